@@ -0,0 +1,128 @@
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "HelloTriangleApplication.h"
+#include "OptionParsing.h"
+
+//Fixed inputs, so results stay comparable between builds whatever the application itself loads
+static const std::string BENCHMARK_MODEL = "models/chalet.obj";
+static const std::string BENCHMARK_TEXTURE = "textures/texture.jpg";
+
+static const double BENCHMARK_TIME_STEP = 1.0 / 60.0;
+
+int main (int argc, char* argv[])
+{
+   ApplicationOptions options;
+   options.headless = true;
+   options.benchmarkSuite = true;
+   options.headlessFrames = 500;
+   options.timeStep = BENCHMARK_TIME_STEP;
+   options.modelPath = BENCHMARK_MODEL;
+   options.texturePath = BENCHMARK_TEXTURE;
+
+   std::string outputPath;
+   std::string baselinePath;
+   double tolerance = 0.1;
+
+   try
+   {
+      for (int i = 1; i < argc; ++i)
+      {
+         std::string arg = argv[i];
+
+         if (arg == "--frames" && i + 1 < argc)
+         {
+            options.headlessFrames = parseUnsigned (arg, argv[++i]);
+         }
+         else if (arg == "--iterations" && i + 1 < argc)
+         {
+            options.benchmarkIterations = parseUnsigned (arg, argv[++i]);
+         }
+         else if (arg == "--draw-count" && i + 1 < argc)
+         {
+            options.drawCount = parseUnsigned (arg, argv[++i]);
+         }
+         else if (arg == "--precomputed-mvp")
+         {
+            options.precomputeTransforms = true;
+         }
+         else if (arg == "--instances" && i + 1 < argc)
+         {
+            options.instanceCount = parseUnsigned (arg, argv[++i]);
+         }
+         else if (arg == "--gpu-culling")
+         {
+            options.gpuCulling = true;
+         }
+         else if (arg == "--gpu-timing")
+         {
+            options.gpuTiming = true;
+         }
+         else if (arg == "--occlusion-culling")
+         {
+            options.gpuCulling = true;
+            options.occlusionCulling = true;
+         }
+         else if (arg == "--output" && i + 1 < argc)
+         {
+            outputPath = argv[++i];
+         }
+         else if (arg == "--baseline" && i + 1 < argc)
+         {
+            baselinePath = argv[++i];
+         }
+         else if (arg == "--tolerance" && i + 1 < argc)
+         {
+            tolerance = parseDouble (arg, argv[++i]);
+         }
+         else
+         {
+            std::cerr << "ignoring unknown option: " << arg << std::endl;
+         }
+      }
+   }
+   catch (const std::runtime_error& e)
+   {
+      std::cerr << e.what () << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   HelloTriangleApplication app (options);
+   try
+   {
+      app.run ();
+   }
+   catch (const std::runtime_error& e)
+   {
+      std::cerr << e.what () << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   const BenchmarkReport& report = app.getBenchmarkReport ();
+
+   if (!outputPath.empty () && !report.write (outputPath))
+   {
+      std::cerr << "failed to write benchmark results!" << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   //A non zero exit code lets a build script fail on a regression
+   if (!baselinePath.empty ())
+   {
+      BenchmarkReport baseline;
+
+      if (!baseline.read (baselinePath))
+      {
+         std::cerr << "failed to read benchmark baseline!" << std::endl;
+         return EXIT_FAILURE;
+      }
+
+      if (!report.compare (baseline, tolerance, std::cerr))
+      {
+         return EXIT_FAILURE;
+      }
+   }
+
+   return EXIT_SUCCESS;
+}
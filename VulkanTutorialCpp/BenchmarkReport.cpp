@@ -0,0 +1,138 @@
+#include "BenchmarkReport.h"
+
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+
+static double readNumber (const std::string& line, const std::string& key)
+{
+   size_t position = line.find ("\"" + key + "\":");
+
+   if (position == std::string::npos)
+   {
+      return 0.0;
+   }
+
+   return std::stod (line.substr (position + key.size () + 3));
+}
+
+void BenchmarkReport::add (const std::string& name, std::vector<double> samplesMilliseconds)
+{
+   BenchmarkResult result;
+   result.name = name;
+   result.iterations = samplesMilliseconds.size ();
+
+   if (!samplesMilliseconds.empty ())
+   {
+      std::sort (samplesMilliseconds.begin (), samplesMilliseconds.end ());
+
+      size_t count = samplesMilliseconds.size ();
+
+      result.meanMilliseconds = std::accumulate (samplesMilliseconds.begin (), samplesMilliseconds.end (), 0.0) / count;
+      result.medianMilliseconds = samplesMilliseconds[count / 2];
+      result.p99Milliseconds = samplesMilliseconds[std::min (count - 1, count * 99 / 100)];
+      result.minMilliseconds = samplesMilliseconds.front ();
+   }
+
+   results.push_back (result);
+}
+
+const std::vector<BenchmarkResult>& BenchmarkReport::getResults () const
+{
+   return results;
+}
+
+void BenchmarkReport::write (std::ostream& out) const
+{
+   out << "{\"results\":[\n";
+
+   for (size_t i = 0; i < results.size (); ++i)
+   {
+      const BenchmarkResult& result = results[i];
+
+      out << "{\"name\":\"" << result.name << "\",\"iterations\":" << result.iterations << ",\"mean_ms\":" << result.meanMilliseconds
+         << ",\"median_ms\":" << result.medianMilliseconds << ",\"p99_ms\":" << result.p99Milliseconds << ",\"min_ms\":" << result.minMilliseconds
+         << "}" << (i + 1 < results.size () ? "," : "") << "\n";
+   }
+
+   out << "]}\n";
+}
+
+bool BenchmarkReport::write (const std::string& filename) const
+{
+   std::ofstream file (filename);
+
+   if (!file.is_open ())
+   {
+      return false;
+   }
+
+   write (file);
+
+   return file.good ();
+}
+
+bool BenchmarkReport::read (const std::string& filename)
+{
+   std::ifstream file (filename);
+
+   if (!file.is_open ())
+   {
+      return false;
+   }
+
+   results.clear ();
+
+   std::string line;
+
+   while (std::getline (file, line))
+   {
+      size_t nameStart = line.find ("\"name\":\"");
+
+      if (nameStart == std::string::npos)
+      {
+         continue;
+      }
+
+      nameStart += 8;
+
+      BenchmarkResult result;
+      result.name = line.substr (nameStart, line.find ('"', nameStart) - nameStart);
+      result.iterations = static_cast<size_t> (readNumber (line, "iterations"));
+      result.meanMilliseconds = readNumber (line, "mean_ms");
+      result.medianMilliseconds = readNumber (line, "median_ms");
+      result.p99Milliseconds = readNumber (line, "p99_ms");
+      result.minMilliseconds = readNumber (line, "min_ms");
+
+      results.push_back (result);
+   }
+
+   return true;
+}
+
+bool BenchmarkReport::compare (const BenchmarkReport& baseline, double tolerance, std::ostream& out) const
+{
+   bool passed = true;
+
+   for (const auto& result : results)
+   {
+      auto previous = std::find_if (baseline.results.begin (), baseline.results.end (), [&] (const BenchmarkResult& other) { return other.name == result.name; });
+
+      if (previous == baseline.results.end () || previous->medianMilliseconds <= 0.0)
+      {
+         continue;
+      }
+
+      double ratio = result.medianMilliseconds / previous->medianMilliseconds;
+
+      if (ratio > 1.0 + tolerance)
+      {
+         out << "regression: " << result.name << " " << previous->medianMilliseconds << " ms -> " << result.medianMilliseconds << " ms ("
+            << (ratio - 1.0) * 100.0 << "% slower)" << std::endl;
+
+         passed = false;
+      }
+   }
+
+   return passed;
+}
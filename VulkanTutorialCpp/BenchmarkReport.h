@@ -0,0 +1,38 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct BenchmarkResult
+{
+   std::string name;
+   size_t iterations;
+   double meanMilliseconds;
+   double medianMilliseconds;
+   double p99Milliseconds;
+   double minMilliseconds;
+
+   BenchmarkResult () : iterations (0), meanMilliseconds (0.0), medianMilliseconds (0.0), p99Milliseconds (0.0), minMilliseconds (0.0) {}
+};
+
+//Results of one benchmark run. Written as JSON with one result per line, which is also the only layout read back, so a
+//baseline from an earlier run can be compared against without a JSON library.
+class BenchmarkReport
+{
+private:
+   std::vector<BenchmarkResult> results;
+
+public:
+   void add (const std::string& name, std::vector<double> samplesMilliseconds);
+
+   const std::vector<BenchmarkResult>& getResults () const;
+
+   void write (std::ostream& out) const;
+   bool write (const std::string& filename) const;
+   bool read (const std::string& filename);
+
+   //Medians are compared, a result slower than the baseline by more than tolerance (0.1 is 10%) is a regression.
+   //Returns false and lists every regression when there is one.
+   bool compare (const BenchmarkReport& baseline, double tolerance, std::ostream& out) const;
+};
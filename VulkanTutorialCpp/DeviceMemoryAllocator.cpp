@@ -0,0 +1,479 @@
+#include "DeviceMemoryAllocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+static vk::DeviceSize alignUp (vk::DeviceSize value, vk::DeviceSize alignment)
+{
+   return (value + alignment - 1) / alignment * alignment;
+}
+
+DeviceMemoryAllocator::DeviceMemoryAllocator () : allocationCallbacks (nullptr), bufferImageGranularity (1), blockSize (DEFAULT_BLOCK_SIZE),
+   getBufferMemoryRequirements2 (nullptr), getImageMemoryRequirements2 (nullptr)
+{
+}
+
+void DeviceMemoryAllocator::init (vk::PhysicalDevice physicalDevice, vk::Device device, const vk::AllocationCallbacks* allocationCallbacks, bool dedicatedAllocation, vk::DeviceSize blockSize)
+{
+   this->physicalDevice = physicalDevice;
+   this->device = device;
+   this->allocationCallbacks = allocationCallbacks;
+   this->blockSize = blockSize;
+
+   physicalDevice.getMemoryProperties (&memoryProperties);
+   bufferImageGranularity = physicalDevice.getProperties ().limits.bufferImageGranularity;
+
+   if (dedicatedAllocation)
+   {
+      getBufferMemoryRequirements2 = (PFN_vkGetBufferMemoryRequirements2KHR) device.getProcAddr ("vkGetBufferMemoryRequirements2KHR");
+      getImageMemoryRequirements2 = (PFN_vkGetImageMemoryRequirements2KHR) device.getProcAddr ("vkGetImageMemoryRequirements2KHR");
+   }
+}
+
+void DeviceMemoryAllocator::destroy ()
+{
+   for (uint32_t i = 0; i < blocks.size (); ++i)
+   {
+      destroyBlock (i);
+   }
+
+   blocks.clear ();
+}
+
+MemoryAllocation DeviceMemoryAllocator::allocateForBuffer (vk::Buffer buffer, vk::MemoryPropertyFlags properties)
+{
+   vk::MemoryRequirements requirements;
+   bool requiresDedicated = false;
+   bool prefersDedicated = false;
+
+   if (getBufferMemoryRequirements2)
+   {
+      VkBufferMemoryRequirementsInfo2KHR info = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2_KHR};
+      info.buffer = VkBuffer (buffer);
+
+      VkMemoryDedicatedRequirementsKHR dedicatedRequirements = {VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS_KHR};
+
+      VkMemoryRequirements2KHR requirements2 = {VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2_KHR};
+      requirements2.pNext = &dedicatedRequirements;
+
+      getBufferMemoryRequirements2 (VkDevice (device), &info, &requirements2);
+
+      requirements = vk::MemoryRequirements (requirements2.memoryRequirements);
+      requiresDedicated = dedicatedRequirements.requiresDedicatedAllocation == VK_TRUE;
+      prefersDedicated = dedicatedRequirements.prefersDedicatedAllocation == VK_TRUE;
+   }
+   else
+   {
+      device.getBufferMemoryRequirements (buffer, &requirements);
+   }
+
+   AllocationStrategy strategy = chooseStrategy (requirements, requiresDedicated, prefersDedicated);
+
+   if (strategy == AllocationStrategy::eSubAllocated)
+   {
+      return allocate (requirements, properties);
+   }
+
+   return allocateDedicated (requirements, properties, strategy, buffer, vk::Image ());
+}
+
+MemoryAllocation DeviceMemoryAllocator::allocateForImage (vk::Image image, vk::MemoryPropertyFlags properties)
+{
+   vk::MemoryRequirements requirements;
+   bool requiresDedicated = false;
+   bool prefersDedicated = false;
+
+   if (getImageMemoryRequirements2)
+   {
+      VkImageMemoryRequirementsInfo2KHR info = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2_KHR};
+      info.image = VkImage (image);
+
+      VkMemoryDedicatedRequirementsKHR dedicatedRequirements = {VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS_KHR};
+
+      VkMemoryRequirements2KHR requirements2 = {VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2_KHR};
+      requirements2.pNext = &dedicatedRequirements;
+
+      getImageMemoryRequirements2 (VkDevice (device), &info, &requirements2);
+
+      requirements = vk::MemoryRequirements (requirements2.memoryRequirements);
+      requiresDedicated = dedicatedRequirements.requiresDedicatedAllocation == VK_TRUE;
+      prefersDedicated = dedicatedRequirements.prefersDedicatedAllocation == VK_TRUE;
+   }
+   else
+   {
+      device.getImageMemoryRequirements (image, &requirements);
+   }
+
+   AllocationStrategy strategy = chooseStrategy (requirements, requiresDedicated, prefersDedicated);
+
+   if (strategy == AllocationStrategy::eSubAllocated)
+   {
+      return allocate (requirements, properties);
+   }
+
+   return allocateDedicated (requirements, properties, strategy, vk::Buffer (), image);
+}
+
+MemoryAllocation DeviceMemoryAllocator::allocate (const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties)
+{
+   MemoryAllocation allocation;
+
+   if (tryAllocate (requirements, properties, allocation))
+   {
+      return allocation;
+   }
+
+   uint32_t memoryTypeIndex = findMemoryType (requirements.memoryTypeBits, properties);
+   vk::DeviceSize alignment = std::max (requirements.alignment, bufferImageGranularity);
+   vk::DeviceSize size = alignUp (requirements.size, bufferImageGranularity);
+
+   uint32_t blockIndex = createBlock (memoryTypeIndex, std::max (blockSize, size));
+
+   if (!allocateFromBlock (blockIndex, size, alignment, allocation))
+   {
+      throw std::runtime_error ("failed to allocate memory from a new block!");
+   }
+
+   return allocation;
+}
+
+bool DeviceMemoryAllocator::tryAllocate (const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties, MemoryAllocation& allocation)
+{
+   uint32_t memoryTypeIndex = findMemoryType (requirements.memoryTypeBits, properties);
+
+   //Linear and optimal resources share blocks, padding every allocation to the granularity keeps them on separate pages
+   vk::DeviceSize alignment = std::max (requirements.alignment, bufferImageGranularity);
+   vk::DeviceSize size = alignUp (requirements.size, bufferImageGranularity);
+
+   for (uint32_t i = 0; i < blocks.size (); ++i)
+   {
+      if (blocks[i].memory && blocks[i].strategy == AllocationStrategy::eSubAllocated && blocks[i].memoryTypeIndex == memoryTypeIndex
+          && !blocks[i].defragmentationSource && allocateFromBlock (i, size, alignment, allocation))
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+void DeviceMemoryAllocator::free (MemoryAllocation& allocation)
+{
+   if (!allocation.memory)
+   {
+      return;
+   }
+
+   MemoryBlock& block = blocks[allocation.blockIndex];
+
+   if (block.strategy != AllocationStrategy::eSubAllocated)
+   {
+      destroyBlock (allocation.blockIndex);
+      allocation = MemoryAllocation ();
+      return;
+   }
+
+   auto next = std::find_if (block.freeRanges.begin (), block.freeRanges.end (),
+                             [&] (const FreeRange& range) { return range.offset > allocation.offset; });
+
+   next = block.freeRanges.insert (next, {allocation.offset, allocation.size});
+
+   if (std::next (next) != block.freeRanges.end () && next->offset + next->size == std::next (next)->offset)
+   {
+      next->size += std::next (next)->size;
+      block.freeRanges.erase (std::next (next));
+   }
+
+   if (next != block.freeRanges.begin () && std::prev (next)->offset + std::prev (next)->size == next->offset)
+   {
+      std::prev (next)->size += next->size;
+      block.freeRanges.erase (next);
+   }
+
+   block.usedBytes -= allocation.size;
+   --block.allocationCount;
+
+   if (block.allocationCount == 0)
+   {
+      //Keep one empty block per memory type around so a single load/unload does not hit vkAllocateMemory every time
+      bool otherBlockOfType = std::any_of (blocks.begin (), blocks.end (), [&] (const MemoryBlock& other)
+      {
+         return &other != &block && other.memory && other.strategy == AllocationStrategy::eSubAllocated && other.memoryTypeIndex == block.memoryTypeIndex;
+      });
+
+      if (otherBlockOfType || block.defragmentationSource)
+      {
+         destroyBlock (allocation.blockIndex);
+      }
+   }
+
+   allocation = MemoryAllocation ();
+}
+
+uint32_t DeviceMemoryAllocator::findMemoryType (uint32_t typeFilter, vk::MemoryPropertyFlags properties) const
+{
+   uint32_t typeIndex;
+
+   if (!tryFindMemoryType (typeFilter, properties, typeIndex))
+   {
+      throw std::runtime_error ("failed to find suitable memory type!");
+   }
+
+   return typeIndex;
+}
+
+bool DeviceMemoryAllocator::tryFindMemoryType (uint32_t typeFilter, vk::MemoryPropertyFlags properties, uint32_t& typeIndex) const
+{
+   for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+   {
+      if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+      {
+         typeIndex = i;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+bool DeviceMemoryAllocator::beginDefragmentation (float maxOccupancy)
+{
+   bool anySource = false;
+
+   for (uint32_t type = 0; type < memoryProperties.memoryTypeCount; ++type)
+   {
+      std::vector<uint32_t> typeBlocks;
+
+      for (uint32_t i = 0; i < blocks.size (); ++i)
+      {
+         if (blocks[i].memory && blocks[i].strategy == AllocationStrategy::eSubAllocated && blocks[i].memoryTypeIndex == type)
+         {
+            typeBlocks.push_back (i);
+         }
+      }
+
+      if (typeBlocks.size () < 2)
+      {
+         continue;
+      }
+
+      std::sort (typeBlocks.begin (), typeBlocks.end (), [&] (uint32_t a, uint32_t b)
+      {
+         return blocks[a].usedBytes * blocks[b].size < blocks[b].usedBytes * blocks[a].size;
+      });
+
+      //The fullest block is never a source so there is always somewhere to move to
+      for (size_t i = 0; i + 1 < typeBlocks.size (); ++i)
+      {
+         MemoryBlock& block = blocks[typeBlocks[i]];
+
+         if (static_cast<float> (block.usedBytes) / block.size < maxOccupancy)
+         {
+            block.defragmentationSource = true;
+            anySource = true;
+         }
+      }
+   }
+
+   return anySource;
+}
+
+bool DeviceMemoryAllocator::isDefragmentationSource (const MemoryAllocation& allocation) const
+{
+   return allocation.memory && blocks[allocation.blockIndex].defragmentationSource;
+}
+
+void DeviceMemoryAllocator::endDefragmentation ()
+{
+   for (auto& block : blocks)
+   {
+      block.defragmentationSource = false;
+   }
+}
+
+MemoryStatistics DeviceMemoryAllocator::getStatistics () const
+{
+   MemoryStatistics statistics;
+
+   for (const auto& block : blocks)
+   {
+      if (!block.memory)
+      {
+         continue;
+      }
+
+      switch (block.strategy)
+      {
+      case AllocationStrategy::eSubAllocated:
+         ++statistics.blockCount;
+         statistics.allocationCount += block.allocationCount;
+         statistics.blockBytes += block.size;
+         statistics.usedBytes += block.usedBytes;
+         continue;
+      case AllocationStrategy::eDedicatedRequired:
+         ++statistics.dedicatedRequiredCount;
+         break;
+      case AllocationStrategy::eDedicatedPreferred:
+         ++statistics.dedicatedPreferredCount;
+         break;
+      case AllocationStrategy::eDedicatedLarge:
+         ++statistics.dedicatedLargeCount;
+         break;
+      }
+
+      ++statistics.dedicatedAllocationCount;
+      statistics.dedicatedBytes += block.size;
+   }
+
+   return statistics;
+}
+
+AllocationStrategy DeviceMemoryAllocator::chooseStrategy (const vk::MemoryRequirements& requirements, bool requiresDedicated, bool prefersDedicated) const
+{
+   if (requiresDedicated)
+   {
+      return AllocationStrategy::eDedicatedRequired;
+   }
+
+   if (prefersDedicated)
+   {
+      return AllocationStrategy::eDedicatedPreferred;
+   }
+
+   //Large resources would pin most of a block on their own and make it a poor compaction candidate
+   if (requirements.size >= DEDICATED_ALLOCATION_THRESHOLD)
+   {
+      return AllocationStrategy::eDedicatedLarge;
+   }
+
+   return AllocationStrategy::eSubAllocated;
+}
+
+MemoryAllocation DeviceMemoryAllocator::allocateDedicated (const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties, AllocationStrategy strategy,
+                                                           vk::Buffer buffer, vk::Image image)
+{
+   uint32_t memoryTypeIndex = findMemoryType (requirements.memoryTypeBits, properties);
+   uint32_t blockIndex = createBlock (memoryTypeIndex, requirements.size, strategy, buffer, image);
+
+   MemoryAllocation allocation;
+
+   if (!allocateFromBlock (blockIndex, requirements.size, 1, allocation))
+   {
+      throw std::runtime_error ("failed to allocate dedicated memory!");
+   }
+
+   allocation.strategy = strategy;
+
+   return allocation;
+}
+
+bool DeviceMemoryAllocator::allocateFromBlock (uint32_t blockIndex, vk::DeviceSize size, vk::DeviceSize alignment, MemoryAllocation& allocation)
+{
+   MemoryBlock& block = blocks[blockIndex];
+
+   for (auto range = block.freeRanges.begin (); range != block.freeRanges.end (); ++range)
+   {
+      vk::DeviceSize offset = alignUp (range->offset, alignment);
+      vk::DeviceSize padding = offset - range->offset;
+
+      if (padding + size > range->size)
+      {
+         continue;
+      }
+
+      FreeRange tail = {offset + size, range->size - padding - size};
+
+      //The alignment padding in front stays free
+      if (padding > 0)
+      {
+         range->size = padding;
+         ++range;
+      }
+      else
+      {
+         range = block.freeRanges.erase (range);
+      }
+
+      if (tail.size > 0)
+      {
+         block.freeRanges.insert (range, tail);
+      }
+
+      block.usedBytes += size;
+      ++block.allocationCount;
+
+      allocation.memory = block.memory;
+      allocation.offset = offset;
+      allocation.size = size;
+      allocation.memoryTypeIndex = block.memoryTypeIndex;
+      allocation.blockIndex = blockIndex;
+      allocation.mappedData = block.mappedData ? static_cast<char*> (block.mappedData) + offset : nullptr;
+
+      return true;
+   }
+
+   return false;
+}
+
+uint32_t DeviceMemoryAllocator::createBlock (uint32_t memoryTypeIndex, vk::DeviceSize size, AllocationStrategy strategy, vk::Buffer dedicatedBuffer, vk::Image dedicatedImage)
+{
+   MemoryBlock block = {};
+   block.size = size;
+   block.memoryTypeIndex = memoryTypeIndex;
+   block.strategy = strategy;
+   block.freeRanges.push_back ({0, size});
+
+   vk::MemoryAllocateInfo allocInfo = {};
+   allocInfo.allocationSize = size;
+   allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+   //Without the extension a dedicated block is still its own vkAllocateMemory, the driver just is not told who owns it
+   VkMemoryDedicatedAllocateInfoKHR dedicatedInfo = {VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO_KHR};
+   dedicatedInfo.buffer = VkBuffer (dedicatedBuffer);
+   dedicatedInfo.image = VkImage (dedicatedImage);
+
+   if (strategy != AllocationStrategy::eSubAllocated && getBufferMemoryRequirements2)
+   {
+      allocInfo.pNext = &dedicatedInfo;
+   }
+
+   if (device.allocateMemory (&allocInfo, allocationCallbacks, &block.memory) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to allocate device memory block!");
+   }
+
+   if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+   {
+      block.mappedData = device.mapMemory (block.memory, 0, size);
+   }
+
+   auto emptySlot = std::find_if (blocks.begin (), blocks.end (), [] (const MemoryBlock& other) { return !other.memory; });
+
+   if (emptySlot != blocks.end ())
+   {
+      *emptySlot = block;
+      return static_cast<uint32_t> (emptySlot - blocks.begin ());
+   }
+
+   blocks.push_back (block);
+   return static_cast<uint32_t> (blocks.size () - 1);
+}
+
+void DeviceMemoryAllocator::destroyBlock (uint32_t blockIndex)
+{
+   MemoryBlock& block = blocks[blockIndex];
+
+   if (!block.memory)
+   {
+      return;
+   }
+
+   if (block.mappedData)
+   {
+      device.unmapMemory (block.memory);
+   }
+
+   device.freeMemory (block.memory, allocationCallbacks);
+
+   block = MemoryBlock ();
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+//Why a resource did or did not get a vkAllocateMemory of its own
+enum class AllocationStrategy
+{
+   eSubAllocated,
+   eDedicatedRequired,
+   eDedicatedPreferred,
+   eDedicatedLarge
+};
+
+struct MemoryAllocation
+{
+   vk::DeviceMemory memory;
+   vk::DeviceSize offset;
+   vk::DeviceSize size;
+   uint32_t memoryTypeIndex;
+   uint32_t blockIndex;
+   void* mappedData;
+   AllocationStrategy strategy;
+
+   MemoryAllocation () : offset (0), size (0), memoryTypeIndex (0), blockIndex (0), mappedData (nullptr), strategy (AllocationStrategy::eSubAllocated) {}
+};
+
+struct MemoryStatistics
+{
+   uint32_t blockCount;
+   uint32_t allocationCount;
+   vk::DeviceSize blockBytes;
+   vk::DeviceSize usedBytes;
+
+   //Dedicated allocations are not part of the block counts above
+   uint32_t dedicatedAllocationCount;
+   uint32_t dedicatedRequiredCount;
+   uint32_t dedicatedPreferredCount;
+   uint32_t dedicatedLargeCount;
+   vk::DeviceSize dedicatedBytes;
+
+   MemoryStatistics () : blockCount (0), allocationCount (0), blockBytes (0), usedBytes (0),
+      dedicatedAllocationCount (0), dedicatedRequiredCount (0), dedicatedPreferredCount (0), dedicatedLargeCount (0), dedicatedBytes (0) {}
+};
+
+//Sub-allocates buffers and images out of large per memory type blocks instead of one vkAllocateMemory per resource.
+//Host visible blocks stay persistently mapped, each allocation carries a pointer into the mapping. Resources the driver
+//asks to be dedicated through VK_KHR_dedicated_allocation, and large ones, get a block of their own instead.
+class DeviceMemoryAllocator
+{
+private:
+
+   struct FreeRange
+   {
+      vk::DeviceSize offset;
+      vk::DeviceSize size;
+   };
+
+   struct MemoryBlock
+   {
+      vk::DeviceMemory memory;
+      vk::DeviceSize size;
+      vk::DeviceSize usedBytes;
+      uint32_t memoryTypeIndex;
+      uint32_t allocationCount;
+      void* mappedData;
+      bool defragmentationSource;
+      AllocationStrategy strategy; //Anything but eSubAllocated holds exactly one resource
+      std::vector<FreeRange> freeRanges; //Sorted by offset, neighbours are always merged
+   };
+
+   vk::PhysicalDevice physicalDevice;
+   vk::Device device;
+   const vk::AllocationCallbacks* allocationCallbacks;
+   vk::PhysicalDeviceMemoryProperties memoryProperties;
+   vk::DeviceSize bufferImageGranularity;
+   vk::DeviceSize blockSize;
+
+   PFN_vkGetBufferMemoryRequirements2KHR getBufferMemoryRequirements2; //Null unless VK_KHR_dedicated_allocation is enabled
+   PFN_vkGetImageMemoryRequirements2KHR getImageMemoryRequirements2;
+
+   std::vector<MemoryBlock> blocks; //Destroyed blocks leave an empty slot so block indices stay stable
+
+public:
+   static const vk::DeviceSize DEFAULT_BLOCK_SIZE = 32 * 1024 * 1024;
+   static const vk::DeviceSize DEDICATED_ALLOCATION_THRESHOLD = 4 * 1024 * 1024;
+
+   DeviceMemoryAllocator ();
+
+   //dedicatedAllocation must only be set if the device was created with VK_KHR_get_memory_requirements2 and VK_KHR_dedicated_allocation
+   void init (vk::PhysicalDevice physicalDevice, vk::Device device, const vk::AllocationCallbacks* allocationCallbacks,
+              bool dedicatedAllocation, vk::DeviceSize blockSize = DEFAULT_BLOCK_SIZE);
+   void destroy ();
+
+   //Query the resource's requirements and decide between a dedicated allocation and the sub-allocator
+   MemoryAllocation allocateForBuffer (vk::Buffer buffer, vk::MemoryPropertyFlags properties);
+   MemoryAllocation allocateForImage (vk::Image image, vk::MemoryPropertyFlags properties);
+
+   MemoryAllocation allocate (const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties);
+   bool tryAllocate (const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties, MemoryAllocation& allocation); //Never grows
+   void free (MemoryAllocation& allocation);
+
+   uint32_t findMemoryType (uint32_t typeFilter, vk::MemoryPropertyFlags properties) const;
+   bool tryFindMemoryType (uint32_t typeFilter, vk::MemoryPropertyFlags properties, uint32_t& typeIndex) const;
+
+   //Marks the sparsest blocks of every memory type that owns more than one block as sources. Allocations that live in a
+   //source block should be moved elsewhere by the caller, the block is released once its last allocation is freed.
+   bool beginDefragmentation (float maxOccupancy);
+   bool isDefragmentationSource (const MemoryAllocation& allocation) const;
+   void endDefragmentation ();
+
+   MemoryStatistics getStatistics () const;
+
+private:
+   AllocationStrategy chooseStrategy (const vk::MemoryRequirements& requirements, bool requiresDedicated, bool prefersDedicated) const;
+   MemoryAllocation allocateDedicated (const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties, AllocationStrategy strategy,
+                                       vk::Buffer buffer, vk::Image image);
+   bool allocateFromBlock (uint32_t blockIndex, vk::DeviceSize size, vk::DeviceSize alignment, MemoryAllocation& allocation);
+   uint32_t createBlock (uint32_t memoryTypeIndex, vk::DeviceSize size, AllocationStrategy strategy = AllocationStrategy::eSubAllocated,
+                         vk::Buffer dedicatedBuffer = vk::Buffer (), vk::Image dedicatedImage = vk::Image ());
+   void destroyBlock (uint32_t blockIndex);
+};
@@ -0,0 +1,138 @@
+#include "DrawListCache.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+DrawListCache::DrawListCache () : allocationCallbacks (nullptr), queueFamilyIndex (0), drawsPerChunk (1), bindingsVersion (0)
+{
+}
+
+void DrawListCache::init (vk::Device device, const vk::AllocationCallbacks* allocationCallbacks, uint32_t queueFamilyIndex,
+                          uint32_t frameCount, size_t drawCount, size_t drawsPerChunk)
+{
+   this->device = device;
+   this->allocationCallbacks = allocationCallbacks;
+   this->queueFamilyIndex = queueFamilyIndex;
+   this->drawsPerChunk = std::max<size_t> (drawsPerChunk, 1);
+
+   size_t chunkCount = (drawCount + this->drawsPerChunk - 1) / this->drawsPerChunk;
+
+   chunks.resize (chunkCount);
+
+   for (size_t i = 0; i < chunkCount; ++i)
+   {
+      chunks[i].firstDraw = i * this->drawsPerChunk;
+      chunks[i].lastDraw = std::min (drawCount, (i + 1) * this->drawsPerChunk);
+      chunks[i].version = 0;
+   }
+
+   //The command buffers are reset through their pool, which is cheaper than resetting them individually
+   vk::CommandPoolCreateInfo poolInfo = {};
+   poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+   vk::CommandBufferAllocateInfo allocInfo = {};
+   allocInfo.level = vk::CommandBufferLevel::eSecondary;
+   allocInfo.commandBufferCount = 1;
+
+   frames.resize (frameCount);
+
+   for (auto& frame : frames)
+   {
+      frame.chunks.resize (chunkCount);
+      frame.commandBuffers.resize (chunkCount);
+
+      for (size_t i = 0; i < chunkCount; ++i)
+      {
+         frame.chunks[i].recorded = false;
+
+         if (device.createCommandPool (&poolInfo, allocationCallbacks, &frame.chunks[i].commandPool) != vk::Result::eSuccess)
+         {
+            throw std::runtime_error ("failed to create command pool!");
+         }
+
+         allocInfo.commandPool = frame.chunks[i].commandPool;
+
+         if (device.allocateCommandBuffers (&allocInfo, &frame.commandBuffers[i]) != vk::Result::eSuccess)
+         {
+            throw std::runtime_error ("failed to allocate command buffers!");
+         }
+      }
+   }
+
+   statistics = DrawListCacheStatistics ();
+}
+
+void DrawListCache::destroy ()
+{
+   for (auto& frame : frames)
+   {
+      for (auto& chunk : frame.chunks)
+      {
+         device.destroyCommandPool (chunk.commandPool, allocationCallbacks);
+      }
+   }
+
+   frames.clear ();
+   chunks.clear ();
+}
+
+void DrawListCache::invalidateDraw (size_t drawIndex)
+{
+   ++chunks[drawIndex / drawsPerChunk].version;
+}
+
+void DrawListCache::invalidateAll ()
+{
+   ++bindingsVersion;
+}
+
+void DrawListCache::collectStaleChunks (uint32_t frameIndex, std::vector<size_t>& staleChunks)
+{
+   FrameCache& frame = frames[frameIndex];
+
+   staleChunks.clear ();
+
+   for (size_t i = 0; i < chunks.size (); ++i)
+   {
+      const CachedChunk& cached = frame.chunks[i];
+
+      if (!cached.recorded || cached.chunkVersion != chunks[i].version || cached.bindingsVersion != bindingsVersion)
+      {
+         staleChunks.push_back (i);
+      }
+   }
+
+   statistics.frameMisses = staleChunks.size ();
+   statistics.frameHits = chunks.size () - staleChunks.size ();
+   statistics.totalMisses += statistics.frameMisses;
+   statistics.totalHits += statistics.frameHits;
+}
+
+vk::CommandBuffer DrawListCache::beginChunk (uint32_t frameIndex, size_t chunkIndex)
+{
+   CachedChunk& cached = frames[frameIndex].chunks[chunkIndex];
+
+   device.resetCommandPool (cached.commandPool, vk::CommandPoolResetFlags ());
+
+   cached.recorded = true;
+   cached.chunkVersion = chunks[chunkIndex].version;
+   cached.bindingsVersion = bindingsVersion;
+
+   return frames[frameIndex].commandBuffers[chunkIndex];
+}
+
+void DrawListCache::getChunkDraws (size_t chunkIndex, size_t& firstDraw, size_t& lastDraw) const
+{
+   firstDraw = chunks[chunkIndex].firstDraw;
+   lastDraw = chunks[chunkIndex].lastDraw;
+}
+
+const std::vector<vk::CommandBuffer>& DrawListCache::getCommandBuffers (uint32_t frameIndex) const
+{
+   return frames[frameIndex].commandBuffers;
+}
+
+DrawListCacheStatistics DrawListCache::getStatistics () const
+{
+   return statistics;
+}
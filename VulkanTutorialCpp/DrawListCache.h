@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+struct DrawListCacheStatistics
+{
+   size_t frameHits; //Chunks replayed from the cache by the last frame
+   size_t frameMisses; //Chunks the last frame had to re-record
+   uint64_t totalHits;
+   uint64_t totalMisses;
+
+   DrawListCacheStatistics () : frameHits (0), frameMisses (0), totalHits (0), totalMisses (0) {}
+};
+
+//Keeps a secondary command buffer per chunk of the draw list and frame slot, and tracks which ones are stale. A chunk
+//goes stale when one of its draws changes, and every chunk does when the pipeline or a bound resource is replaced.
+//Each cached command buffer has its own pool, so stale chunks can be re-recorded on any thread.
+class DrawListCache
+{
+private:
+
+   struct Chunk
+   {
+      size_t firstDraw;
+      size_t lastDraw;
+      uint64_t version; //Bumped whenever a draw in the chunk changes
+   };
+
+   struct CachedChunk
+   {
+      vk::CommandPool commandPool;
+      bool recorded;
+      uint64_t chunkVersion; //Versions the command buffer was recorded against
+      uint64_t bindingsVersion;
+   };
+
+   struct FrameCache
+   {
+      std::vector<CachedChunk> chunks;
+      std::vector<vk::CommandBuffer> commandBuffers; //Parallel to chunks, ready to pass to executeCommands
+   };
+
+   vk::Device device;
+   const vk::AllocationCallbacks* allocationCallbacks;
+   uint32_t queueFamilyIndex;
+
+   size_t drawsPerChunk;
+   std::vector<Chunk> chunks;
+   std::vector<FrameCache> frames;
+   uint64_t bindingsVersion;
+
+   DrawListCacheStatistics statistics;
+
+public:
+   DrawListCache ();
+
+   void init (vk::Device device, const vk::AllocationCallbacks* allocationCallbacks, uint32_t queueFamilyIndex,
+              uint32_t frameCount, size_t drawCount, size_t drawsPerChunk);
+   void destroy ();
+
+   void invalidateDraw (size_t drawIndex);
+   void invalidateAll (); //The pipeline, descriptor set or a vertex or index buffer was replaced
+
+   //Returns the chunks of this frame slot that need recording, and counts the rest as hits
+   void collectStaleChunks (uint32_t frameIndex, std::vector<size_t>& staleChunks);
+
+   //Resets the chunk's command buffer so it can be recorded again. The GPU must be done with the frame slot, and the
+   //chunk may only be recorded by one thread at a time.
+   vk::CommandBuffer beginChunk (uint32_t frameIndex, size_t chunkIndex);
+
+   void getChunkDraws (size_t chunkIndex, size_t& firstDraw, size_t& lastDraw) const;
+   const std::vector<vk::CommandBuffer>& getCommandBuffers (uint32_t frameIndex) const;
+
+   DrawListCacheStatistics getStatistics () const;
+};
@@ -0,0 +1,76 @@
+#include "FrameCommandPools.h"
+
+#include <stdexcept>
+
+FrameCommandPools::FrameCommandPools () : allocationCallbacks (nullptr), currentFrame (0)
+{
+}
+
+void FrameCommandPools::init (vk::Device device, const vk::AllocationCallbacks* allocationCallbacks, uint32_t queueFamilyIndex, uint32_t frameCount)
+{
+   this->device = device;
+   this->allocationCallbacks = allocationCallbacks;
+
+   vk::CommandPoolCreateInfo poolInfo = {};
+   poolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+   poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+   frames.resize (frameCount);
+
+   for (auto& frame : frames)
+   {
+      frame.primaryInUse = 0;
+
+      if (device.createCommandPool (&poolInfo, allocationCallbacks, &frame.commandPool) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to create command pool!");
+      }
+   }
+
+   currentFrame = 0;
+}
+
+void FrameCommandPools::destroy ()
+{
+   //Destroying a pool frees its command buffers
+   for (auto& frame : frames)
+   {
+      device.destroyCommandPool (frame.commandPool, allocationCallbacks);
+   }
+
+   frames.clear ();
+}
+
+void FrameCommandPools::beginFrame (uint32_t frameIndex)
+{
+   currentFrame = frameIndex;
+
+   FramePool& frame = frames[currentFrame];
+
+   device.resetCommandPool (frame.commandPool, vk::CommandPoolResetFlags ());
+   frame.primaryInUse = 0;
+}
+
+vk::CommandBuffer FrameCommandPools::allocate ()
+{
+   FramePool& frame = frames[currentFrame];
+
+   if (frame.primaryInUse == frame.primary.size ())
+   {
+      vk::CommandBufferAllocateInfo allocInfo = {};
+      allocInfo.commandPool = frame.commandPool;
+      allocInfo.level = vk::CommandBufferLevel::ePrimary;
+      allocInfo.commandBufferCount = 1;
+
+      vk::CommandBuffer commandBuffer;
+
+      if (device.allocateCommandBuffers (&allocInfo, &commandBuffer) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to allocate command buffers!");
+      }
+
+      frame.primary.push_back (commandBuffer);
+   }
+
+   return frame.primary[frame.primaryInUse++];
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+//One transient command pool per frame slot for the main thread's primary command buffers. When a slot comes around again
+//its pool is reset in one call and every command buffer allocated from it goes back on the free list, nothing is freed
+//individually. The draws are recorded into secondaries that DrawListCache keeps across frames.
+class FrameCommandPools
+{
+private:
+
+   struct FramePool
+   {
+      vk::CommandPool commandPool;
+      std::vector<vk::CommandBuffer> primary; //Everything ever allocated, the first primaryInUse are handed out
+      size_t primaryInUse;
+   };
+
+   vk::Device device;
+   const vk::AllocationCallbacks* allocationCallbacks;
+
+   std::vector<FramePool> frames; //Indexed by frame slot
+   uint32_t currentFrame;
+
+public:
+   FrameCommandPools ();
+
+   void init (vk::Device device, const vk::AllocationCallbacks* allocationCallbacks, uint32_t queueFamilyIndex, uint32_t frameCount);
+   void destroy ();
+
+   //The caller guarantees the GPU has finished with everything recorded the last time this slot was used
+   void beginFrame (uint32_t frameIndex);
+
+   vk::CommandBuffer allocate ();
+};
@@ -0,0 +1,88 @@
+#include "FramePacer.h"
+
+#include <thread>
+
+//Sleeping is only accurate to the scheduler tick, so the last stretch before a deadline is spent yielding instead
+static const std::chrono::microseconds SPIN_THRESHOLD (2000);
+
+FramePacer::FramePacer (size_t windowSize) : framePeriod (0), hasLastPresent (false), frameTimes (windowSize), latencies (windowSize)
+{
+}
+
+void FramePacer::setTargetFrameRate (double framesPerSecond)
+{
+   if (framesPerSecond > 0.0)
+   {
+      framePeriod = std::chrono::duration_cast<Clock::duration> (std::chrono::duration<double> (1.0 / framesPerSecond));
+   }
+   else
+   {
+      framePeriod = Clock::duration (0);
+   }
+
+   reset ();
+}
+
+void FramePacer::reset ()
+{
+   nextFrame = Clock::now ();
+   hasLastPresent = false;
+   frameTimes.reset ();
+   latencies.reset ();
+}
+
+void FramePacer::beginFrame ()
+{
+   if (framePeriod != Clock::duration (0))
+   {
+      Clock::time_point now = Clock::now ();
+
+      if (nextFrame - now > SPIN_THRESHOLD)
+      {
+         std::this_thread::sleep_until (nextFrame - SPIN_THRESHOLD);
+      }
+
+      while (Clock::now () < nextFrame)
+      {
+         std::this_thread::yield ();
+      }
+
+      //A frame that ran long moves the schedule instead of being made up with a burst of short frames
+      nextFrame += framePeriod;
+      now = Clock::now ();
+
+      if (nextFrame < now)
+      {
+         nextFrame = now + framePeriod;
+      }
+   }
+
+   frameStart = Clock::now ();
+}
+
+void FramePacer::endFrame ()
+{
+   Clock::time_point now = Clock::now ();
+
+   if (hasLastPresent)
+   {
+      frameTimes.add (std::chrono::duration<double, std::milli> (now - lastPresent).count ());
+      latencies.add (std::chrono::duration<double, std::milli> (now - frameStart).count ());
+   }
+
+   lastPresent = now;
+   hasLastPresent = true;
+}
+
+FramePacingStatistics FramePacer::getStatistics () const
+{
+   FramePacingStatistics statistics;
+   statistics.sampleCount = frameTimes.getCount ();
+   statistics.meanFrameMilliseconds = frameTimes.getMean ();
+   statistics.jitterMilliseconds = frameTimes.getStandardDeviation ();
+   statistics.worstFrameMilliseconds = frameTimes.getMax ();
+   statistics.meanLatencyMilliseconds = latencies.getMean ();
+   statistics.p99LatencyMilliseconds = latencies.getPercentile (99.0);
+
+   return statistics;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <chrono>
+
+#include "RollingStatistics.h"
+
+struct FramePacingStatistics
+{
+   size_t sampleCount;
+   double meanFrameMilliseconds; //Present to present
+   double jitterMilliseconds; //Standard deviation of the frame time
+   double worstFrameMilliseconds;
+   double meanLatencyMilliseconds; //Frame start, where input and time are sampled, to the return of the present call
+   double p99LatencyMilliseconds;
+
+   FramePacingStatistics () : sampleCount (0), meanFrameMilliseconds (0.0), jitterMilliseconds (0.0), worstFrameMilliseconds (0.0),
+      meanLatencyMilliseconds (0.0), p99LatencyMilliseconds (0.0) {}
+};
+
+//CPU side frame limiter. beginFrame sleeps until the next frame is due, so a capped frame rate leaves the CPU idle
+//instead of letting it run ahead and block in the present queue, which also keeps the latency from input to present
+//low. The latency measured here ends when the present call returns, the display itself is not observable from Vulkan 1.0.
+class FramePacer
+{
+private:
+   typedef std::chrono::high_resolution_clock Clock;
+
+   Clock::duration framePeriod; //Zero when unlimited
+   Clock::time_point nextFrame;
+   Clock::time_point frameStart;
+   Clock::time_point lastPresent;
+   bool hasLastPresent;
+
+   RollingStatistics frameTimes; //Milliseconds
+   RollingStatistics latencies;
+
+public:
+   explicit FramePacer (size_t windowSize = 600);
+
+   void setTargetFrameRate (double framesPerSecond); //0 disables the limiter
+   void reset ();
+
+   void beginFrame ();
+   void endFrame (); //Right after the frame was presented
+
+   FramePacingStatistics getStatistics () const;
+};
@@ -0,0 +1,835 @@
+#include "GpuCuller.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+static const uint32_t WORKGROUP_SIZE = 64; //local_size_x in cull.comp
+static const uint32_t REDUCE_WORKGROUP_SIZE = 8; //local_size_x and local_size_y in depth_reduce.comp
+
+static const vk::DeviceSize DRAW_COMMANDS_OFFSET = 16; //The counts come first in each slot: visible early, visible late, frustum culled, occluded
+
+static vk::DeviceSize alignUp (vk::DeviceSize value, vk::DeviceSize alignment)
+{
+   return (value + alignment - 1) / alignment * alignment;
+}
+
+static uint32_t previousPowerOfTwo (uint32_t value)
+{
+   uint32_t result = 1;
+
+   while (result * 2 <= value)
+   {
+      result *= 2;
+   }
+
+   return result;
+}
+
+static uint32_t phaseIndex (CullPhase phase)
+{
+   return phase == CullPhase::eLate ? 1 : 0;
+}
+
+GpuCuller::GpuCuller () : allocationCallbacks (nullptr), memoryAllocator (nullptr), occlusionCulling (false), occlusionTest (true),
+   visibleInstanceStride (0), drawCommandStride (0), drawModelStride (0), parameterStride (0), visibilityCleared (false), pyramidWidth (0), pyramidHeight (0),
+   pyramidLevels (0), pyramidInitialized (false), descriptorVersion (0), instanceCount (0), drawCount (0), instanceSize (0)
+{
+}
+
+void GpuCuller::init (vk::Device device, const vk::AllocationCallbacks* allocationCallbacks, DeviceMemoryAllocator& memoryAllocator,
+                      const vk::PhysicalDeviceLimits& limits, const std::vector<char>& cullShaderCode, const std::vector<char>& reduceShaderCode,
+                      uint32_t frameCount, vk::Buffer instanceBuffer, uint32_t instanceCount, uint32_t instanceSize,
+                      const std::vector<vk::DrawIndexedIndirectCommand>& drawCommands)
+{
+   this->device = device;
+   this->allocationCallbacks = allocationCallbacks;
+   this->memoryAllocator = &memoryAllocator;
+   this->occlusionCulling = !reduceShaderCode.empty ();
+   this->instanceBuffer = instanceBuffer;
+   this->instanceCount = instanceCount;
+   this->instanceSize = instanceSize;
+   this->drawCount = static_cast<uint32_t> (drawCommands.size ());
+
+   uint32_t phaseCount = occlusionCulling ? 2 : 1;
+
+   //Instances, the slot's compacted instances, counts, parameters and draw models, then the visibility and the depth pyramid
+   std::vector<vk::DescriptorSetLayoutBinding> bindings (occlusionCulling ? 7 : 5);
+
+   for (uint32_t i = 0; i < bindings.size (); ++i)
+   {
+      bindings[i].binding = i;
+      bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+      bindings[i].descriptorCount = 1;
+      bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+   }
+
+   bindings[3].descriptorType = vk::DescriptorType::eUniformBuffer;
+
+   if (occlusionCulling)
+   {
+      bindings[6].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+   }
+
+   vk::DescriptorSetLayoutCreateInfo layoutInfo = {};
+   layoutInfo.bindingCount = static_cast<uint32_t> (bindings.size ());
+   layoutInfo.pBindings = bindings.data ();
+
+   if (device.createDescriptorSetLayout (&layoutInfo, allocationCallbacks, &descriptorSetLayout) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create descriptor set layout!");
+   }
+
+   std::array<vk::DescriptorPoolSize, 3> poolSizes = {};
+   poolSizes[0].type = vk::DescriptorType::eStorageBuffer;
+   poolSizes[0].descriptorCount = (occlusionCulling ? 5 : 4) * frameCount;
+   poolSizes[1].type = vk::DescriptorType::eUniformBuffer;
+   poolSizes[1].descriptorCount = frameCount;
+   poolSizes[2].type = vk::DescriptorType::eCombinedImageSampler;
+   poolSizes[2].descriptorCount = frameCount;
+
+   vk::DescriptorPoolCreateInfo poolInfo = {};
+   poolInfo.poolSizeCount = occlusionCulling ? 3 : 2;
+   poolInfo.pPoolSizes = poolSizes.data ();
+   poolInfo.maxSets = frameCount;
+
+   if (device.createDescriptorPool (&poolInfo, allocationCallbacks, &descriptorPool) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create descriptor pool!");
+   }
+
+   //Only the phase is pushed, everything else is in the parameter buffer
+   vk::PushConstantRange pushConstantRange = {};
+   pushConstantRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+   pushConstantRange.offset = 0;
+   pushConstantRange.size = sizeof (uint32_t);
+
+   vk::PipelineLayoutCreateInfo pipelineLayoutInfo = {};
+   pipelineLayoutInfo.setLayoutCount = 1;
+   pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+   pipelineLayoutInfo.pushConstantRangeCount = 1;
+   pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+   if (device.createPipelineLayout (&pipelineLayoutInfo, allocationCallbacks, &pipelineLayout) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create the pipeline layout!");
+   }
+
+   vk::ShaderModuleCreateInfo shaderInfo = {};
+   shaderInfo.codeSize = cullShaderCode.size ();
+   shaderInfo.pCode = reinterpret_cast<const uint32_t*> (cullShaderCode.data ());
+
+   vk::ShaderModule shaderModule;
+
+   if (device.createShaderModule (&shaderInfo, allocationCallbacks, &shaderModule) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create shader module!");
+   }
+
+   vk::ComputePipelineCreateInfo pipelineInfo = {};
+   pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+   pipelineInfo.stage.module = shaderModule;
+   pipelineInfo.stage.pName = "main";
+   pipelineInfo.layout = pipelineLayout;
+
+   vk::Result result = device.createComputePipelines (vk::PipelineCache (), 1, &pipelineInfo, allocationCallbacks, &pipeline);
+
+   device.destroyShaderModule (shaderModule, allocationCallbacks);
+
+   if (result != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create compute pipeline!");
+   }
+
+   //Written by the compute pass and read as vertex input, so it never leaves the device
+   visibleInstanceStride = alignUp (static_cast<vk::DeviceSize> (instanceSize) * instanceCount * phaseCount, limits.minStorageBufferOffsetAlignment);
+
+   vk::BufferCreateInfo bufferInfo = {};
+   bufferInfo.size = visibleInstanceStride * frameCount;
+   bufferInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer;
+   bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+
+   if (device.createBuffer (&bufferInfo, allocationCallbacks, &visibleInstanceBuffer) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create buffer!");
+   }
+
+   visibleInstanceBufferAllocation = memoryAllocator.allocateForBuffer (visibleInstanceBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+   device.bindBufferMemory (visibleInstanceBuffer, visibleInstanceBufferAllocation.memory, visibleInstanceBufferAllocation.offset);
+
+   //Host visible, the draw commands are written once from here and the counts are read back
+   drawCommandStride = alignUp (DRAW_COMMANDS_OFFSET + sizeof (vk::DrawIndexedIndirectCommand) * drawCount * phaseCount, limits.minStorageBufferOffsetAlignment);
+
+   bufferInfo.size = drawCommandStride * frameCount;
+   bufferInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer |
+      vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+
+   if (device.createBuffer (&bufferInfo, allocationCallbacks, &drawCommandBuffer) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create buffer!");
+   }
+
+   drawCommandBufferAllocation = memoryAllocator.allocateForBuffer (drawCommandBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+   device.bindBufferMemory (drawCommandBuffer, drawCommandBufferAllocation.memory, drawCommandBufferAllocation.offset);
+
+   drawModelStride = alignUp (sizeof (glm::mat4) * drawCount, limits.minStorageBufferOffsetAlignment);
+
+   bufferInfo.size = drawModelStride * frameCount;
+   bufferInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer;
+
+   if (device.createBuffer (&bufferInfo, allocationCallbacks, &drawModelBuffer) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create buffer!");
+   }
+
+   drawModelBufferAllocation = memoryAllocator.allocateForBuffer (drawModelBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+   device.bindBufferMemory (drawModelBuffer, drawModelBufferAllocation.memory, drawModelBufferAllocation.offset);
+
+   parameterStride = alignUp (sizeof (CullParameters), limits.minUniformBufferOffsetAlignment);
+
+   bufferInfo.size = parameterStride * frameCount;
+   bufferInfo.usage = vk::BufferUsageFlagBits::eUniformBuffer;
+
+   if (device.createBuffer (&bufferInfo, allocationCallbacks, &parameterBuffer) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create buffer!");
+   }
+
+   parameterBufferAllocation = memoryAllocator.allocateForBuffer (parameterBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+   device.bindBufferMemory (parameterBuffer, parameterBufferAllocation.memory, parameterBufferAllocation.offset);
+
+   if (occlusionCulling)
+   {
+      //Cleared on the device by the first frame, which then draws everything visible in its late phase
+      bufferInfo.size = sizeof (uint32_t) * instanceCount;
+      bufferInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+
+      if (device.createBuffer (&bufferInfo, allocationCallbacks, &visibilityBuffer) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to create buffer!");
+      }
+
+      visibilityBufferAllocation = memoryAllocator.allocateForBuffer (visibilityBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+      device.bindBufferMemory (visibilityBuffer, visibilityBufferAllocation.memory, visibilityBufferAllocation.offset);
+      visibilityCleared = false;
+
+      std::array<vk::DescriptorSetLayoutBinding, 2> reduceBindings = {};
+      reduceBindings[0].binding = 0;
+      reduceBindings[0].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+      reduceBindings[0].descriptorCount = 1;
+      reduceBindings[0].stageFlags = vk::ShaderStageFlagBits::eCompute;
+      reduceBindings[1].binding = 1;
+      reduceBindings[1].descriptorType = vk::DescriptorType::eStorageImage;
+      reduceBindings[1].descriptorCount = 1;
+      reduceBindings[1].stageFlags = vk::ShaderStageFlagBits::eCompute;
+
+      layoutInfo.bindingCount = static_cast<uint32_t> (reduceBindings.size ());
+      layoutInfo.pBindings = reduceBindings.data ();
+
+      if (device.createDescriptorSetLayout (&layoutInfo, allocationCallbacks, &reduceDescriptorSetLayout) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to create descriptor set layout!");
+      }
+
+      pipelineLayoutInfo.pSetLayouts = &reduceDescriptorSetLayout;
+      pipelineLayoutInfo.pushConstantRangeCount = 0;
+      pipelineLayoutInfo.pPushConstantRanges = nullptr;
+
+      if (device.createPipelineLayout (&pipelineLayoutInfo, allocationCallbacks, &reducePipelineLayout) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to create the pipeline layout!");
+      }
+
+      shaderInfo.codeSize = reduceShaderCode.size ();
+      shaderInfo.pCode = reinterpret_cast<const uint32_t*> (reduceShaderCode.data ());
+
+      if (device.createShaderModule (&shaderInfo, allocationCallbacks, &shaderModule) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to create shader module!");
+      }
+
+      pipelineInfo.stage.module = shaderModule;
+      pipelineInfo.layout = reducePipelineLayout;
+
+      result = device.createComputePipelines (vk::PipelineCache (), 1, &pipelineInfo, allocationCallbacks, &reducePipeline);
+
+      device.destroyShaderModule (shaderModule, allocationCallbacks);
+
+      if (result != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to create compute pipeline!");
+      }
+
+      //Only ever read with texelFetch, the sampler just has to exist
+      vk::SamplerCreateInfo samplerInfo = {};
+      samplerInfo.magFilter = vk::Filter::eNearest;
+      samplerInfo.minFilter = vk::Filter::eNearest;
+      samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+      samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+      samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+      samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+      samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+      if (device.createSampler (&samplerInfo, allocationCallbacks, &pyramidSampler) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to create texture sampler!");
+      }
+   }
+
+   //With occlusion culling the sets need the depth pyramid, so every slot writes its set when first recorded
+   ++descriptorVersion;
+
+   frames.resize (frameCount);
+
+   for (uint32_t i = 0; i < frameCount; ++i)
+   {
+      char* slot = static_cast<char*> (drawCommandBufferAllocation.mappedData) + i * drawCommandStride;
+
+      memset (slot, 0, DRAW_COMMANDS_OFFSET);
+
+      for (uint32_t phase = 0; phase < phaseCount; ++phase)
+      {
+         memcpy (slot + DRAW_COMMANDS_OFFSET + sizeof (vk::DrawIndexedIndirectCommand) * drawCount * phase, drawCommands.data (), sizeof (vk::DrawIndexedIndirectCommand) * drawCount);
+      }
+
+      vk::DescriptorSetAllocateInfo allocInfo = {};
+      allocInfo.descriptorPool = descriptorPool;
+      allocInfo.descriptorSetCount = 1;
+      allocInfo.pSetLayouts = &descriptorSetLayout;
+
+      if (device.allocateDescriptorSets (&allocInfo, &frames[i].descriptorSet) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to allocate descriptor set!");
+      }
+
+      frames[i].descriptorVersion = 0;
+      frames[i].pending = false;
+   }
+
+   resetStatistics ();
+}
+
+void GpuCuller::destroy ()
+{
+   if (!memoryAllocator)
+   {
+      return;
+   }
+
+   destroyDepthPyramid ();
+
+   if (occlusionCulling)
+   {
+      device.destroySampler (pyramidSampler, allocationCallbacks);
+      device.destroyPipeline (reducePipeline, allocationCallbacks);
+      device.destroyPipelineLayout (reducePipelineLayout, allocationCallbacks);
+      device.destroyDescriptorSetLayout (reduceDescriptorSetLayout, allocationCallbacks);
+
+      device.destroyBuffer (visibilityBuffer, allocationCallbacks);
+      memoryAllocator->free (visibilityBufferAllocation);
+   }
+
+   device.destroyPipeline (pipeline, allocationCallbacks);
+   device.destroyPipelineLayout (pipelineLayout, allocationCallbacks);
+   device.destroyDescriptorPool (descriptorPool, allocationCallbacks); //Frees the sets
+   device.destroyDescriptorSetLayout (descriptorSetLayout, allocationCallbacks);
+
+   device.destroyBuffer (visibleInstanceBuffer, allocationCallbacks);
+   memoryAllocator->free (visibleInstanceBufferAllocation);
+   device.destroyBuffer (drawCommandBuffer, allocationCallbacks);
+   memoryAllocator->free (drawCommandBufferAllocation);
+   device.destroyBuffer (drawModelBuffer, allocationCallbacks);
+   memoryAllocator->free (drawModelBufferAllocation);
+   device.destroyBuffer (parameterBuffer, allocationCallbacks);
+   memoryAllocator->free (parameterBufferAllocation);
+
+   frames.clear ();
+   memoryAllocator = nullptr;
+}
+
+bool GpuCuller::isEnabled () const
+{
+   return memoryAllocator != nullptr;
+}
+
+bool GpuCuller::isOcclusionCulling () const
+{
+   return isEnabled () && occlusionCulling;
+}
+
+void GpuCuller::createDepthPyramid (vk::Extent2D extent, vk::ImageView depthImageView)
+{
+   //Rounding down keeps every level an exact halving of the one above, only the first reduction covers uneven footprints
+   pyramidWidth = previousPowerOfTwo (extent.width);
+   pyramidHeight = previousPowerOfTwo (extent.height);
+   pyramidLevels = 1;
+
+   while ((std::max (pyramidWidth, pyramidHeight) >> pyramidLevels) > 0)
+   {
+      ++pyramidLevels;
+   }
+
+   vk::ImageCreateInfo imageInfo = {};
+   imageInfo.imageType = vk::ImageType::e2D;
+   imageInfo.extent = vk::Extent3D (pyramidWidth, pyramidHeight, 1);
+   imageInfo.mipLevels = pyramidLevels;
+   imageInfo.arrayLayers = 1;
+   imageInfo.format = vk::Format::eR32Sfloat;
+   imageInfo.tiling = vk::ImageTiling::eOptimal;
+   imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+   imageInfo.usage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled;
+   imageInfo.samples = vk::SampleCountFlagBits::e1;
+   imageInfo.sharingMode = vk::SharingMode::eExclusive;
+
+   if (device.createImage (&imageInfo, allocationCallbacks, &depthPyramid) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create image!");
+   }
+
+   depthPyramidAllocation = memoryAllocator->allocateForImage (depthPyramid, vk::MemoryPropertyFlagBits::eDeviceLocal);
+   device.bindImageMemory (depthPyramid, depthPyramidAllocation.memory, depthPyramidAllocation.offset);
+
+   vk::ImageViewCreateInfo viewInfo = {};
+   viewInfo.image = depthPyramid;
+   viewInfo.viewType = vk::ImageViewType::e2D;
+   viewInfo.format = vk::Format::eR32Sfloat;
+   viewInfo.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+   viewInfo.subresourceRange.baseMipLevel = 0;
+   viewInfo.subresourceRange.levelCount = pyramidLevels;
+   viewInfo.subresourceRange.baseArrayLayer = 0;
+   viewInfo.subresourceRange.layerCount = 1;
+
+   depthPyramidView = device.createImageView (viewInfo, allocationCallbacks);
+
+   depthPyramidLevelViews.resize (pyramidLevels);
+
+   for (uint32_t level = 0; level < pyramidLevels; ++level)
+   {
+      viewInfo.subresourceRange.baseMipLevel = level;
+      viewInfo.subresourceRange.levelCount = 1;
+
+      depthPyramidLevelViews[level] = device.createImageView (viewInfo, allocationCallbacks);
+   }
+
+   std::array<vk::DescriptorPoolSize, 2> poolSizes = {};
+   poolSizes[0].type = vk::DescriptorType::eCombinedImageSampler;
+   poolSizes[0].descriptorCount = pyramidLevels;
+   poolSizes[1].type = vk::DescriptorType::eStorageImage;
+   poolSizes[1].descriptorCount = pyramidLevels;
+
+   vk::DescriptorPoolCreateInfo poolInfo = {};
+   poolInfo.poolSizeCount = static_cast<uint32_t> (poolSizes.size ());
+   poolInfo.pPoolSizes = poolSizes.data ();
+   poolInfo.maxSets = pyramidLevels;
+
+   if (device.createDescriptorPool (&poolInfo, allocationCallbacks, &reduceDescriptorPool) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create descriptor pool!");
+   }
+
+   std::vector<vk::DescriptorSetLayout> layouts (pyramidLevels, reduceDescriptorSetLayout);
+
+   vk::DescriptorSetAllocateInfo allocInfo = {};
+   allocInfo.descriptorPool = reduceDescriptorPool;
+   allocInfo.descriptorSetCount = pyramidLevels;
+   allocInfo.pSetLayouts = layouts.data ();
+
+   reduceDescriptorSets.resize (pyramidLevels);
+
+   if (device.allocateDescriptorSets (&allocInfo, reduceDescriptorSets.data ()) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to allocate descriptor set!");
+   }
+
+   for (uint32_t level = 0; level < pyramidLevels; ++level)
+   {
+      vk::DescriptorImageInfo sourceInfo = {};
+      sourceInfo.sampler = pyramidSampler;
+      sourceInfo.imageView = level == 0 ? depthImageView : depthPyramidLevelViews[level - 1];
+      sourceInfo.imageLayout = level == 0 ? vk::ImageLayout::eDepthStencilReadOnlyOptimal : vk::ImageLayout::eGeneral;
+
+      vk::DescriptorImageInfo destinationInfo = {};
+      destinationInfo.imageView = depthPyramidLevelViews[level];
+      destinationInfo.imageLayout = vk::ImageLayout::eGeneral;
+
+      std::array<vk::WriteDescriptorSet, 2> descriptorWrites = {};
+
+      descriptorWrites[0].dstSet = reduceDescriptorSets[level];
+      descriptorWrites[0].dstBinding = 0;
+      descriptorWrites[0].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+      descriptorWrites[0].descriptorCount = 1;
+      descriptorWrites[0].pImageInfo = &sourceInfo;
+
+      descriptorWrites[1].dstSet = reduceDescriptorSets[level];
+      descriptorWrites[1].dstBinding = 1;
+      descriptorWrites[1].descriptorType = vk::DescriptorType::eStorageImage;
+      descriptorWrites[1].descriptorCount = 1;
+      descriptorWrites[1].pImageInfo = &destinationInfo;
+
+      device.updateDescriptorSets (static_cast<uint32_t> (descriptorWrites.size ()), descriptorWrites.data (), 0, nullptr);
+   }
+
+   pyramidInitialized = false;
+   ++descriptorVersion;
+}
+
+void GpuCuller::destroyDepthPyramid ()
+{
+   retireDepthPyramid () ();
+}
+
+std::function<void ()> GpuCuller::retireDepthPyramid ()
+{
+   if (!depthPyramid)
+   {
+      return [] () {};
+   }
+
+   vk::Device device = this->device;
+   const vk::AllocationCallbacks* allocationCallbacks = this->allocationCallbacks;
+   DeviceMemoryAllocator* memoryAllocator = this->memoryAllocator;
+   vk::DescriptorPool pool = reduceDescriptorPool;
+   std::vector<vk::ImageView> levelViews = std::move (depthPyramidLevelViews);
+   vk::ImageView view = depthPyramidView;
+   vk::Image image = depthPyramid;
+   MemoryAllocation allocation = depthPyramidAllocation;
+
+   reduceDescriptorPool = vk::DescriptorPool ();
+   reduceDescriptorSets.clear ();
+   depthPyramidLevelViews.clear ();
+   depthPyramidView = vk::ImageView ();
+   depthPyramid = vk::Image ();
+
+   return [device, allocationCallbacks, memoryAllocator, pool, levelViews, view, image, allocation] () mutable
+   {
+      device.destroyDescriptorPool (pool, allocationCallbacks); //Frees the sets
+
+      for (auto levelView : levelViews)
+      {
+         device.destroyImageView (levelView, allocationCallbacks);
+      }
+
+      device.destroyImageView (view, allocationCallbacks);
+      device.destroyImage (image, allocationCallbacks);
+      memoryAllocator->free (allocation);
+   };
+}
+
+void GpuCuller::setOcclusionTest (bool enabled)
+{
+   occlusionTest = enabled;
+}
+
+void GpuCuller::setInstanceBuffer (vk::Buffer buffer)
+{
+   instanceBuffer = buffer;
+   ++descriptorVersion;
+}
+
+void GpuCuller::collect (uint32_t frameIndex)
+{
+   if (frames.empty () || !frames[frameIndex].pending)
+   {
+      return;
+   }
+
+   const char* slot = static_cast<const char*> (drawCommandBufferAllocation.mappedData) + frameIndex * drawCommandStride;
+
+   uint32_t counts[4];
+   memcpy (counts, slot, sizeof (counts));
+
+   statistics.drawnEarly.add (counts[0]);
+   statistics.frustumCulled.add (counts[2]);
+
+   if (occlusionCulling)
+   {
+      statistics.drawnLate.add (counts[1]);
+      statistics.occluded.add (counts[3]);
+   }
+
+   frames[frameIndex].pending = false;
+}
+
+void GpuCuller::record (vk::CommandBuffer commandBuffer, uint32_t frameIndex, CullPhase phase, const glm::mat4& view, const glm::mat4& projection,
+                        const glm::vec4& bounds, const TransformArray& drawTransforms)
+{
+   FrameResources& frame = frames[frameIndex];
+
+   if (frame.descriptorVersion != descriptorVersion)
+   {
+      writeDescriptorSet (frameIndex);
+   }
+
+   vk::DeviceSize countOffset = frameIndex * drawCommandStride;
+
+   if (phase == CullPhase::eEarly)
+   {
+      //The late phase runs from the same command buffer, so both read what is written here
+      CullParameters parameters = {};
+
+      std::array<glm::vec4, 6> planes = extractFrustumPlanes (projection * view);
+
+      for (size_t i = 0; i < planes.size (); ++i)
+      {
+         parameters.planes[i] = planes[i];
+      }
+
+      parameters.bounds = bounds;
+      parameters.view = view;
+      parameters.projection = glm::vec4 (projection[0][0], std::abs (projection[1][1]), -projection[2][2], projection[3][2]);
+      parameters.pyramid = glm::vec4 (pyramidWidth, pyramidHeight, pyramidLevels, projection[3][2] / projection[2][2]);
+      parameters.instanceCount = instanceCount;
+      parameters.occlusionTest = occlusionTest ? 1 : 0;
+
+      //Every distinct transform costs each instance another sphere test, and usually the draws all share one
+      std::vector<glm::mat4> drawModels;
+      size_t transformCount = std::min<size_t> (drawTransforms.size (), drawCount);
+
+      for (size_t i = 0; i < transformCount; ++i)
+      {
+         glm::mat4 model = drawTransforms.get (i);
+
+         if (std::find (drawModels.begin (), drawModels.end (), model) == drawModels.end ())
+         {
+            drawModels.push_back (model);
+         }
+      }
+
+      parameters.drawModelCount = static_cast<uint32_t> (drawModels.size ());
+
+      if (!drawModels.empty ())
+      {
+         memcpy (static_cast<char*> (drawModelBufferAllocation.mappedData) + frameIndex * drawModelStride, drawModels.data (), sizeof (glm::mat4) * drawModels.size ());
+      }
+
+      memcpy (static_cast<char*> (parameterBufferAllocation.mappedData) + frameIndex * parameterStride, &parameters, sizeof (parameters));
+
+      commandBuffer.fillBuffer (drawCommandBuffer, countOffset, DRAW_COMMANDS_OFFSET, 0);
+
+      if (occlusionCulling && !visibilityCleared)
+      {
+         commandBuffer.fillBuffer (visibilityBuffer, 0, VK_WHOLE_SIZE, 0);
+         visibilityCleared = true;
+      }
+
+      //Also orders this frame's visibility reads after the previous frame's late phase wrote it
+      vk::MemoryBarrier clearBarrier = {};
+      clearBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderWrite;
+      clearBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+
+      commandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+                                     vk::DependencyFlags (), 1, &clearBarrier, 0, nullptr, 0, nullptr);
+   }
+   else
+   {
+      buildDepthPyramid (commandBuffer);
+   }
+
+   uint32_t phaseValue = phaseIndex (phase);
+
+   commandBuffer.bindPipeline (vk::PipelineBindPoint::eCompute, pipeline);
+   commandBuffer.bindDescriptorSets (vk::PipelineBindPoint::eCompute, pipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+   commandBuffer.pushConstants (pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof (phaseValue), &phaseValue);
+   commandBuffer.dispatch ((instanceCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+   vk::MemoryBarrier countBarrier = {};
+   countBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+   countBarrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
+
+   commandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags (), 1, &countBarrier, 0, nullptr, 0, nullptr);
+
+   //Every draw renders the same instances, only the index range differs
+   std::vector<vk::BufferCopy> copies (drawCount);
+
+   for (uint32_t i = 0; i < drawCount; ++i)
+   {
+      copies[i].srcOffset = countOffset + phaseValue * sizeof (uint32_t);
+      copies[i].dstOffset = getDrawCommandOffset (frameIndex, phase, i) + offsetof (VkDrawIndexedIndirectCommand, instanceCount);
+      copies[i].size = sizeof (uint32_t);
+   }
+
+   commandBuffer.copyBuffer (drawCommandBuffer, drawCommandBuffer, drawCount, copies.data ());
+
+   vk::MemoryBarrier drawBarrier = {};
+   drawBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite;
+   drawBarrier.dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eVertexAttributeRead;
+
+   commandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+                                  vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexInput,
+                                  vk::DependencyFlags (), 1, &drawBarrier, 0, nullptr, 0, nullptr);
+
+   //collect reads the counts on the host once the slot's fence has signaled, the fence alone does not make them visible
+   vk::MemoryBarrier hostBarrier = {};
+   hostBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+   hostBarrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+
+   commandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags (), 1, &hostBarrier, 0, nullptr, 0, nullptr);
+
+   frame.pending = true;
+}
+
+void GpuCuller::buildDepthPyramid (vk::CommandBuffer commandBuffer)
+{
+   //The depth buffer was made readable by the early render pass, this only has to wait for the previous frame's reads of the pyramid
+   if (!pyramidInitialized)
+   {
+      vk::ImageMemoryBarrier barrier = {};
+      barrier.oldLayout = vk::ImageLayout::eUndefined;
+      barrier.newLayout = vk::ImageLayout::eGeneral;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.image = depthPyramid;
+      barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+      barrier.subresourceRange.baseMipLevel = 0;
+      barrier.subresourceRange.levelCount = pyramidLevels;
+      barrier.subresourceRange.baseArrayLayer = 0;
+      barrier.subresourceRange.layerCount = 1;
+      barrier.dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+
+      commandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags (), 0, nullptr, 0, nullptr, 1, &barrier);
+
+      pyramidInitialized = true;
+   }
+   else
+   {
+      commandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags (), 0, nullptr, 0, nullptr, 0, nullptr);
+   }
+
+   commandBuffer.bindPipeline (vk::PipelineBindPoint::eCompute, reducePipeline);
+
+   //Each level reads the one written before it, the barrier after the last one also covers the culling dispatch
+   for (uint32_t level = 0; level < pyramidLevels; ++level)
+   {
+      uint32_t levelWidth = std::max (pyramidWidth >> level, 1u);
+      uint32_t levelHeight = std::max (pyramidHeight >> level, 1u);
+
+      commandBuffer.bindDescriptorSets (vk::PipelineBindPoint::eCompute, reducePipelineLayout, 0, 1, &reduceDescriptorSets[level], 0, nullptr);
+      commandBuffer.dispatch ((levelWidth + REDUCE_WORKGROUP_SIZE - 1) / REDUCE_WORKGROUP_SIZE, (levelHeight + REDUCE_WORKGROUP_SIZE - 1) / REDUCE_WORKGROUP_SIZE, 1);
+
+      vk::MemoryBarrier levelBarrier = {};
+      levelBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+      levelBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+      commandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags (), 1, &levelBarrier, 0, nullptr, 0, nullptr);
+   }
+}
+
+vk::Buffer GpuCuller::getVisibleInstanceBuffer () const
+{
+   return visibleInstanceBuffer;
+}
+
+vk::DeviceSize GpuCuller::getVisibleInstanceOffset (uint32_t frameIndex, CullPhase phase) const
+{
+   return frameIndex * visibleInstanceStride + phaseIndex (phase) * static_cast<vk::DeviceSize> (instanceSize) * instanceCount;
+}
+
+vk::Buffer GpuCuller::getDrawCommandBuffer () const
+{
+   return drawCommandBuffer;
+}
+
+vk::DeviceSize GpuCuller::getDrawCommandOffset (uint32_t frameIndex, CullPhase phase, size_t drawIndex) const
+{
+   return frameIndex * drawCommandStride + DRAW_COMMANDS_OFFSET + (phaseIndex (phase) * drawCount + drawIndex) * sizeof (vk::DrawIndexedIndirectCommand);
+}
+
+uint32_t GpuCuller::getInstanceCount () const
+{
+   return instanceCount;
+}
+
+const CullingStatistics& GpuCuller::getStatistics () const
+{
+   return statistics;
+}
+
+void GpuCuller::resetStatistics ()
+{
+   statistics = CullingStatistics ();
+}
+
+std::array<glm::vec4, 6> GpuCuller::extractFrustumPlanes (const glm::mat4& viewProjection)
+{
+   //Rows of the matrix, glm stores columns
+   glm::vec4 rows[4];
+
+   for (int row = 0; row < 4; ++row)
+   {
+      rows[row] = glm::vec4 (viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+   }
+
+   //Left, right, bottom, top, near, far
+   std::array<glm::vec4, 6> planes = {rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[2], rows[3] - rows[2]};
+
+   for (auto& plane : planes)
+   {
+      plane /= glm::length (glm::vec3 (plane));
+   }
+
+   return planes;
+}
+
+void GpuCuller::writeDescriptorSet (uint32_t frameIndex)
+{
+   FrameResources& frame = frames[frameIndex];
+   uint32_t phaseCount = occlusionCulling ? 2 : 1;
+
+   vk::DescriptorBufferInfo bufferInfos[6] = {};
+
+   bufferInfos[0].buffer = instanceBuffer;
+   bufferInfos[0].offset = 0;
+   bufferInfos[0].range = static_cast<vk::DeviceSize> (instanceSize) * instanceCount;
+
+   bufferInfos[1].buffer = visibleInstanceBuffer;
+   bufferInfos[1].offset = getVisibleInstanceOffset (frameIndex, CullPhase::eEarly);
+   bufferInfos[1].range = static_cast<vk::DeviceSize> (instanceSize) * instanceCount * phaseCount;
+
+   bufferInfos[2].buffer = drawCommandBuffer;
+   bufferInfos[2].offset = frameIndex * drawCommandStride;
+   bufferInfos[2].range = DRAW_COMMANDS_OFFSET;
+
+   bufferInfos[3].buffer = parameterBuffer;
+   bufferInfos[3].offset = frameIndex * parameterStride;
+   bufferInfos[3].range = sizeof (CullParameters);
+
+   bufferInfos[4].buffer = drawModelBuffer;
+   bufferInfos[4].offset = frameIndex * drawModelStride;
+   bufferInfos[4].range = sizeof (glm::mat4) * drawCount;
+
+   bufferInfos[5].buffer = visibilityBuffer;
+   bufferInfos[5].offset = 0;
+   bufferInfos[5].range = VK_WHOLE_SIZE;
+
+   vk::DescriptorImageInfo pyramidInfo = {};
+   pyramidInfo.sampler = pyramidSampler;
+   pyramidInfo.imageView = depthPyramidView;
+   pyramidInfo.imageLayout = vk::ImageLayout::eGeneral;
+
+   std::vector<vk::WriteDescriptorSet> descriptorWrites (occlusionCulling ? 7 : 5);
+
+   for (uint32_t i = 0; i < descriptorWrites.size (); ++i)
+   {
+      descriptorWrites[i].dstSet = frame.descriptorSet;
+      descriptorWrites[i].dstBinding = i;
+      descriptorWrites[i].dstArrayElement = 0;
+      descriptorWrites[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+      descriptorWrites[i].descriptorCount = 1;
+      descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+   }
+
+   descriptorWrites[3].descriptorType = vk::DescriptorType::eUniformBuffer;
+
+   if (occlusionCulling)
+   {
+      descriptorWrites[6].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+      descriptorWrites[6].pBufferInfo = nullptr;
+      descriptorWrites[6].pImageInfo = &pyramidInfo;
+   }
+
+   device.updateDescriptorSets (static_cast<uint32_t> (descriptorWrites.size ()), descriptorWrites.data (), 0, nullptr);
+
+   frame.descriptorVersion = descriptorVersion;
+}
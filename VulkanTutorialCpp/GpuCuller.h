@@ -0,0 +1,173 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include "DeviceMemoryAllocator.h"
+#include "RollingStatistics.h"
+#include "TransformArray.h"
+
+//Occlusion culling draws in two passes, frustum culling alone only records the early one
+enum class CullPhase
+{
+   eEarly, //Instances that were visible last frame
+   eLate //Instances that pass the depth pyramid built from the early draws and were not drawn early
+};
+
+struct CullingStatistics
+{
+   RollingStatistics drawnEarly; //All of the visible instances without occlusion culling
+   RollingStatistics drawnLate;
+   RollingStatistics frustumCulled;
+   RollingStatistics occluded;
+};
+
+//Frustum culls instances on the GPU. A compute pass tests each instance's bounding sphere, moved by every distinct draw
+//model matrix, against the frustum planes, appends the survivors to a per frame slot instance buffer and counts them. The count is then copied into the
+//instanceCount of every indirect draw, so the CPU records the same handful of commands however many instances there are.
+//
+//With occlusion culling the early pass draws what was visible last frame, a depth pyramid is reduced from the resulting
+//depth buffer, and the late pass tests every instance against the pyramid. It draws the ones that became visible and
+//records the visibility the next frame's early pass starts from.
+class GpuCuller
+{
+private:
+
+   //Matches the uniform block in cull.comp
+   struct CullParameters
+   {
+      glm::vec4 planes[6]; //xyz is the inward facing normal, w the distance
+      glm::vec4 bounds; //Bounding sphere of the model in model space, w is the radius
+      glm::mat4 view;
+      glm::vec4 projection; //x and y scale, then the depth a + b / distance is mapped to
+      glm::vec4 pyramid; //Width, height, level count and the near plane distance
+      uint32_t instanceCount;
+      uint32_t occlusionTest;
+      uint32_t drawModelCount;
+      uint32_t padding;
+   };
+
+   struct FrameResources
+   {
+      vk::DescriptorSet descriptorSet;
+      uint64_t descriptorVersion; //Rewritten when it falls behind, which is only safe once the slot's fence signaled
+      bool pending; //Recorded and not yet read back
+   };
+
+   vk::Device device;
+   const vk::AllocationCallbacks* allocationCallbacks;
+   DeviceMemoryAllocator* memoryAllocator;
+   bool occlusionCulling;
+   bool occlusionTest;
+
+   vk::DescriptorSetLayout descriptorSetLayout;
+   vk::DescriptorPool descriptorPool;
+   vk::PipelineLayout pipelineLayout;
+   vk::Pipeline pipeline;
+
+   vk::Buffer visibleInstanceBuffer; //Compacted instances, bound as the per instance vertex buffer
+   MemoryAllocation visibleInstanceBufferAllocation;
+   vk::DeviceSize visibleInstanceStride; //Per slot, the early region and with occlusion culling the late region after it
+
+   vk::Buffer drawCommandBuffer; //Per slot: the counts, then the early and the late vk::DrawIndexedIndirectCommand of each draw
+   MemoryAllocation drawCommandBufferAllocation;
+   vk::DeviceSize drawCommandStride;
+
+   vk::Buffer drawModelBuffer; //Per slot, the distinct model matrices the draws push on top of the instance's
+   MemoryAllocation drawModelBufferAllocation;
+   vk::DeviceSize drawModelStride;
+
+   vk::Buffer parameterBuffer; //Per slot, too large for push constants once the occlusion test needs the view
+   MemoryAllocation parameterBufferAllocation;
+   vk::DeviceSize parameterStride;
+
+   vk::Buffer visibilityBuffer; //One uint per instance, shared by the slots since each frame starts from the last one's result
+   MemoryAllocation visibilityBufferAllocation;
+   bool visibilityCleared;
+
+   vk::DescriptorSetLayout reduceDescriptorSetLayout;
+   vk::PipelineLayout reducePipelineLayout;
+   vk::Pipeline reducePipeline;
+   vk::Sampler pyramidSampler;
+
+   //Farthest depth of each texel's footprint, a power of two no larger than the depth buffer, kept in the general layout
+   vk::Image depthPyramid;
+   MemoryAllocation depthPyramidAllocation;
+   vk::ImageView depthPyramidView;
+   std::vector<vk::ImageView> depthPyramidLevelViews;
+   vk::DescriptorPool reduceDescriptorPool;
+   std::vector<vk::DescriptorSet> reduceDescriptorSets; //One per level, reading the level above or the depth buffer
+   uint32_t pyramidWidth;
+   uint32_t pyramidHeight;
+   uint32_t pyramidLevels;
+   bool pyramidInitialized; //Moved to the general layout
+
+   vk::Buffer instanceBuffer;
+   uint64_t descriptorVersion;
+   uint32_t instanceCount;
+   uint32_t drawCount;
+   uint32_t instanceSize;
+
+   std::vector<FrameResources> frames;
+
+   CullingStatistics statistics;
+
+public:
+   GpuCuller ();
+
+   //The queue family the commands are recorded for has to support compute as well as graphics. Occlusion culling is
+   //on when reduceShaderCode is not empty, and then needs a depth pyramid before the first frame is recorded.
+   void init (vk::Device device, const vk::AllocationCallbacks* allocationCallbacks, DeviceMemoryAllocator& memoryAllocator,
+              const vk::PhysicalDeviceLimits& limits, const std::vector<char>& cullShaderCode, const std::vector<char>& reduceShaderCode,
+              uint32_t frameCount, vk::Buffer instanceBuffer, uint32_t instanceCount, uint32_t instanceSize,
+              const std::vector<vk::DrawIndexedIndirectCommand>& drawCommands);
+   void destroy ();
+
+   bool isEnabled () const;
+   bool isOcclusionCulling () const;
+
+   //Follows the depth buffer, which has to be sampled in the depth stencil read only layout
+   void createDepthPyramid (vk::Extent2D extent, vk::ImageView depthImageView);
+   void destroyDepthPyramid ();
+
+   //Detaches the pyramid and returns what destroys it, for when frames in flight may still be sampling it.
+   //createDepthPyramid can be called straight away.
+   std::function<void ()> retireDepthPyramid ();
+
+   //Off draws everything in the frustum late, for comparing against the occlusion culled frame
+   void setOcclusionTest (bool enabled);
+
+   //For when the instance buffer is moved, each slot picks it up the next time it is recorded
+   void setInstanceBuffer (vk::Buffer buffer);
+
+   //Reads the counts of the last frame recorded into this slot. Only call once the slot's fence has signaled.
+   void collect (uint32_t frameIndex);
+
+   //Outside the render pass, before the draws that consume the results. The late phase also builds the depth pyramid,
+   //so it goes after the render pass of the early draws. An instance is kept if any of the draw transforms leaves it visible.
+   void record (vk::CommandBuffer commandBuffer, uint32_t frameIndex, CullPhase phase, const glm::mat4& view, const glm::mat4& projection,
+                const glm::vec4& bounds, const TransformArray& drawTransforms);
+
+   vk::Buffer getVisibleInstanceBuffer () const;
+   vk::DeviceSize getVisibleInstanceOffset (uint32_t frameIndex, CullPhase phase) const;
+   vk::Buffer getDrawCommandBuffer () const;
+   vk::DeviceSize getDrawCommandOffset (uint32_t frameIndex, CullPhase phase, size_t drawIndex) const;
+
+   uint32_t getInstanceCount () const;
+   const CullingStatistics& getStatistics () const;
+   void resetStatistics ();
+
+   //Planes of the clip volume of a Vulkan projection, 0 <= z <= w, normalized so distances are in world units
+   static std::array<glm::vec4, 6> extractFrustumPlanes (const glm::mat4& viewProjection);
+
+private:
+   void writeDescriptorSet (uint32_t frameIndex);
+   void buildDepthPyramid (vk::CommandBuffer commandBuffer);
+};
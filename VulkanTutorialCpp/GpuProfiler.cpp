@@ -0,0 +1,192 @@
+#include "GpuProfiler.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+//Results come back in bit order: vertex shader, clipping invocations, clipping primitives, fragment shader
+static const vk::QueryPipelineStatisticFlags STATISTICS = vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations |
+   vk::QueryPipelineStatisticFlagBits::eClippingInvocations | vk::QueryPipelineStatisticFlagBits::eClippingPrimitives |
+   vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+
+static const uint32_t STATISTICS_COUNT = 4;
+
+static const uint32_t FRAME_TIMESTAMPS = 2;
+
+GpuProfiler::GpuProfiler () : allocationCallbacks (nullptr), timestamps (false), pipelineStatistics (false), timestampMask (0),
+   timestampPeriod (1.0), maxDrawTimestamps (0)
+{
+}
+
+void GpuProfiler::init (vk::Device device, const vk::AllocationCallbacks* allocationCallbacks, uint32_t frameCount, uint32_t timestampValidBits,
+                        float timestampPeriod, bool pipelineStatistics, uint32_t maxDrawTimestamps)
+{
+   this->device = device;
+   this->allocationCallbacks = allocationCallbacks;
+   this->timestamps = timestampValidBits != 0;
+   this->pipelineStatistics = pipelineStatistics;
+   this->timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+   this->timestampPeriod = timestampPeriod;
+   this->maxDrawTimestamps = maxDrawTimestamps;
+
+   vk::QueryPoolCreateInfo timestampPoolInfo = {};
+   timestampPoolInfo.queryType = vk::QueryType::eTimestamp;
+   timestampPoolInfo.queryCount = FRAME_TIMESTAMPS + maxDrawTimestamps;
+
+   vk::QueryPoolCreateInfo statisticsPoolInfo = {};
+   statisticsPoolInfo.queryType = vk::QueryType::ePipelineStatistics;
+   statisticsPoolInfo.queryCount = 1;
+   statisticsPoolInfo.pipelineStatistics = STATISTICS;
+
+   frames.resize (frameCount);
+
+   for (auto& frame : frames)
+   {
+      frame.drawTimestampCount = 0;
+      frame.pending = false;
+
+      if (timestamps && device.createQueryPool (&timestampPoolInfo, allocationCallbacks, &frame.timestampPool) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to create query pool!");
+      }
+
+      if (pipelineStatistics && device.createQueryPool (&statisticsPoolInfo, allocationCallbacks, &frame.statisticsPool) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to create query pool!");
+      }
+   }
+
+   results.resize (std::max (timestampPoolInfo.queryCount, STATISTICS_COUNT));
+}
+
+void GpuProfiler::destroy ()
+{
+   for (auto& frame : frames)
+   {
+      device.destroyQueryPool (frame.timestampPool, allocationCallbacks);
+      device.destroyQueryPool (frame.statisticsPool, allocationCallbacks);
+   }
+
+   frames.clear ();
+}
+
+bool GpuProfiler::isEnabled () const
+{
+   return timestamps || pipelineStatistics;
+}
+
+void GpuProfiler::collect (uint32_t frameIndex)
+{
+   if (frames.empty () || !frames[frameIndex].pending)
+   {
+      return;
+   }
+
+   FrameQueries& frame = frames[frameIndex];
+   frame.pending = false;
+
+   double millisecondsPerTick = timestampPeriod / 1000000.0;
+
+   uint32_t timestampCount = FRAME_TIMESTAMPS + frame.drawTimestampCount;
+
+   if (timestamps && device.getQueryPoolResults (frame.timestampPool, 0, timestampCount, timestampCount * sizeof (uint64_t), results.data (),
+                                                 sizeof (uint64_t), vk::QueryResultFlagBits::e64) == vk::Result::eSuccess)
+   {
+      timings.frameMilliseconds.add (((results[1] - results[0]) & timestampMask) * millisecondsPerTick);
+
+      if (frame.drawTimestampCount > 0)
+      {
+         uint64_t previous = results[0];
+         uint64_t totalTicks = 0;
+         uint64_t slowestTicks = 0;
+
+         for (uint32_t i = 0; i < frame.drawTimestampCount; ++i)
+         {
+            uint64_t ticks = (results[FRAME_TIMESTAMPS + i] - previous) & timestampMask;
+
+            totalTicks += ticks;
+            slowestTicks = std::max (slowestTicks, ticks);
+            previous = results[FRAME_TIMESTAMPS + i];
+         }
+
+         timings.meanDrawMilliseconds.add (totalTicks * millisecondsPerTick / frame.drawTimestampCount);
+         timings.slowestDrawMilliseconds.add (slowestTicks * millisecondsPerTick);
+      }
+   }
+
+   if (pipelineStatistics && device.getQueryPoolResults (frame.statisticsPool, 0, 1, STATISTICS_COUNT * sizeof (uint64_t), results.data (),
+                                                         STATISTICS_COUNT * sizeof (uint64_t), vk::QueryResultFlagBits::e64) == vk::Result::eSuccess)
+   {
+      timings.vertexShaderInvocations.add (static_cast<double> (results[0]));
+      timings.clippingInvocations.add (static_cast<double> (results[1]));
+      timings.clippingPrimitives.add (static_cast<double> (results[2]));
+      timings.fragmentShaderInvocations.add (static_cast<double> (results[3]));
+   }
+}
+
+void GpuProfiler::beginFrame (vk::CommandBuffer commandBuffer, uint32_t frameIndex, size_t drawCount)
+{
+   if (frames.empty ())
+   {
+      return;
+   }
+
+   FrameQueries& frame = frames[frameIndex];
+   frame.drawTimestampCount = static_cast<uint32_t> (std::min<size_t> (drawCount, maxDrawTimestamps));
+
+   if (timestamps)
+   {
+      commandBuffer.resetQueryPool (frame.timestampPool, 0, FRAME_TIMESTAMPS + maxDrawTimestamps);
+      commandBuffer.writeTimestamp (vk::PipelineStageFlagBits::eTopOfPipe, frame.timestampPool, 0);
+   }
+
+   if (pipelineStatistics)
+   {
+      commandBuffer.resetQueryPool (frame.statisticsPool, 0, 1);
+      commandBuffer.beginQuery (frame.statisticsPool, 0, vk::QueryControlFlags ());
+   }
+}
+
+void GpuProfiler::endFrame (vk::CommandBuffer commandBuffer, uint32_t frameIndex)
+{
+   if (frames.empty ())
+   {
+      return;
+   }
+
+   FrameQueries& frame = frames[frameIndex];
+
+   if (pipelineStatistics)
+   {
+      commandBuffer.endQuery (frame.statisticsPool, 0);
+   }
+
+   if (timestamps)
+   {
+      commandBuffer.writeTimestamp (vk::PipelineStageFlagBits::eBottomOfPipe, frame.timestampPool, 1);
+   }
+
+   frame.pending = isEnabled ();
+}
+
+void GpuProfiler::writeDrawTimestamp (vk::CommandBuffer commandBuffer, uint32_t frameIndex, size_t drawIndex)
+{
+   if (timestamps && drawIndex < maxDrawTimestamps)
+   {
+      commandBuffer.writeTimestamp (vk::PipelineStageFlagBits::eBottomOfPipe, frames[frameIndex].timestampPool, FRAME_TIMESTAMPS + static_cast<uint32_t> (drawIndex));
+   }
+}
+
+vk::QueryPipelineStatisticFlags GpuProfiler::getInheritedStatistics () const
+{
+   return pipelineStatistics ? STATISTICS : vk::QueryPipelineStatisticFlags ();
+}
+
+const GpuTimings& GpuProfiler::getTimings () const
+{
+   return timings;
+}
+
+void GpuProfiler::resetTimings ()
+{
+   timings = GpuTimings ();
+}
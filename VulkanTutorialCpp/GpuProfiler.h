@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "RollingStatistics.h"
+
+struct GpuTimings
+{
+   RollingStatistics frameMilliseconds; //From just before the render pass begins to after it ends
+   RollingStatistics meanDrawMilliseconds; //Per frame average over the timed draws
+   RollingStatistics slowestDrawMilliseconds;
+   RollingStatistics vertexShaderInvocations;
+   RollingStatistics clippingInvocations;
+   RollingStatistics clippingPrimitives;
+   RollingStatistics fragmentShaderInvocations;
+};
+
+//Timestamp and pipeline statistics queries, one set of pools per frame slot. A slot's results are read once its fence
+//has been waited on, the next time the slot comes around, so reading them never stalls. Draw timestamps are written at
+//the bottom of the pipe after each draw, so a draw's time is the gap to the previous one and overlapping draws blur.
+class GpuProfiler
+{
+private:
+
+   struct FrameQueries
+   {
+      vk::QueryPool timestampPool; //Frame start, frame end, then one per timed draw
+      vk::QueryPool statisticsPool;
+      uint32_t drawTimestampCount; //Timed draws in the last frame recorded into this slot
+      bool pending; //Recorded and not yet read back
+   };
+
+   vk::Device device;
+   const vk::AllocationCallbacks* allocationCallbacks;
+
+   bool timestamps;
+   bool pipelineStatistics;
+   uint64_t timestampMask; //Only timestampValidBits of each timestamp are meaningful
+   double timestampPeriod; //Nanoseconds per tick
+   uint32_t maxDrawTimestamps;
+
+   std::vector<FrameQueries> frames;
+   std::vector<uint64_t> results; //Scratch space for readback
+
+   GpuTimings timings;
+
+public:
+   GpuProfiler ();
+
+   //A timestampValidBits of 0 disables timestamps. Pipeline statistics need the pipelineStatisticsQuery and
+   //inheritedQueries features, since the draws are recorded into secondary command buffers.
+   void init (vk::Device device, const vk::AllocationCallbacks* allocationCallbacks, uint32_t frameCount, uint32_t timestampValidBits,
+              float timestampPeriod, bool pipelineStatistics, uint32_t maxDrawTimestamps);
+   void destroy ();
+
+   bool isEnabled () const;
+
+   //Reads the results of the last frame recorded into this slot. Only call once the slot's fence has signaled.
+   void collect (uint32_t frameIndex);
+
+   //Outside the render pass, around it
+   void beginFrame (vk::CommandBuffer commandBuffer, uint32_t frameIndex, size_t drawCount);
+   void endFrame (vk::CommandBuffer commandBuffer, uint32_t frameIndex);
+
+   void writeDrawTimestamp (vk::CommandBuffer commandBuffer, uint32_t frameIndex, size_t drawIndex);
+
+   //Secondary command buffers executed while the statistics query is active have to declare it
+   vk::QueryPipelineStatisticFlags getInheritedStatistics () const;
+
+   const GpuTimings& getTimings () const;
+   void resetTimings ();
+};
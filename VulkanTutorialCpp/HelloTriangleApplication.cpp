@@ -1,4 +1,5 @@
 #include "HelloTriangleApplication.h"
+#include "Profiler.h"
 
 #include <functional>
 #include <iostream>
@@ -8,11 +9,15 @@
 #include <fstream>
 #include <chrono>
 #include <unordered_map>
+#include <limits>
+#include <cmath>
+#include <iomanip>
+#include <thread>
 
 #define STB_IMAGE_IMPLEMENTATION
-#include <stb\stb_image.h>
+#include <stb/stb_image.h>
 #define TINYOBJLOADER_IMPLEMENTATION
-#include <tinyobj\tiny_obj_loader.h>
+#include <tinyobj/tiny_obj_loader.h>
 
 static const int WIDTH = 800;
 static const int HEIGHT = 600;
@@ -23,9 +28,29 @@ static const std::string TEXTURE_PATH = "textures/purmesh.jpg";
 static const std::vector<const char*> validationLayers = {"VK_LAYER_LUNARG_standard_validation"};
 
 static const std::vector<const char*> deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+static const std::vector<const char*> dedicatedAllocationExtensions = {VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME, VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME};
+
+static const uint32_t MAX_FRAMES_IN_FLIGHT = 3; //Upper bound for ApplicationOptions::framesInFlight
+
+//A frame's fence is only waited on when its slot comes around again, so anything retired during frame N may still be
+//in use until frame N + MAX_FRAMES_IN_FLIGHT has started
+static const uint32_t DEFERRED_DESTRUCTION_FRAMES = MAX_FRAMES_IN_FLIGHT + 1;
+
+static const size_t DRAWS_PER_CHUNK = 64; //Draws per cached secondary command buffer, also the unit of work per recording thread
+static const uint64_t STATISTICS_INTERVAL_FRAMES = 600;
+static const vk::Format OFFSCREEN_FORMAT = vk::Format::eB8G8R8A8Unorm; //Same as the preferred surface format, so the pipeline matches
+static const uint32_t OFFSCREEN_IMAGE_COUNT = MAX_FRAMES_IN_FLIGHT; //Enough that a frame never waits for an image
+static const uint32_t MAX_DRAW_TIMESTAMPS = 4096; //Draws past this are only covered by the frame timestamps
+
+static const uint64_t COMPACTION_INTERVAL_FRAMES = 1000;
+static const float COMPACTION_MAX_OCCUPANCY = 0.5f;
+static const vk::DeviceSize COMPACTION_MAX_BYTES_PER_PASS = 64 * 1024 * 1024;
+
+//Dragging a window edge sends a resize event every few milliseconds, only the size it settles on gets a swap chain
+static const std::chrono::milliseconds RESIZE_DEBOUNCE (30);
 
 #ifdef NDEBUG
-static const bool enableValidationLayers = false
+static const bool enableValidationLayers = false;
 #else
 static const bool enableValidationLayers = true;
 #endif
@@ -40,6 +65,33 @@ static void getRequiredGlfwExtensions (std::vector<const char *> &extensions)
    extensions.insert (extensions.end (), glfwExtensions, glfwExtensions + glfwExtensionCount);
 }
 
+static uint32_t recordingThreadCount (const ApplicationOptions& options)
+{
+   return options.recordingThreads != 0 ? options.recordingThreads : std::max (1u, std::thread::hardware_concurrency ());
+}
+
+void DecodedPixelsDeleter::operator() (unsigned char* pixels) const
+{
+   stbi_image_free (pixels);
+}
+
+static DecodedImage decodeImage (const std::string& filename)
+{
+   PROFILE_ZONE ("decodeImage");
+
+   DecodedImage image = {};
+   int channels;
+
+   image.pixels.reset (stbi_load (filename.c_str (), &image.width, &image.height, &channels, STBI_rgb_alpha));
+
+   if (!image.pixels)
+   {
+      throw std::runtime_error ("failed to load texture image!");
+   }
+
+   return image;
+}
+
 static std::vector<char> readFile (const std::string& filename)
 {
    std::ifstream file (filename, std::ios::ate | std::ios::binary);
@@ -60,8 +112,36 @@ static std::vector<char> readFile (const std::string& filename)
    return buffer;
 }
 
+//Square grid on the xy plane centered on the origin, scaled down so the whole grid is as big as one copy of the model
+static std::vector<InstanceData> buildInstanceGrid (uint32_t count)
+{
+   uint32_t side = static_cast<uint32_t> (std::ceil (std::sqrt (static_cast<double> (std::max (count, 1u)))));
+   float scale = 1.0f / side;
+
+   std::vector<InstanceData> instances (count);
+
+   for (uint32_t i = 0; i < count; ++i)
+   {
+      glm::vec3 offset ((i % side) - (side - 1) * 0.5f, (i / side) - (side - 1) * 0.5f, 0.0f);
+
+      instances[i].model = glm::scale (glm::mat4 (1.0f), glm::vec3 (scale));
+      instances[i].model = glm::translate (instances[i].model, offset * 2.0f);
+   }
+
+   return instances;
+}
+
+
+HelloTriangleApplication::HelloTriangleApplication () : HelloTriangleApplication (ApplicationOptions ())
+{
+}
 
-HelloTriangleApplication::HelloTriangleApplication ()
+HelloTriangleApplication::HelloTriangleApplication (const ApplicationOptions& options)
+   : options (options), allocationCallbacks (hostAllocator.getCallbacks ()), workerPool (recordingThreadCount (options)), window (nullptr),
+   nextOffscreenImage (0),
+   framesInFlight (std::min (std::max (options.framesInFlight, 1u), MAX_FRAMES_IN_FLIGHT)), currentFrame (0),
+   frameWaitTime (0), resizePending (false), blockingSwapChainRecreation (false), resizeEvents (0), swapChainRecreations (0),
+   outOfDateRecreations (0), swapChainRecreateTime (0), slowestSwapChainRecreate (0), frameNumber (0), compactionInProgress (false)
 {
 }
 
@@ -70,12 +150,98 @@ HelloTriangleApplication::~HelloTriangleApplication ()
 {
 }
 
+const BenchmarkReport& HelloTriangleApplication::getBenchmarkReport () const
+{
+   return benchmarkReport;
+}
+
+void HelloTriangleApplication::setDrawTransform (size_t drawIndex, const glm::mat4& model)
+{
+   drawTransforms.set (drawIndex, model);
+
+   //Precomputed transforms are read from transformBuffer, the model matrix pushed with the draw goes unused
+   if (!options.precomputeTransforms)
+   {
+      drawListCache.invalidateDraw (drawIndex);
+
+      if (options.occlusionCulling)
+      {
+         lateDrawListCache.invalidateDraw (drawIndex);
+      }
+   }
+}
+
+std::string HelloTriangleApplication::modelPath () const
+{
+   return options.modelPath.empty () ? MODEL_PATH : options.modelPath;
+}
+
+std::string HelloTriangleApplication::texturePath () const
+{
+   return options.texturePath.empty () ? TEXTURE_PATH : options.texturePath;
+}
+
 void HelloTriangleApplication::run ()
 {
-   initWindow ();
+   launchTime = std::chrono::high_resolution_clock::now ();
+
+   Profiler::setEnabled (!options.profileOutput.empty ());
+   Profiler::setThreadName ("main");
+
+   //Reading and decoding assets needs no device, so it overlaps window, instance, device and pipeline creation
+   startAssetLoading ();
+
+   if (!options.headless)
+   {
+      initWindow ();
+   }
+
    initVulkan ();
-   mainLoop ();
+   initTimeSource ();
+
+   if (options.headless && options.benchmarkSuite)
+   {
+      runBenchmarkSuite ();
+   }
+   else if (options.headless)
+   {
+      runHeadless ();
+   }
+   else if (options.benchmarkSharingModes)
+   {
+      benchmarkBufferSharingModes ();
+   }
+   else if (options.benchmarkFramesInFlight)
+   {
+      benchmarkFramesInFlight ();
+   }
+   else if (options.benchmarkResize)
+   {
+      benchmarkResizeStorm ();
+   }
+   else
+   {
+      mainLoop ();
+   }
+
    cleanup ();
+
+   if (!options.recordTimePath.empty ())
+   {
+      timeSource.saveRecording (options.recordTimePath);
+   }
+
+   if (!options.profileOutput.empty ())
+   {
+      Profiler::setEnabled (false);
+
+      if (!Profiler::writeChromeTrace (options.profileOutput))
+      {
+         throw std::runtime_error ("failed to write profile!");
+      }
+
+      std::cout << "profile written to " << options.profileOutput << std::endl;
+   }
 }
 
 VKAPI_ATTR VkBool32 VKAPI_CALL HelloTriangleApplication::debugCallback (
@@ -95,6 +261,8 @@ VKAPI_ATTR VkBool32 VKAPI_CALL HelloTriangleApplication::debugCallback (
 
 void HelloTriangleApplication::initWindow ()
 {
+   PROFILE_ZONE ("initWindow");
+
    glfwInit ();
 
    glfwWindowHint (GLFW_CLIENT_API, GLFW_NO_API);
@@ -112,13 +280,17 @@ void HelloTriangleApplication::onWindowResized (GLFWwindow * window, int width,
 
    auto app = reinterpret_cast<HelloTriangleApplication*> (glfwGetWindowUserPointer (window));
 
-   app->recreateSwapChain ();
-
+   //Picked up by drawFrame once the events stop, so a drag recreates the swap chain once instead of per event
+   app->resizePending = true;
+   app->lastResizeEvent = std::chrono::high_resolution_clock::now ();
+   ++app->resizeEvents;
 }
 
 
 void HelloTriangleApplication::initVulkan ()
 {
+   PROFILE_ZONE ("initVulkan");
+
    createInstance ();
    setupDebugCallback ();
    createSurface ();
@@ -130,21 +302,33 @@ void HelloTriangleApplication::initVulkan ()
    createDescriptorSetLayout ();
    createGraphicsPipeline ();
    createCommandPool ();
+
+   beginUploadBatch ();
    createDepthResources ();
    createFramebuffers ();
    createTexture ();
-   loadModel ();
+   waitForModel ();
+   buildDrawList ();
+   createDrawListCache ();
    createVertexBuffer ();
    createIndexBuffer ();
+   createInstanceBuffer ();
+   endUploadBatch ();
+
    createUniformBuffer ();
+   createTransformBuffer ();
+   createGpuCuller ();
    createDescriptorPool ();
    createDescriptorSet ();
-   createCommandBuffers ();
-   createSemaphores ();
+   createSyncObjects ();
+
+   printMemoryStatistics ();
 }
 
 void HelloTriangleApplication::createTexture ()
 {
+   PROFILE_ZONE ("createTexture");
+
    createTextureImage ();
    createTextureImageView ();
    createTextureSampler ();
@@ -152,6 +336,8 @@ void HelloTriangleApplication::createTexture ()
 
 void HelloTriangleApplication::createInstance ()
 {
+   PROFILE_ZONE ("createInstance");
+
    if (enableValidationLayers)
    {
       PrintSupportedValidationLayers ();
@@ -191,7 +377,7 @@ void HelloTriangleApplication::createInstance ()
 
    try
    {
-      instance = vk::createInstance (createInfo, nullptr);
+      instance = vk::createInstance (createInfo, allocationCallbacks);
    }
    catch (std::exception const&)
    {
@@ -203,6 +389,8 @@ void HelloTriangleApplication::createInstance ()
 
 void HelloTriangleApplication::setupDebugCallback ()
 {
+   PROFILE_ZONE ("setupDebugCallback");
+
    if (!enableValidationLayers) return;
 
    auto vkCreateDebugReportCallbackEXT = (PFN_vkCreateDebugReportCallbackEXT) instance.getProcAddr ("vkCreateDebugReportCallbackEXT");
@@ -224,7 +412,7 @@ void HelloTriangleApplication::setupDebugCallback ()
       if (CreateDebugReportCallbackEXT (
          VkInstance (instance),
          reinterpret_cast<VkDebugReportCallbackCreateInfoEXT*>(&createInfo),
-         nullptr,
+         reinterpret_cast<const VkAllocationCallbacks*> (allocationCallbacks),
          reinterpret_cast<VkDebugReportCallbackEXT*>(&callback)) != VK_SUCCESS)
       {
          throw std::runtime_error ("failed to set up debug callback!");
@@ -235,7 +423,14 @@ void HelloTriangleApplication::setupDebugCallback ()
 
 void HelloTriangleApplication::createSurface ()
 {
-   if (glfwCreateWindowSurface (VkInstance (instance), window, nullptr, reinterpret_cast<VkSurfaceKHR*> (&surface)) != VK_SUCCESS)
+   PROFILE_ZONE ("createSurface");
+
+   if (options.headless)
+   {
+      return;
+   }
+
+   if (glfwCreateWindowSurface (VkInstance (instance), window, reinterpret_cast<const VkAllocationCallbacks*> (allocationCallbacks), reinterpret_cast<VkSurfaceKHR*> (&surface)) != VK_SUCCESS)
    {
       throw std::runtime_error ("failed to create window surface!");
    }
@@ -243,6 +438,8 @@ void HelloTriangleApplication::createSurface ()
 
 void HelloTriangleApplication::pickPhysicalDevice ()
 {
+   PROFILE_ZONE ("pickPhysicalDevice");
+
    PrintAvailablePhysicalDevices (instance);
 
    std::vector<vk::PhysicalDevice> devices = instance.enumeratePhysicalDevices ();
@@ -272,6 +469,14 @@ bool HelloTriangleApplication::isDeviceSuitable (vk::PhysicalDevice device)
 {
    QueueFamilyIndices indices = findQueueFamilies (device);
 
+   vk::PhysicalDeviceFeatures supportedFeatures = device.getFeatures ();
+
+   //Rendering offscreen needs neither the swap chain extension nor a surface, and there is no surface to query
+   if (options.headless)
+   {
+      return indices.isComplete () && supportedFeatures.samplerAnisotropy;
+   }
+
    bool extensionsSupported = checkDeviceExtensionSupport (device);
 
    bool swapChainAdequate = false;
@@ -283,8 +488,6 @@ bool HelloTriangleApplication::isDeviceSuitable (vk::PhysicalDevice device)
 
    }
 
-   vk::PhysicalDeviceFeatures supportedFeatures = device.getFeatures ();
-
    return indices.isComplete () && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy;
 }
 
@@ -302,8 +505,17 @@ QueueFamilyIndices HelloTriangleApplication::findQueueFamilies (vk::PhysicalDevi
          indices.graphicsFamily = i;
       }
 
+      //Without a surface nothing is presented, the graphics queue stands in for the present queue
       vk::Bool32 presentSupport = false;
-      device.getSurfaceSupportKHR (i, surface, &presentSupport);
+
+      if (options.headless)
+      {
+         presentSupport = queueFamily.queueFlags & vk::QueueFlagBits::eGraphics ? VK_TRUE : VK_FALSE;
+      }
+      else
+      {
+         device.getSurfaceSupportKHR (i, surface, &presentSupport);
+      }
 
       if (queueFamily.queueCount > 0 && presentSupport)
       {
@@ -323,6 +535,12 @@ QueueFamilyIndices HelloTriangleApplication::findQueueFamilies (vk::PhysicalDevi
       ++i;
    }
 
+   //Software drivers such as lavapipe expose a single family, uploads then go through the graphics queue
+   if (indices.transferFamily < 0)
+   {
+      indices.transferFamily = indices.graphicsFamily;
+   }
+
    return indices;
 }
 
@@ -341,6 +559,14 @@ SwapChainSupportDetails HelloTriangleApplication::querySwapChainSupport (vk::Phy
 
 void HelloTriangleApplication::createSwapChain ()
 {
+   PROFILE_ZONE ("createSwapChain");
+
+   if (options.headless)
+   {
+      createOffscreenImages ();
+      return;
+   }
+
    SwapChainSupportDetails swapChainSupport = querySwapChainSupport (physicalDevice);
 
    vk::SurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat (swapChainSupport.formats);
@@ -348,7 +574,10 @@ void HelloTriangleApplication::createSwapChain ()
 
    vk::Extent2D extent = chooseSwapExtent (swapChainSupport.capabilities);
 
-   uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+   //More images let mailbox and immediate run ahead of the display, fewer cut the latency FIFO queues up
+   uint32_t imageCount = options.swapChainImageCount != 0 ? options.swapChainImageCount : swapChainSupport.capabilities.minImageCount + 1;
+   imageCount = std::max (imageCount, swapChainSupport.capabilities.minImageCount);
+
    if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
    {
       imageCount = swapChainSupport.capabilities.maxImageCount;
@@ -385,9 +614,9 @@ void HelloTriangleApplication::createSwapChain ()
 
    createInfo.presentMode = presentMode;
    createInfo.clipped = VK_TRUE;
-   createInfo.oldSwapchain = VK_NULL_HANDLE;
+   createInfo.oldSwapchain = swapChain; //Lets the presentation engine hand over the images still being presented, null the first time
 
-   if (device.createSwapchainKHR (&createInfo, nullptr, &swapChain) != vk::Result::eSuccess)
+   if (device.createSwapchainKHR (&createInfo, allocationCallbacks, &swapChain) != vk::Result::eSuccess)
    {
       throw std::runtime_error ("failed to create swap chain!");
    }
@@ -400,6 +629,25 @@ void HelloTriangleApplication::createSwapChain ()
 
 }
 
+void HelloTriangleApplication::createOffscreenImages ()
+{
+   //Stand in for the swap chain images, everything downstream renders to them the same way
+   swapChainImageFormat = OFFSCREEN_FORMAT;
+   swapChainExtent = vk::Extent2D (WIDTH, HEIGHT);
+
+   swapChainImages.resize (OFFSCREEN_IMAGE_COUNT);
+   offscreenImageAllocations.resize (OFFSCREEN_IMAGE_COUNT);
+
+   for (uint32_t i = 0; i < OFFSCREEN_IMAGE_COUNT; ++i)
+   {
+      createImage (swapChainExtent.width, swapChainExtent.height, swapChainImageFormat, vk::ImageTiling::eOptimal,
+                   vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eDeviceLocal,
+                   swapChainImages[i], offscreenImageAllocations[i]);
+   }
+
+   nextOffscreenImage = 0;
+}
+
 vk::SurfaceFormatKHR HelloTriangleApplication::chooseSwapSurfaceFormat (const std::vector<vk::SurfaceFormatKHR>& availableFormats)
 {
    if (availableFormats.size () == 1 && availableFormats[0].format == vk::Format::eUndefined)
@@ -421,22 +669,15 @@ vk::SurfaceFormatKHR HelloTriangleApplication::chooseSwapSurfaceFormat (const st
 
 vk::PresentModeKHR HelloTriangleApplication::chooseSwapPresentMode (const std::vector<vk::PresentModeKHR>& availablePresentModes)
 {
-
-   vk::PresentModeKHR bestMode = vk::PresentModeKHR::eFifo;
-
-   for (const auto& availablePresentMode : availablePresentModes)
+   if (std::find (availablePresentModes.begin (), availablePresentModes.end (), options.presentMode) != availablePresentModes.end ())
    {
-      if (availablePresentMode == vk::PresentModeKHR::eMailbox)
-      {
-         return availablePresentMode;
-      }
-      else if (availablePresentMode == vk::PresentModeKHR::eFifo)
-      {
-         bestMode = availablePresentMode;
-      }
+      return options.presentMode;
    }
 
-   return bestMode;
+   //FIFO is the only mode the specification requires
+   std::cout << "present mode " << vk::to_string (options.presentMode) << " is not supported, using FIFO" << std::endl;
+
+   return vk::PresentModeKHR::eFifo;
 }
 
 vk::Extent2D HelloTriangleApplication::chooseSwapExtent (const vk::SurfaceCapabilitiesKHR & capabilities)
@@ -460,6 +701,8 @@ vk::Extent2D HelloTriangleApplication::chooseSwapExtent (const vk::SurfaceCapabi
 
 void HelloTriangleApplication::createImageViews ()
 {
+   PROFILE_ZONE ("createImageViews");
+
    swapChainImageViews.resize (swapChainImages.size ());
 
    for (size_t i = 0; i < swapChainImages.size (); ++i)
@@ -487,7 +730,7 @@ vk::ImageView HelloTriangleApplication::createImageView (vk::Image & image, vk::
 
    try
    {
-      imageView = device.createImageView (viewInfo, nullptr);
+      imageView = device.createImageView (viewInfo, allocationCallbacks);
    }
    catch (std::exception const &e)
    {
@@ -499,6 +742,8 @@ vk::ImageView HelloTriangleApplication::createImageView (vk::Image & image, vk::
 
 void HelloTriangleApplication::createRenderPass ()
 {
+   PROFILE_ZONE ("createRenderPass");
+
    vk::AttachmentDescription colorAttachment = {};
    colorAttachment.setFormat (swapChainImageFormat);
    colorAttachment.setSamples (vk::SampleCountFlagBits::e1);
@@ -509,7 +754,7 @@ void HelloTriangleApplication::createRenderPass ()
    colorAttachment.setStencilStoreOp (vk::AttachmentStoreOp::eDontCare);
 
    colorAttachment.setInitialLayout (vk::ImageLayout::eUndefined);
-   colorAttachment.setFinalLayout (vk::ImageLayout::ePresentSrcKHR);
+   colorAttachment.setFinalLayout (options.headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR);
 
    vk::AttachmentReference colorAttachmentRef = {};
    colorAttachmentRef.attachment = 0;
@@ -518,12 +763,12 @@ void HelloTriangleApplication::createRenderPass ()
    vk::AttachmentDescription depthAttachment = {};
    depthAttachment.setFormat (findDepthFormat ());
    depthAttachment.setSamples (vk::SampleCountFlagBits::e1);
-   depthAttachment.setLoadOp = vk::AttachmentLoadOp::eClear;
-   depthAttachment.setStoreOp = vk::AttachmentStoreOp::eDontCare;
-   depthAttachment.setStencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-   depthAttachment.setStencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-   depthAttachment.setInitialLayout = vk::ImageLayout::eUndefined;
-   depthAttachment.setFinalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+   depthAttachment.setLoadOp (vk::AttachmentLoadOp::eClear);
+   depthAttachment.setStoreOp (vk::AttachmentStoreOp::eDontCare); //Never stored, which is what lets the depth image be transient
+   depthAttachment.setStencilLoadOp (vk::AttachmentLoadOp::eDontCare);
+   depthAttachment.setStencilStoreOp (vk::AttachmentStoreOp::eDontCare);
+   depthAttachment.setInitialLayout (vk::ImageLayout::eUndefined);
+   depthAttachment.setFinalLayout (vk::ImageLayout::eDepthStencilAttachmentOptimal);
 
    vk::AttachmentReference depthAttachmentRef = {};
    depthAttachmentRef.attachment = 1;
@@ -535,12 +780,17 @@ void HelloTriangleApplication::createRenderPass ()
    subpass.pColorAttachments = &colorAttachmentRef;
    subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
+   //The frames in flight share depthImage, so the clear also waits for the previous frame's depth writes
    vk::SubpassDependency dependency = {};
    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
    dependency.dstSubpass = 0;
-   dependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-   dependency.dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-   dependency.dstAccessMask = vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+   dependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eEarlyFragmentTests |
+      vk::PipelineStageFlagBits::eLateFragmentTests;
+   dependency.srcAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+   dependency.dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eEarlyFragmentTests |
+      vk::PipelineStageFlagBits::eLateFragmentTests;
+   dependency.dstAccessMask = vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite |
+      vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
 
    std::array<vk::AttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
 
@@ -552,7 +802,68 @@ void HelloTriangleApplication::createRenderPass ()
    renderPassInfo.dependencyCount = 1;
    renderPassInfo.pDependencies = &dependency;
 
-   if (device.createRenderPass (&renderPassInfo, nullptr, &renderPass) != vk::Result::eSuccess)
+   //Occlusion culling splits the frame in two passes around the depth pyramid. The first keeps both attachments and
+   //leaves the depth readable for the reduction, the second loads them and finishes the frame like the single pass does.
+   std::array<vk::SubpassDependency, 2> earlyDependencies = {};
+
+   if (options.occlusionCulling)
+   {
+      attachments[0].setFinalLayout (vk::ImageLayout::eColorAttachmentOptimal);
+      attachments[1].setStoreOp (vk::AttachmentStoreOp::eStore);
+      attachments[1].setFinalLayout (vk::ImageLayout::eDepthStencilReadOnlyOptimal);
+
+      //The previous frame's reduction read the depth image this pass clears, and its late pass wrote it
+      earlyDependencies[0] = dependency;
+      earlyDependencies[0].srcStageMask |= vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eEarlyFragmentTests |
+         vk::PipelineStageFlagBits::eLateFragmentTests;
+      earlyDependencies[0].srcAccessMask |= vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+      earlyDependencies[0].dstStageMask |= vk::PipelineStageFlagBits::eEarlyFragmentTests;
+      earlyDependencies[0].dstAccessMask |= vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+
+      earlyDependencies[1].srcSubpass = 0;
+      earlyDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+      earlyDependencies[1].srcStageMask = vk::PipelineStageFlagBits::eLateFragmentTests;
+      earlyDependencies[1].srcAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+      earlyDependencies[1].dstStageMask = vk::PipelineStageFlagBits::eComputeShader;
+      earlyDependencies[1].dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+      renderPassInfo.dependencyCount = static_cast<uint32_t> (earlyDependencies.size ());
+      renderPassInfo.pDependencies = earlyDependencies.data ();
+   }
+
+   if (device.createRenderPass (&renderPassInfo, allocationCallbacks, &renderPass) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create render pass!");
+   }
+
+   if (!options.occlusionCulling)
+   {
+      return;
+   }
+
+   attachments[0].setLoadOp (vk::AttachmentLoadOp::eLoad);
+   attachments[0].setInitialLayout (vk::ImageLayout::eColorAttachmentOptimal);
+   attachments[0].setFinalLayout (colorAttachment.finalLayout);
+
+   attachments[1].setLoadOp (vk::AttachmentLoadOp::eLoad);
+   attachments[1].setStoreOp (vk::AttachmentStoreOp::eDontCare);
+   attachments[1].setInitialLayout (vk::ImageLayout::eDepthStencilReadOnlyOptimal);
+   attachments[1].setFinalLayout (depthAttachment.finalLayout);
+
+   //Waits for the reduction to finish reading the depth before it is written again, and for the early draws' color
+   vk::SubpassDependency lateDependency = {};
+   lateDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+   lateDependency.dstSubpass = 0;
+   lateDependency.srcStageMask = vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eColorAttachmentOutput;
+   lateDependency.srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+   lateDependency.dstStageMask = vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eColorAttachmentOutput;
+   lateDependency.dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite |
+      vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+
+   renderPassInfo.dependencyCount = 1;
+   renderPassInfo.pDependencies = &lateDependency;
+
+   if (device.createRenderPass (&renderPassInfo, allocationCallbacks, &lateRenderPass) != vk::Result::eSuccess)
    {
       throw std::runtime_error ("failed to create render pass!");
    }
@@ -560,9 +871,12 @@ void HelloTriangleApplication::createRenderPass ()
 
 void HelloTriangleApplication::createGraphicsPipeline ()
 {
-   auto vertShaderCode = readFile ("shaders/vert.spv");
+   PROFILE_ZONE ("createGraphicsPipeline");
 
-   std::cout << "shaders/vert.spv read with size: " << vertShaderCode.size () << " bytes" << std::endl;
+   std::string vertShaderPath = options.precomputeTransforms ? "shaders/vert_mvp.spv" : "shaders/vert.spv";
+   auto vertShaderCode = readFile (vertShaderPath);
+
+   std::cout << vertShaderPath << " read with size: " << vertShaderCode.size () << " bytes" << std::endl;
 
    auto fragShaderCode = readFile ("shaders/frag.spv");
 
@@ -588,11 +902,16 @@ void HelloTriangleApplication::createGraphicsPipeline ()
 
    vk::PipelineVertexInputStateCreateInfo vertexInputInfo = {};
 
-   auto bindingDescription = Vertex::getBindingDescription ();
-   auto attributeDescription = Vertex::getAttributeDescriptions ();
+   std::array<vk::VertexInputBindingDescription, 2> bindingDescription = {Vertex::getBindingDescription (), InstanceData::getBindingDescription ()};
+
+   std::vector<vk::VertexInputAttributeDescription> attributeDescription;
+   auto vertexAttributes = Vertex::getAttributeDescriptions ();
+   auto instanceAttributes = InstanceData::getAttributeDescriptions ();
+   attributeDescription.insert (attributeDescription.end (), vertexAttributes.begin (), vertexAttributes.end ());
+   attributeDescription.insert (attributeDescription.end (), instanceAttributes.begin (), instanceAttributes.end ());
 
-   vertexInputInfo.vertexBindingDescriptionCount = 1;
-   vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+   vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t> (bindingDescription.size ());
+   vertexInputInfo.pVertexBindingDescriptions = bindingDescription.data ();
    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t> (attributeDescription.size ());
    vertexInputInfo.pVertexAttributeDescriptions = attributeDescription.data ();
 
@@ -600,24 +919,12 @@ void HelloTriangleApplication::createGraphicsPipeline ()
    inputAssembly.topology = vk::PrimitiveTopology::eTriangleList;
    inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-   vk::Viewport viewport = {};
-   viewport.x = 0.0f;
-   viewport.y = 0.0f;
-
-   viewport.width = (float) swapChainExtent.width;
-   viewport.height = (float) swapChainExtent.height;
-   viewport.minDepth = 0.0f;
-   viewport.maxDepth = 1.0f;
-
-   vk::Rect2D scissor = {};
-   scissor.offset = {0, 0};
-   scissor.extent = swapChainExtent;
-
+   //Viewport and scissor are dynamic, so nothing here depends on the swap chain extent and a resize keeps the pipeline
    vk::PipelineViewportStateCreateInfo viewportState = {};
    viewportState.viewportCount = 1;
-   viewportState.pViewports = &viewport;
+   viewportState.pViewports = nullptr;
    viewportState.scissorCount = 1;
-   viewportState.pScissors = &scissor;
+   viewportState.pScissors = nullptr;
 
    vk::PipelineRasterizationStateCreateInfo rasterizer = {};
    rasterizer.depthClampEnable = VK_FALSE;
@@ -666,18 +973,23 @@ void HelloTriangleApplication::createGraphicsPipeline ()
    depthStencil.depthBoundsTestEnable = VK_FALSE;
    depthStencil.stencilTestEnable = VK_FALSE;
 
-   vk::DynamicState dynamicStates[] = {vk::DynamicState::eViewport, vk::DynamicState::eLineWidth};
+   vk::DynamicState dynamicStates[] = {vk::DynamicState::eViewport, vk::DynamicState::eScissor};
    vk::PipelineDynamicStateCreateInfo dynamicState = {};
    dynamicState.dynamicStateCount = 2;
    dynamicState.pDynamicStates = dynamicStates;
 
+   vk::PushConstantRange pushConstantRange = {};
+   pushConstantRange.stageFlags = vk::ShaderStageFlagBits::eVertex;
+   pushConstantRange.offset = 0;
+   pushConstantRange.size = sizeof (PushConstants);
+
    vk::PipelineLayoutCreateInfo pipelineLayoutInfo = {};
    pipelineLayoutInfo.setLayoutCount = 1;
    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-   pipelineLayoutInfo.pushConstantRangeCount = 0;
-   pipelineLayoutInfo.pPushConstantRanges = nullptr;
+   pipelineLayoutInfo.pushConstantRangeCount = 1;
+   pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
-   if (device.createPipelineLayout (&pipelineLayoutInfo, nullptr, &pipelineLayout) != vk::Result::eSuccess)
+   if (device.createPipelineLayout (&pipelineLayoutInfo, allocationCallbacks, &pipelineLayout) != vk::Result::eSuccess)
    {
       throw std::runtime_error ("failed to create the pipeline layout!");
    }
@@ -693,19 +1005,47 @@ void HelloTriangleApplication::createGraphicsPipeline ()
    pipelineInfo.pDepthStencilState = nullptr;
    pipelineInfo.pColorBlendState = &colorBlending;
    pipelineInfo.pDepthStencilState = &depthStencil;
-   pipelineInfo.pDynamicState = nullptr;
+   pipelineInfo.pDynamicState = &dynamicState;
 
    pipelineInfo.layout = pipelineLayout;
    pipelineInfo.renderPass = renderPass;
    pipelineInfo.subpass = 0;
 
-   if (device.createGraphicsPipelines (VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != vk::Result::eSuccess)
+   if (device.createGraphicsPipelines (VK_NULL_HANDLE, 1, &pipelineInfo, allocationCallbacks, &graphicsPipeline) != vk::Result::eSuccess)
    {
       throw std::runtime_error ("failed to create graphics pipeline!");
    }
 
-   device.destroyShaderModule (fragShaderModule, nullptr);
-   device.destroyShaderModule (vertShaderModule, nullptr);
+   device.destroyShaderModule (fragShaderModule, allocationCallbacks);
+   device.destroyShaderModule (vertShaderModule, allocationCallbacks);
+}
+
+void HelloTriangleApplication::setViewportAndScissor (vk::CommandBuffer commandBuffer)
+{
+   vk::Viewport viewport = {};
+   viewport.x = 0.0f;
+   viewport.y = 0.0f;
+   viewport.width = (float) swapChainExtent.width;
+   viewport.height = (float) swapChainExtent.height;
+   viewport.minDepth = 0.0f;
+   viewport.maxDepth = 1.0f;
+
+   vk::Rect2D scissor = {};
+   scissor.offset = {0, 0};
+   scissor.extent = swapChainExtent;
+
+   commandBuffer.setViewport (0, 1, &viewport);
+   commandBuffer.setScissor (0, 1, &scissor);
+}
+
+void HelloTriangleApplication::destroyRenderPassAndPipeline ()
+{
+   device.destroyPipeline (graphicsPipeline, allocationCallbacks);
+
+   device.destroyPipelineLayout (pipelineLayout, allocationCallbacks);
+
+   device.destroyRenderPass (renderPass, allocationCallbacks);
+   device.destroyRenderPass (lateRenderPass, allocationCallbacks);
 }
 
 vk::ShaderModule HelloTriangleApplication::createShaderModule (const std::vector<char>& code)
@@ -716,7 +1056,7 @@ vk::ShaderModule HelloTriangleApplication::createShaderModule (const std::vector
    createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data ());
 
    vk::ShaderModule shaderModule;
-   if (device.createShaderModule (&createInfo, nullptr, &shaderModule) != vk::Result::eSuccess)
+   if (device.createShaderModule (&createInfo, allocationCallbacks, &shaderModule) != vk::Result::eSuccess)
    {
       throw std::runtime_error ("failed to create shader module!");
    }
@@ -726,6 +1066,8 @@ vk::ShaderModule HelloTriangleApplication::createShaderModule (const std::vector
 
 void HelloTriangleApplication::createFramebuffers ()
 {
+   PROFILE_ZONE ("createFramebuffers");
+
    swapChainFramebuffers.resize (swapChainImageViews.size ());
 
    for (size_t i = 0; i < swapChainImageViews.size (); ++i)
@@ -740,7 +1082,7 @@ void HelloTriangleApplication::createFramebuffers ()
       framebufferInfo.height = swapChainExtent.height;
       framebufferInfo.layers = 1;
 
-      if (device.createFramebuffer (&framebufferInfo, nullptr, &swapChainFramebuffers[i]) != vk::Result::eSuccess)
+      if (device.createFramebuffer (&framebufferInfo, allocationCallbacks, &swapChainFramebuffers[i]) != vk::Result::eSuccess)
       {
          throw std::runtime_error ("failed to create framebuffer!");
       }
@@ -749,132 +1091,354 @@ void HelloTriangleApplication::createFramebuffers ()
 
 void HelloTriangleApplication::createCommandPool ()
 {
+   PROFILE_ZONE ("createCommandPool");
+
    QueueFamilyIndices queueFamilyIndices = findQueueFamilies (physicalDevice);
 
+   //Individually resettable so retired one time command buffers can be recycled
    vk::CommandPoolCreateInfo commandPoolGraphicsInfo = {};
+   commandPoolGraphicsInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
    commandPoolGraphicsInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
 
-   if (device.createCommandPool (&commandPoolGraphicsInfo, nullptr, &commandPoolGraphics) != vk::Result::eSuccess)
+   if (device.createCommandPool (&commandPoolGraphicsInfo, allocationCallbacks, &commandPoolGraphics) != vk::Result::eSuccess)
    {
       throw std::runtime_error ("failed to create command pool!");
    }
 
    vk::CommandPoolCreateInfo commandPoolTransferInfo = {};
+   commandPoolTransferInfo.flags = vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
    commandPoolTransferInfo.queueFamilyIndex = queueFamilyIndices.transferFamily;
 
-   if (device.createCommandPool (&commandPoolTransferInfo, nullptr, &commandPoolTransfer) != vk::Result::eSuccess)
+   if (device.createCommandPool (&commandPoolTransferInfo, allocationCallbacks, &commandPoolTransfer) != vk::Result::eSuccess)
    {
       throw std::runtime_error ("failed to create command pool!");
    }
-}
 
-void HelloTriangleApplication::createCommandBuffers ()
-{
-   commandBuffers.resize (swapChainFramebuffers.size ());
+   //The worker threads record into DrawListCache's pools
+   frameCommandPools.init (device, allocationCallbacks, queueFamilyIndices.graphicsFamily, framesInFlight);
 
-   vk::CommandBufferAllocateInfo allocInfo = {};
-   allocInfo.commandPool = commandPoolGraphics;
-   allocInfo.level = vk::CommandBufferLevel::ePrimary;
-   allocInfo.commandBufferCount = (uint32_t) commandBuffers.size ();
+   createQueryPools ();
+}
 
-   if (device.allocateCommandBuffers (&allocInfo, commandBuffers.data ()) != vk::Result::eSuccess)
+void HelloTriangleApplication::createQueryPools ()
+{
+   if (!options.gpuTiming)
    {
-      throw std::runtime_error ("failed to allocate command buffers!");
+      return;
    }
 
-   for (size_t i = 0; i < commandBuffers.size (); ++i)
-   {
-      vk::CommandBufferBeginInfo beginInfo = {};
-      beginInfo.flags = vk::CommandBufferUsageFlagBits::eSimultaneousUse;
-      beginInfo.pInheritanceInfo = nullptr;
+   QueueFamilyIndices queueFamilyIndices = findQueueFamilies (physicalDevice);
 
-      commandBuffers[i].begin (&beginInfo);
+   uint32_t timestampValidBits = physicalDevice.getQueueFamilyProperties ()[queueFamilyIndices.graphicsFamily].timestampValidBits;
+   float timestampPeriod = physicalDevice.getProperties ().limits.timestampPeriod;
 
-      vk::RenderPassBeginInfo renderPassInfo = {};
-      renderPassInfo.renderPass = renderPass;
-      renderPassInfo.framebuffer = swapChainFramebuffers[i];
+   vk::PhysicalDeviceFeatures supportedFeatures = physicalDevice.getFeatures ();
+   bool pipelineStatistics = supportedFeatures.pipelineStatisticsQuery && supportedFeatures.inheritedQueries;
 
-      renderPassInfo.renderArea.offset = {0, 0};
-      renderPassInfo.renderArea.extent = swapChainExtent;
+   uint32_t drawTimestamps = std::min (std::max (options.drawCount, 1u), MAX_DRAW_TIMESTAMPS);
 
-      std::array<vk::ClearValue, 2> clearValues = {};
-      vk::ClearColorValue clearColValue = {};
-      clearColValue.setFloat32 ({0.0f, 0.0f, 0.0f, 1.0f});
-      clearValues[0].setColor (clearColValue);
+   gpuProfiler.init (device, allocationCallbacks, framesInFlight, timestampValidBits, timestampPeriod, pipelineStatistics, drawTimestamps);
+}
 
-      clearValues[1].depthStencil = {1.0f, 0};
+void HelloTriangleApplication::recordCommandBuffer (vk::CommandBuffer commandBuffer, uint32_t imageIndex)
+{
+   PROFILE_ZONE ("recordCommandBuffer");
 
-      renderPassInfo.clearValueCount = static_cast<uint32_t> (clearValues.size ());
-      renderPassInfo.pClearValues = clearValues.data ();
+   vk::CommandBufferBeginInfo beginInfo = {};
+   beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+   beginInfo.pInheritanceInfo = nullptr;
+
+   commandBuffer.begin (&beginInfo);
+
+   vk::RenderPassBeginInfo renderPassInfo = {};
+   renderPassInfo.renderPass = renderPass;
+   renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+
+   renderPassInfo.renderArea.offset = {0, 0};
+   renderPassInfo.renderArea.extent = swapChainExtent;
 
-      commandBuffers[i].beginRenderPass (&renderPassInfo, vk::SubpassContents::eInline);
+   std::array<vk::ClearValue, 2> clearValues = {};
+   vk::ClearColorValue clearColValue = {};
+   clearColValue.setFloat32 ({0.0f, 0.0f, 0.0f, 1.0f});
+   clearValues[0].setColor (clearColValue);
 
-      commandBuffers[i].bindPipeline (vk::PipelineBindPoint::eGraphics, graphicsPipeline);
+   clearValues[1].depthStencil = {1.0f, 0};
 
-      commandBuffers[i].bindDescriptorSets (vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+   renderPassInfo.clearValueCount = static_cast<uint32_t> (clearValues.size ());
+   renderPassInfo.pClearValues = clearValues.data ();
 
-      vk::Buffer vertexBuffers[] = {vertexBuffer};
-      vk::DeviceSize offsets[] = {0};
-      commandBuffers[i].bindVertexBuffers (0, 1, vertexBuffers, offsets);
+   if (gpuCuller.isEnabled ())
+   {
+      gpuCuller.record (commandBuffer, currentFrame, CullPhase::eEarly, cullingView, cullingProjection, modelBounds, drawTransforms);
+   }
+
+   gpuProfiler.beginFrame (commandBuffer, currentFrame, drawList.size ());
+
+   if (!options.cacheDrawCommands)
+   {
+      drawListCache.invalidateAll ();
+      lateDrawListCache.invalidateAll ();
+   }
 
-      commandBuffers[i].bindIndexBuffer (indexBuffer, 0, vk::IndexType::eUint32);
+   commandBuffer.beginRenderPass (&renderPassInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+   executeDrawList (commandBuffer, CullPhase::eEarly);
+   commandBuffer.endRenderPass ();
 
-      commandBuffers[i].drawIndexed (static_cast<uint32_t>(indices.size ()), 1, 0, 0, 0);
+   //The depth pyramid is built from what the early draws left in the depth buffer, then the late draws add to both attachments
+   if (gpuCuller.isOcclusionCulling ())
+   {
+      gpuCuller.record (commandBuffer, currentFrame, CullPhase::eLate, cullingView, cullingProjection, modelBounds, drawTransforms);
 
-      commandBuffers[i].endRenderPass ();
+      renderPassInfo.renderPass = lateRenderPass;
+      renderPassInfo.clearValueCount = 0;
+      renderPassInfo.pClearValues = nullptr;
 
-      commandBuffers[i].end ();
+      commandBuffer.beginRenderPass (&renderPassInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+      executeDrawList (commandBuffer, CullPhase::eLate);
+      commandBuffer.endRenderPass ();
    }
 
+   gpuProfiler.endFrame (commandBuffer, currentFrame);
+
+   commandBuffer.end ();
 }
 
-void HelloTriangleApplication::createSemaphores ()
+void HelloTriangleApplication::executeDrawList (vk::CommandBuffer commandBuffer, CullPhase phase)
 {
-   vk::SemaphoreCreateInfo semaphoreInfo = {};
+   DrawListCache& cache = phase == CullPhase::eLate ? lateDrawListCache : drawListCache;
 
-   if (device.createSemaphore (&semaphoreInfo, nullptr, &imageAvailableSemaphore) != vk::Result::eSuccess
-       || device.createSemaphore (&semaphoreInfo, nullptr, &renderFinishedSemaphore) != vk::Result::eSuccess
-       )
+   //Only stale chunks are recorded, spread round robin over the threads
+   std::vector<size_t> staleChunks;
+   cache.collectStaleChunks (currentFrame, staleChunks);
+
+   if (!staleChunks.empty ())
    {
-      throw std::runtime_error ("failed to create semaphores!");
+      size_t threadCount = std::min<size_t> (workerPool.getThreadCount (), staleChunks.size ());
+
+      workerPool.run ([&] (uint32_t threadIndex)
+      {
+         for (size_t i = threadIndex; i < staleChunks.size (); i += threadCount)
+         {
+            recordChunk (phase, staleChunks[i]);
+         }
+      });
    }
-}
 
+   const std::vector<vk::CommandBuffer>& secondaryCommandBuffers = cache.getCommandBuffers (currentFrame);
+   commandBuffer.executeCommands (static_cast<uint32_t> (secondaryCommandBuffers.size ()), secondaryCommandBuffers.data ());
+}
 
-void HelloTriangleApplication::createLogicalDevice ()
+void HelloTriangleApplication::recordChunk (CullPhase phase, size_t chunkIndex)
 {
-   QueueFamilyIndices indices = findQueueFamilies (physicalDevice);
+   PROFILE_ZONE ("recordChunk");
 
-   std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
-   std::set<int> uniqueQueueFamilies = {indices.graphicsFamily, indices.presentFamily, indices.transferFamily};
+   DrawListCache& cache = phase == CullPhase::eLate ? lateDrawListCache : drawListCache;
 
-   float queuePriority = 1.0f;
+   vk::CommandBuffer commandBuffer = cache.beginChunk (currentFrame, chunkIndex);
 
-   for (int queueFamily : uniqueQueueFamilies)
-   {
-      vk::DeviceQueueCreateInfo queueCreateInfo = {};
-      queueCreateInfo.queueFamilyIndex = queueFamily;
-      queueCreateInfo.queueCount = 1;
-      queueCreateInfo.pQueuePriorities = &queuePriority;
-      queueCreateInfos.push_back (queueCreateInfo);
-   }
+   //No framebuffer, so the same command buffer can be replayed into whichever swap chain image was acquired. The late
+   //render pass is compatible with the early one, so either can be inherited.
+   vk::CommandBufferInheritanceInfo inheritanceInfo = {};
+   inheritanceInfo.renderPass = phase == CullPhase::eLate ? lateRenderPass : renderPass;
+   inheritanceInfo.subpass = 0;
+   inheritanceInfo.pipelineStatistics = gpuProfiler.getInheritedStatistics ();
 
-   vk::PhysicalDeviceFeatures deviceFeatures = {};
-   deviceFeatures.samplerAnisotropy = VK_TRUE;
+   vk::CommandBufferBeginInfo beginInfo = {};
+   beginInfo.flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+   beginInfo.pInheritanceInfo = &inheritanceInfo;
 
-   vk::DeviceCreateInfo createInfo = {};
+   commandBuffer.begin (&beginInfo);
 
-   createInfo.queueCreateInfoCount = static_cast<uint32_t> (queueCreateInfos.size ());
-   createInfo.pQueueCreateInfos = queueCreateInfos.data ();
+   //Secondary command buffers inherit no state from the primary, so every one binds everything. That includes the
+   //viewport of the current extent, which is why a resize invalidates the cached chunks.
+   commandBuffer.bindPipeline (vk::PipelineBindPoint::eGraphics, graphicsPipeline);
+   setViewportAndScissor (commandBuffer);
 
-   createInfo.pEnabledFeatures = &deviceFeatures;
+   //The cache is per frame slot, so the slot's uniform and transform offsets can be baked in
+   uint32_t dynamicOffsets[] = {static_cast<uint32_t> (currentFrame * uniformBufferStride), static_cast<uint32_t> (currentFrame * transformBufferStride)};
+   commandBuffer.bindDescriptorSets (vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 1, &descriptorSet, 2, dynamicOffsets);
 
-   createInfo.enabledExtensionCount = static_cast<uint32_t> (deviceExtensions.size ());
-   createInfo.ppEnabledExtensionNames = deviceExtensions.data ();
+   //Culled draws read the instances that survived, compacted into this slot's region
+   vk::Buffer vertexBuffers[] = {vertexBuffer, instanceBuffer};
+   vk::DeviceSize offsets[] = {0, 0};
 
-   if (enableValidationLayers)
+   if (gpuCuller.isEnabled ())
    {
-      createInfo.enabledLayerCount = static_cast<uint32_t> (validationLayers.size ());
+      vertexBuffers[1] = gpuCuller.getVisibleInstanceBuffer ();
+      offsets[1] = gpuCuller.getVisibleInstanceOffset (currentFrame, phase);
+   }
+
+   commandBuffer.bindVertexBuffers (0, 2, vertexBuffers, offsets);
+
+   commandBuffer.bindIndexBuffer (indexBuffer, 0, vk::IndexType::eUint32);
+
+   size_t firstDraw;
+   size_t lastDraw;
+   cache.getChunkDraws (chunkIndex, firstDraw, lastDraw);
+
+   for (size_t i = firstDraw; i < lastDraw; ++i)
+   {
+      PushConstants pushConstants;
+      pushConstants.model = drawTransforms.get (i);
+      pushConstants.drawIndex = static_cast<uint32_t> (i);
+
+      commandBuffer.pushConstants (pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof (pushConstants), &pushConstants);
+
+      if (gpuCuller.isEnabled ())
+      {
+         commandBuffer.drawIndexedIndirect (gpuCuller.getDrawCommandBuffer (), gpuCuller.getDrawCommandOffset (currentFrame, phase, i), 1, sizeof (vk::DrawIndexedIndirectCommand));
+      }
+      else
+      {
+         commandBuffer.drawIndexed (drawList[i].indexCount, std::max (options.instanceCount, 1u), drawList[i].firstIndex, 0, 0);
+      }
+
+      //Each draw has one timestamp query, which the late draws would write a second time
+      if (phase == CullPhase::eEarly)
+      {
+         gpuProfiler.writeDrawTimestamp (commandBuffer, currentFrame, i);
+      }
+   }
+
+   commandBuffer.end ();
+}
+
+void HelloTriangleApplication::createSyncObjects ()
+{
+   PROFILE_ZONE ("createSyncObjects");
+
+   createFrameSyncObjects ();
+
+   vk::FenceCreateInfo fenceInfo = {};
+
+   if (device.createFence (&fenceInfo, allocationCallbacks, &compactionFence) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create fence!");
+   }
+}
+
+void HelloTriangleApplication::createFrameSyncObjects ()
+{
+   imageAvailableSemaphores.resize (framesInFlight);
+   renderFinishedSemaphores.resize (framesInFlight);
+   inFlightFences.resize (framesInFlight);
+   imagesInFlight.assign (swapChainImages.size (), vk::Fence ());
+
+   vk::SemaphoreCreateInfo semaphoreInfo = {};
+
+   //Signaled so the first wait on every slot returns immediately
+   vk::FenceCreateInfo fenceInfo = {};
+   fenceInfo.flags = vk::FenceCreateFlagBits::eSignaled;
+
+   for (uint32_t i = 0; i < framesInFlight; ++i)
+   {
+      if (device.createSemaphore (&semaphoreInfo, allocationCallbacks, &imageAvailableSemaphores[i]) != vk::Result::eSuccess
+          || device.createSemaphore (&semaphoreInfo, allocationCallbacks, &renderFinishedSemaphores[i]) != vk::Result::eSuccess
+          || device.createFence (&fenceInfo, allocationCallbacks, &inFlightFences[i]) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to create synchronization objects for a frame!");
+      }
+   }
+
+   currentFrame = 0;
+}
+
+void HelloTriangleApplication::destroyFrameSyncObjects ()
+{
+   for (uint32_t i = 0; i < framesInFlight; ++i)
+   {
+      device.destroySemaphore (renderFinishedSemaphores[i], allocationCallbacks);
+      device.destroySemaphore (imageAvailableSemaphores[i], allocationCallbacks);
+      device.destroyFence (inFlightFences[i], allocationCallbacks);
+   }
+
+   imageAvailableSemaphores.clear ();
+   renderFinishedSemaphores.clear ();
+   inFlightFences.clear ();
+   imagesInFlight.clear ();
+}
+
+void HelloTriangleApplication::setFramesInFlight (uint32_t count)
+{
+   device.waitIdle ();
+
+   destroyFrameSyncObjects ();
+   frameCommandPools.destroy ();
+
+   framesInFlight = std::min (std::max (count, 1u), MAX_FRAMES_IN_FLIGHT);
+
+   frameCommandPools.init (device, allocationCallbacks, findQueueFamilies (physicalDevice).graphicsFamily, framesInFlight);
+   createFrameSyncObjects ();
+
+   drawListCache.destroy ();
+   lateDrawListCache.destroy ();
+   createDrawListCache ();
+
+   gpuProfiler.destroy ();
+   createQueryPools ();
+}
+
+
+void HelloTriangleApplication::createLogicalDevice ()
+{
+   PROFILE_ZONE ("createLogicalDevice");
+
+   QueueFamilyIndices indices = findQueueFamilies (physicalDevice);
+
+   std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
+   std::set<int> uniqueQueueFamilies = {indices.graphicsFamily, indices.presentFamily, indices.transferFamily};
+
+   float queuePriority = 1.0f;
+
+   for (int queueFamily : uniqueQueueFamilies)
+   {
+      vk::DeviceQueueCreateInfo queueCreateInfo = {};
+      queueCreateInfo.queueFamilyIndex = queueFamily;
+      queueCreateInfo.queueCount = 1;
+      queueCreateInfo.pQueuePriorities = &queuePriority;
+      queueCreateInfos.push_back (queueCreateInfo);
+   }
+
+   vk::PhysicalDeviceFeatures deviceFeatures = {};
+   deviceFeatures.samplerAnisotropy = VK_TRUE;
+
+   //The statistics query stays active while the secondary command buffers execute, which needs inherited queries
+   vk::PhysicalDeviceFeatures supportedFeatures = physicalDevice.getFeatures ();
+
+   if (options.gpuTiming && supportedFeatures.pipelineStatisticsQuery && supportedFeatures.inheritedQueries)
+   {
+      deviceFeatures.pipelineStatisticsQuery = VK_TRUE;
+      deviceFeatures.inheritedQueries = VK_TRUE;
+   }
+
+   vk::DeviceCreateInfo createInfo = {};
+
+   createInfo.queueCreateInfoCount = static_cast<uint32_t> (queueCreateInfos.size ());
+   createInfo.pQueueCreateInfos = queueCreateInfos.data ();
+
+   createInfo.pEnabledFeatures = &deviceFeatures;
+
+   //Dedicated allocations are optional, without them the allocator falls back to plain per resource allocations
+   std::vector<const char*> enabledExtensions;
+
+   if (!options.headless)
+   {
+      enabledExtensions = deviceExtensions;
+   }
+
+   bool dedicatedAllocation = checkDeviceExtensionSupport (physicalDevice, dedicatedAllocationExtensions);
+
+   if (dedicatedAllocation)
+   {
+      enabledExtensions.insert (enabledExtensions.end (), dedicatedAllocationExtensions.begin (), dedicatedAllocationExtensions.end ());
+   }
+
+   createInfo.enabledExtensionCount = static_cast<uint32_t> (enabledExtensions.size ());
+   createInfo.ppEnabledExtensionNames = enabledExtensions.data ();
+
+   if (enableValidationLayers)
+   {
+      createInfo.enabledLayerCount = static_cast<uint32_t> (validationLayers.size ());
       createInfo.ppEnabledLayerNames = validationLayers.data ();
    }
    else
@@ -882,11 +1446,14 @@ void HelloTriangleApplication::createLogicalDevice ()
       createInfo.enabledLayerCount = 0;
    }
 
-   if (physicalDevice.createDevice (&createInfo, nullptr, &device) != vk::Result::eSuccess)
+   if (physicalDevice.createDevice (&createInfo, allocationCallbacks, &device) != vk::Result::eSuccess)
    {
       throw std::runtime_error ("failed to create logical device!");
    }
 
+   memoryAllocator.init (physicalDevice, device, allocationCallbacks, dedicatedAllocation);
+   transferScheduler.init (device, allocationCallbacks);
+
    device.getQueue (indices.graphicsFamily, 0, &graphicsQueue);
    device.getQueue (indices.presentFamily, 0, &presentQueue);
    device.getQueue (indices.transferFamily, 0, &transferQueue);
@@ -894,730 +1461,2526 @@ void HelloTriangleApplication::createLogicalDevice ()
 
 void HelloTriangleApplication::mainLoop ()
 {
+   framePacer.setTargetFrameRate (options.targetFrameRate);
+
    while (!glfwWindowShouldClose (window))
    {
-      glfwPollEvents ();
+      int width = 0;
+      int height = 0;
+      glfwGetFramebufferSize (window, &width, &height);
+
+      //Minimized, there is nothing to present to, so sleep until an event restores the window instead of spinning
+      if (width == 0 || height == 0)
+      {
+         PROFILE_ZONE ("glfwWaitEvents");
+         glfwWaitEvents ();
+         continue;
+      }
+
+      //The limiter sleeps before events are polled, so the frame samples input as late as possible
+      {
+         PROFILE_ZONE ("frame limiter");
+         framePacer.beginFrame ();
+      }
+
+      {
+         PROFILE_ZONE ("glfwPollEvents");
+         glfwPollEvents ();
+      }
 
-      updateUniformBuffer ();
       drawFrame ();
+
+      framePacer.endFrame ();
+
+      if (frameNumber == 1)
+      {
+         auto firstFrameTime = std::chrono::high_resolution_clock::now ();
+         double milliseconds = std::chrono::duration<double, std::chrono::milliseconds::period> (firstFrameTime - launchTime).count ();
+
+         std::cout << "time to first frame: " << milliseconds << " ms (" << (options.sequentialInit ? "sequential" : "parallel") << " init)" << std::endl;
+      }
+
+      if (frameNumber % STATISTICS_INTERVAL_FRAMES == 0)
+      {
+         printFrameStatistics ();
+      }
+
+      updateMemoryCompaction ();
+
+      if (frameNumber % COMPACTION_INTERVAL_FRAMES == 0)
+      {
+         beginMemoryCompaction ();
+      }
    }
 
    device.waitIdle ();
 }
 
-void HelloTriangleApplication::updateUniformBuffer ()
+void HelloTriangleApplication::runHeadless ()
 {
-   static auto startTime = std::chrono::high_resolution_clock::now ();
+   framePacer.setTargetFrameRate (options.targetFrameRate);
 
-   auto currentTime = std::chrono::high_resolution_clock::now ();
+   RollingStatistics cpuFrameTimes (options.headlessFrames);
 
-   float time = std::chrono::duration<float, std::chrono::seconds::period> (currentTime - startTime).count ();
-   UniformBufferObject ubo = {};
-   ubo.model = glm::rotate (glm::mat4 (1.0f), time * glm::radians (90.0f), glm::vec3 (0.0f, 0.0f, 1.0f));
+   auto startTime = std::chrono::high_resolution_clock::now ();
 
-   ubo.view = glm::lookAt (glm::vec3 (2.0f, 2.0f, 2.0f), glm::vec3 (0.0f, 0.0f, 0.0f), glm::vec3 (0.0f, 0.0f, 1.0f));
+   for (uint32_t i = 0; i < options.headlessFrames; ++i)
+   {
+      {
+         PROFILE_ZONE ("frame limiter");
+         framePacer.beginFrame ();
+      }
 
-   ubo.proj = glm::perspective (glm::radians (45.0f), swapChainExtent.width / (float) swapChainExtent.height, 0.1f, 10.0f);
-   ubo.proj[1][1] *= -1; //glm is orignally designed for OpenGL which inverts its y-coordinate so we need to flip it
+      auto frameStart = std::chrono::high_resolution_clock::now ();
+
+      drawFrame ();
+
+      cpuFrameTimes.add (std::chrono::duration<double, std::milli> (std::chrono::high_resolution_clock::now () - frameStart).count ());
+
+      framePacer.endFrame ();
+   }
+
+   device.waitIdle ();
+
+   //Throughput includes the GPU draining the last frames, the frame times are what drawFrame cost the CPU
+   auto endTime = std::chrono::high_resolution_clock::now ();
+   double seconds = std::chrono::duration<double, std::chrono::seconds::period> (endTime - startTime).count ();
 
-   void* data;
-   data = device.mapMemory (uniformBufferMemory, 0, sizeof (ubo));
-   memcpy (data, &ubo, sizeof (ubo));
+   std::cout << "headless: " << options.headlessFrames << " frames in " << seconds << " s, " << options.headlessFrames / seconds << " fps" << std::endl;
+   std::cout << "cpu frame time: " << cpuFrameTimes.getMean () << " ms mean, " << cpuFrameTimes.getPercentile (50.0) << " ms median, "
+      << cpuFrameTimes.getPercentile (99.0) << " ms 99th percentile, " << cpuFrameTimes.getMax () << " ms worst" << std::endl;
 
-   device.unmapMemory (uniformBufferMemory);
+   printFrameStatistics ();
+
+   if (options.checksum)
+   {
+      uint32_t lastImage = (nextOffscreenImage + static_cast<uint32_t> (swapChainImages.size ()) - 1) % static_cast<uint32_t> (swapChainImages.size ());
+
+      std::cout << "image checksum: " << std::hex << std::setw (16) << std::setfill ('0') << checksumImage (swapChainImages[lastImage])
+         << std::dec << std::setfill (' ') << std::endl;
+   }
 }
 
-void HelloTriangleApplication::drawFrame ()
+void HelloTriangleApplication::runBenchmarkSuite ()
 {
-   uint32_t imageIndex;
-   vk::Result result = device.acquireNextImageKHR (swapChain, std::numeric_limits<uint64_t>::max (), imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+   typedef std::chrono::high_resolution_clock Clock;
 
-   if (result == vk::Result::eErrorOutOfDateKHR)
+   auto elapsedMilliseconds = [] (Clock::time_point start) { return std::chrono::duration<double, std::milli> (Clock::now () - start).count (); };
+
+   //Parse and weld, every run starts from empty arrays like the first load did
+   std::vector<double> samples;
+
+   for (uint32_t i = 0; i < options.benchmarkIterations; ++i)
    {
-      recreateSwapChain ();
-      return;
+      vertices.clear ();
+      indices.clear ();
+
+      auto start = Clock::now ();
+      loadModel ();
+      samples.push_back (elapsedMilliseconds (start));
    }
-   else if (result != vk::Result::eSuccess && result != vk::Result::eSuboptimalKHR)
+
+   benchmarkReport.add ("loadModel", samples);
+   samples.clear ();
+
+   for (uint32_t i = 0; i < options.benchmarkIterations; ++i)
    {
-      throw std::runtime_error ("failed to acquire swap chain image!");
+      auto start = Clock::now ();
+      DecodedImage image = decodeImage (texturePath ());
+      samples.push_back (elapsedMilliseconds (start));
    }
 
-   vk::SubmitInfo submitInfo = {};
+   benchmarkReport.add ("stbi_load", samples);
+   samples.clear ();
 
-   vk::Semaphore waitSemaphores[] = {imageAvailableSemaphore};
-   vk::PipelineStageFlags waitStages[] = {vk::PipelineStageFlagBits::eColorAttachmentOutput};
+   //From recording the copy to the host seeing its fence, staging buffer included
+   for (uint32_t i = 0; i < options.benchmarkIterations; ++i)
+   {
+      vk::Buffer buffer;
+      MemoryAllocation allocation;
 
-   submitInfo.waitSemaphoreCount = 1;
-   submitInfo.pWaitSemaphores = waitSemaphores;
-   submitInfo.pWaitDstStageMask = waitStages;
+      auto start = Clock::now ();
 
-   submitInfo.commandBufferCount = 1;
-   submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+      TransferHandle upload = createDeviceLocalBuffer (vertices.data (), sizeof (vertices[0]) * vertices.size (), vk::BufferUsageFlagBits::eVertexBuffer,
+                                                       vk::AccessFlagBits::eVertexAttributeRead, vk::PipelineStageFlagBits::eVertexInput, buffer, allocation);
+      transferScheduler.wait (upload);
 
-   vk::Semaphore signalSemaphores[] = {renderFinishedSemaphore};
-   submitInfo.signalSemaphoreCount = 1;
-   submitInfo.pSignalSemaphores = signalSemaphores;
+      samples.push_back (elapsedMilliseconds (start));
+
+      device.destroyBuffer (buffer, allocationCallbacks);
+      memoryAllocator.free (allocation);
+   }
+
+   benchmarkReport.add ("staging upload (vertex buffer)", samples);
+   samples.clear ();
+
+   //Rewrites the bound set, which is only legal while no frame uses it
+   static const uint32_t DESCRIPTOR_WRITES_PER_SAMPLE = 1000;
+
+   device.waitIdle ();
 
-   if (graphicsQueue.submit (1, &submitInfo, VK_NULL_HANDLE) != vk::Result::eSuccess)
+   for (uint32_t i = 0; i < options.benchmarkIterations; ++i)
    {
-      throw std::runtime_error ("failed to submit draw command buffer!");
+      auto start = Clock::now ();
+
+      for (uint32_t j = 0; j < DESCRIPTOR_WRITES_PER_SAMPLE; ++j)
+      {
+         writeDescriptorSet (descriptorSet);
+      }
+
+      samples.push_back (elapsedMilliseconds (start) / DESCRIPTOR_WRITES_PER_SAMPLE);
    }
 
-   vk::PresentInfoKHR presentInfo = {};
-   presentInfo.waitSemaphoreCount = 1;
-   presentInfo.pWaitSemaphores = signalSemaphores;
+   benchmarkReport.add ("updateDescriptorSets", samples);
+   samples.clear ();
 
-   vk::SwapchainKHR swapChains[] = {swapChain};
-   presentInfo.swapchainCount = 1;
-   presentInfo.pSwapchains = swapChains;
-   presentInfo.pImageIndices = &imageIndex;
-   presentInfo.pResults = nullptr;
+   benchmarkInstancing ();
+   benchmarkOcclusionCulling ();
+
+   //Model view projection for a scene of many objects, one glm multiply per object against the batched kernel
+   static const size_t TRANSFORM_BENCHMARK_OBJECTS = 10000;
+   static const uint32_t TRANSFORM_PASSES_PER_SAMPLE = 100;
 
+   TransformArray transforms;
+   transforms.resize (TRANSFORM_BENCHMARK_OBJECTS);
 
-   result = presentQueue.presentKHR (&presentInfo);
+   std::vector<glm::mat4> models (TRANSFORM_BENCHMARK_OBJECTS);
 
-   if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR)
+   for (size_t i = 0; i < models.size (); ++i)
    {
-      recreateSwapChain ();
+      models[i] = glm::translate (glm::mat4 (1.0f), glm::vec3 (i % 100, i / 100, 0.0f));
+      models[i] = glm::rotate (models[i], glm::radians (static_cast<float> (i)), glm::vec3 (0.0f, 0.0f, 1.0f));
+      transforms.set (i, models[i]);
    }
-   else if (result != vk::Result::eSuccess)
+
+   glm::mat4 viewProjection = glm::perspective (glm::radians (45.0f), 4.0f / 3.0f, 0.1f, 10.0f) *
+                              glm::lookAt (glm::vec3 (2.0f, 2.0f, 2.0f), glm::vec3 (0.0f, 0.0f, 0.0f), glm::vec3 (0.0f, 0.0f, 1.0f));
+
+   std::vector<glm::mat4> glmResults (TRANSFORM_BENCHMARK_OBJECTS);
+   std::vector<glm::mat4> batchResults (TRANSFORM_BENCHMARK_OBJECTS);
+
+   for (uint32_t i = 0; i < options.benchmarkIterations; ++i)
    {
-      throw std::runtime_error ("failed to present swap chain image!");
+      auto start = Clock::now ();
+
+      for (uint32_t pass = 0; pass < TRANSFORM_PASSES_PER_SAMPLE; ++pass)
+      {
+         for (size_t j = 0; j < models.size (); ++j)
+         {
+            glmResults[j] = viewProjection * models[j];
+         }
+      }
+
+      samples.push_back (elapsedMilliseconds (start) / TRANSFORM_PASSES_PER_SAMPLE);
+   }
+
+   benchmarkReport.add ("model view projection, glm (" + std::to_string (TRANSFORM_BENCHMARK_OBJECTS) + " objects)", samples);
+   samples.clear ();
+
+   for (uint32_t i = 0; i < options.benchmarkIterations; ++i)
+   {
+      auto start = Clock::now ();
+
+      for (uint32_t pass = 0; pass < TRANSFORM_PASSES_PER_SAMPLE; ++pass)
+      {
+         transforms.multiply (viewProjection, &batchResults[0][0][0]);
+      }
+
+      samples.push_back (elapsedMilliseconds (start) / TRANSFORM_PASSES_PER_SAMPLE);
+   }
+
+   benchmarkReport.add ("model view projection, batched (" + std::to_string (TRANSFORM_BENCHMARK_OBJECTS) + " objects)", samples);
+   samples.clear ();
+
+   for (size_t i = 0; i < models.size (); ++i)
+   {
+      for (int column = 0; column < 4; ++column)
+      {
+         if (glm::any (glm::greaterThan (glm::abs (glmResults[i][column] - batchResults[i][column]), glm::vec4 (1e-4f))))
+         {
+            throw std::runtime_error ("batched transforms do not match glm!");
+         }
+      }
+   }
+
+   //The CPU cost of each frame, then the whole run including the GPU draining the last frames
+   auto runStart = Clock::now ();
+
+   for (uint32_t i = 0; i < options.headlessFrames; ++i)
+   {
+      auto start = Clock::now ();
+      drawFrame ();
+      samples.push_back (elapsedMilliseconds (start));
+   }
+
+   device.waitIdle ();
+
+   double runMilliseconds = elapsedMilliseconds (runStart);
+
+   benchmarkReport.add ("drawFrame", samples);
+   benchmarkReport.add ("headless frames (wall time per frame)", std::vector<double> (1, runMilliseconds / std::max (options.headlessFrames, 1u)));
+
+   benchmarkReport.write (std::cout);
+}
+
+void HelloTriangleApplication::benchmarkOcclusionCulling ()
+{
+   if (!gpuCuller.isOcclusionCulling ())
+   {
+      return;
+   }
+
+   PROFILE_ZONE ("benchmarkOcclusionCulling");
+
+   typedef std::chrono::high_resolution_clock Clock;
+
+   auto elapsedMilliseconds = [] (Clock::time_point start) { return std::chrono::duration<double, std::milli> (Clock::now () - start).count (); };
+
+   //The same frames with the occlusion test off, which draws everything in the frustum, and on. The visibility left by
+   //the other setting takes a frame to settle, and the slots still in flight are read back into the next run's numbers.
+   static const uint32_t OCCLUSION_BENCHMARK_FRAMES = 200;
+   uint32_t settleFrames = framesInFlight + 2;
+
+   double fragmentInvocations[2] = {};
+   double occluded[2] = {};
+   double drawn[2] = {};
+
+   for (int occlusionTest = 0; occlusionTest < 2; ++occlusionTest)
+   {
+      gpuCuller.setOcclusionTest (occlusionTest != 0);
+
+      for (uint32_t i = 0; i < settleFrames; ++i)
+      {
+         drawFrame ();
+      }
+
+      gpuCuller.resetStatistics ();
+      gpuProfiler.resetTimings ();
+
+      std::vector<double> samples;
+
+      for (uint32_t i = 0; i < OCCLUSION_BENCHMARK_FRAMES; ++i)
+      {
+         auto start = Clock::now ();
+         drawFrame ();
+         samples.push_back (elapsedMilliseconds (start));
+      }
+
+      device.waitIdle ();
+
+      benchmarkReport.add (occlusionTest ? "drawFrame, occlusion test on" : "drawFrame, occlusion test off", samples);
+
+      const CullingStatistics& culling = gpuCuller.getStatistics ();
+
+      fragmentInvocations[occlusionTest] = gpuProfiler.getTimings ().fragmentShaderInvocations.getMean ();
+      occluded[occlusionTest] = culling.occluded.getMean ();
+      drawn[occlusionTest] = culling.drawnEarly.getMean () + culling.drawnLate.getMean ();
+   }
+
+   std::cout << "occlusion culling: " << drawn[1] << " instances drawn per frame against " << drawn[0] << " without the test, "
+      << occluded[1] << " of " << gpuCuller.getInstanceCount () << " occluded" << std::endl;
+
+   if (gpuProfiler.getTimings ().fragmentShaderInvocations.getCount () > 0)
+   {
+      std::cout << "occlusion culling: " << fragmentInvocations[1] << " fragment invocations per frame against " << fragmentInvocations[0]
+         << " without the test, " << (fragmentInvocations[0] > 0.0 ? 100.0 * (1.0 - fragmentInvocations[1] / fragmentInvocations[0]) : 0.0)
+         << "% fewer" << std::endl;
+   }
+   else
+   {
+      std::cout << "occlusion culling: fragment invocations need pipeline statistics queries, run with --gpu-timing" << std::endl;
    }
+}
+
+void HelloTriangleApplication::benchmarkInstancing ()
+{
+   PROFILE_ZONE ("benchmarkInstancing");
 
-   presentQueue.waitIdle ();
+   typedef std::chrono::high_resolution_clock Clock;
+
+   auto elapsedMilliseconds = [] (Clock::time_point start) { return std::chrono::duration<double, std::milli> (Clock::now () - start).count (); };
+
+   //The same copies of the model either way, one instanced draw against one draw per copy selecting its instance through firstInstance
+   static const uint32_t BENCHMARK_INSTANCES = 1024;
+
+   std::vector<InstanceData> instances = buildInstanceGrid (BENCHMARK_INSTANCES);
+
+   vk::Buffer benchmarkInstanceBuffer;
+   MemoryAllocation benchmarkInstanceBufferAllocation;
+
+   TransferHandle upload = createDeviceLocalBuffer (instances.data (), sizeof (instances[0]) * instances.size (), vk::BufferUsageFlagBits::eVertexBuffer,
+                                                    vk::AccessFlagBits::eVertexAttributeRead, vk::PipelineStageFlagBits::eVertexInput,
+                                                    benchmarkInstanceBuffer, benchmarkInstanceBufferAllocation);
+   transferScheduler.wait (upload);
+
+   device.waitIdle ();
+   updateUniformBuffer (0);
+
+   vk::CommandBufferAllocateInfo allocInfo = {};
+   allocInfo.commandPool = commandPoolGraphics;
+   allocInfo.level = vk::CommandBufferLevel::ePrimary;
+   allocInfo.commandBufferCount = 1;
+
+   vk::CommandBuffer commandBuffer;
+   if (device.allocateCommandBuffers (&allocInfo, &commandBuffer) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to allocate command buffers!");
+   }
+
+   vk::FenceCreateInfo fenceInfo = {};
+   vk::Fence fence;
+
+   if (device.createFence (&fenceInfo, allocationCallbacks, &fence) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create fence!");
+   }
+
+   for (bool instanced : {true, false})
+   {
+      std::vector<double> recordSamples;
+      std::vector<double> frameSamples;
+
+      for (uint32_t i = 0; i < options.benchmarkIterations; ++i)
+      {
+         auto start = Clock::now ();
+
+         vk::CommandBufferBeginInfo beginInfo = {};
+         beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+         commandBuffer.begin (&beginInfo);
+
+         std::array<vk::ClearValue, 2> clearValues = {};
+         clearValues[0].setColor (vk::ClearColorValue (std::array<float, 4> {0.0f, 0.0f, 0.0f, 1.0f}));
+         clearValues[1].depthStencil = {1.0f, 0};
+
+         vk::RenderPassBeginInfo renderPassInfo = {};
+         renderPassInfo.renderPass = renderPass;
+         renderPassInfo.framebuffer = swapChainFramebuffers[0];
+         renderPassInfo.renderArea.offset = {0, 0};
+         renderPassInfo.renderArea.extent = swapChainExtent;
+         renderPassInfo.clearValueCount = static_cast<uint32_t> (clearValues.size ());
+         renderPassInfo.pClearValues = clearValues.data ();
+
+         commandBuffer.beginRenderPass (&renderPassInfo, vk::SubpassContents::eInline);
+         commandBuffer.bindPipeline (vk::PipelineBindPoint::eGraphics, graphicsPipeline);
+         setViewportAndScissor (commandBuffer);
+
+         uint32_t dynamicOffsets[] = {0, 0};
+         commandBuffer.bindDescriptorSets (vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 1, &descriptorSet, 2, dynamicOffsets);
+
+         vk::Buffer vertexBuffers[] = {vertexBuffer, benchmarkInstanceBuffer};
+         vk::DeviceSize offsets[] = {0, 0};
+         commandBuffer.bindVertexBuffers (0, 2, vertexBuffers, offsets);
+         commandBuffer.bindIndexBuffer (indexBuffer, 0, vk::IndexType::eUint32);
+
+         PushConstants pushConstants;
+         pushConstants.model = glm::mat4 (1.0f);
+         pushConstants.drawIndex = 0;
+         commandBuffer.pushConstants (pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof (pushConstants), &pushConstants);
+
+         uint32_t indexCount = static_cast<uint32_t> (indices.size ());
+
+         if (instanced)
+         {
+            commandBuffer.drawIndexed (indexCount, BENCHMARK_INSTANCES, 0, 0, 0);
+         }
+         else
+         {
+            for (uint32_t instance = 0; instance < BENCHMARK_INSTANCES; ++instance)
+            {
+               commandBuffer.drawIndexed (indexCount, 1, 0, 0, instance);
+            }
+         }
+
+         commandBuffer.endRenderPass ();
+         commandBuffer.end ();
+
+         recordSamples.push_back (elapsedMilliseconds (start));
+
+         vk::SubmitInfo submitInfo = {};
+         submitInfo.commandBufferCount = 1;
+         submitInfo.pCommandBuffers = &commandBuffer;
+
+         if (graphicsQueue.submit (1, &submitInfo, fence) != vk::Result::eSuccess)
+         {
+            throw std::runtime_error ("failed to submit draw command buffer!");
+         }
+
+         device.waitForFences (1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max ());
+         device.resetFences (1, &fence);
+
+         frameSamples.push_back (elapsedMilliseconds (start));
+
+         commandBuffer.reset (vk::CommandBufferResetFlags ());
+      }
+
+      std::string name = std::string (instanced ? "one instanced draw" : "separate draws") + " (" + std::to_string (BENCHMARK_INSTANCES) + " copies)";
+
+      benchmarkReport.add (name + ", record", recordSamples);
+      benchmarkReport.add (name + ", record to fence", frameSamples);
+   }
+
+   device.destroyFence (fence, allocationCallbacks);
+   device.freeCommandBuffers (commandPoolGraphics, 1, &commandBuffer);
+
+   device.destroyBuffer (benchmarkInstanceBuffer, allocationCallbacks);
+   memoryAllocator.free (benchmarkInstanceBufferAllocation);
+}
+
+void HelloTriangleApplication::initTimeSource ()
+{
+   if (!options.replayTimePath.empty ())
+   {
+      timeSource.useReplay (options.replayTimePath);
+   }
+   else if (options.timeStep > 0.0)
+   {
+      timeSource.useFixedStep (options.timeStep);
+   }
+   else
+   {
+      //Restarted here so the animation begins with the first frame, not with the launch
+      timeSource.useWallClock ();
+   }
+
+   if (!options.recordTimePath.empty ())
+   {
+      timeSource.startRecording ();
+   }
+}
+
+uint64_t HelloTriangleApplication::checksumImage (vk::Image image)
+{
+   //The image is left in eTransferSrcOptimal by the render pass, so it can be copied out as is
+   vk::DeviceSize size = static_cast<vk::DeviceSize> (swapChainExtent.width) * swapChainExtent.height * 4;
+
+   vk::Buffer readbackBuffer;
+   MemoryAllocation readbackAllocation;
+   createBuffer (size, vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                 readbackBuffer, readbackAllocation);
+
+   vk::CommandBuffer commandBuffer = beginSingleTimeCommands (commandPoolGraphics);
+
+   //The render pass has no outgoing dependency on transfers, so its color writes are made visible to the copy here
+   vk::ImageMemoryBarrier renderBarrier = {};
+   renderBarrier.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
+   renderBarrier.newLayout = vk::ImageLayout::eTransferSrcOptimal;
+   renderBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+   renderBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+   renderBarrier.image = image;
+   renderBarrier.subresourceRange = {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+   renderBarrier.srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+   renderBarrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
+
+   commandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags (), 0, nullptr, 0, nullptr, 1, &renderBarrier);
+
+   vk::BufferImageCopy region = {};
+   region.imageSubresource = {vk::ImageAspectFlagBits::eColor, 0, 0, 1};
+   region.imageExtent = vk::Extent3D (swapChainExtent.width, swapChainExtent.height, 1);
+
+   commandBuffer.copyImageToBuffer (image, vk::ImageLayout::eTransferSrcOptimal, readbackBuffer, 1, &region);
+
+   vk::BufferMemoryBarrier barrier = {};
+   barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+   barrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+   barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+   barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+   barrier.buffer = readbackBuffer;
+   barrier.size = VK_WHOLE_SIZE;
+
+   commandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags (), 0, nullptr, 1, &barrier, 0, nullptr);
+
+   transferScheduler.wait (endSingleTimeCommands (commandBuffer, commandPoolGraphics, graphicsQueue));
+
+   //FNV-1a over the raw pixels
+   const unsigned char* pixels = static_cast<const unsigned char*> (readbackAllocation.mappedData);
+   uint64_t hash = 14695981039346656037ull;
+
+   for (vk::DeviceSize i = 0; i < size; ++i)
+   {
+      hash = (hash ^ pixels[i]) * 1099511628211ull;
+   }
+
+   device.destroyBuffer (readbackBuffer, allocationCallbacks);
+   memoryAllocator.free (readbackAllocation);
+
+   return hash;
+}
+
+void HelloTriangleApplication::printFrameStatistics ()
+{
+   FramePacingStatistics pacing = framePacer.getStatistics ();
+
+   std::cout << "frame pacing: " << pacing.meanFrameMilliseconds << " ms per frame, " << pacing.jitterMilliseconds << " ms jitter, "
+      << pacing.worstFrameMilliseconds << " ms worst, " << pacing.meanLatencyMilliseconds << " ms mean latency, "
+      << pacing.p99LatencyMilliseconds << " ms 99th percentile latency" << std::endl;
+
+   if (gpuProfiler.isEnabled ())
+   {
+      const GpuTimings& timings = gpuProfiler.getTimings ();
+
+      std::cout << "gpu frame: " << timings.frameMilliseconds.getMean () << " ms mean, " << timings.frameMilliseconds.getPercentile (50.0)
+         << " ms median, " << timings.frameMilliseconds.getPercentile (99.0) << " ms 99th percentile, draws: "
+         << timings.meanDrawMilliseconds.getMean () << " ms mean, " << timings.slowestDrawMilliseconds.getPercentile (99.0) << " ms slowest (99th percentile)" << std::endl;
+
+      std::cout << "gpu pipeline statistics per frame: " << timings.vertexShaderInvocations.getMean () << " vertex invocations, "
+         << timings.fragmentShaderInvocations.getMean () << " fragment invocations, " << timings.clippingInvocations.getMean ()
+         << " clipping invocations, " << timings.clippingPrimitives.getMean () << " clipping primitives" << std::endl;
+   }
+
+   if (gpuCuller.isEnabled ())
+   {
+      const CullingStatistics& culling = gpuCuller.getStatistics ();
+      double instanceCount = gpuCuller.getInstanceCount ();
+      double visible = culling.drawnEarly.getMean () + culling.drawnLate.getMean ();
+
+      std::cout << "gpu culling: " << visible << " of " << instanceCount << " instances visible on average, "
+         << 100.0 * (1.0 - visible / instanceCount) << "% culled, " << culling.frustumCulled.getMean () << " outside the frustum";
+
+      if (gpuCuller.isOcclusionCulling ())
+      {
+         std::cout << ", " << culling.occluded.getMean () << " occluded, " << culling.drawnEarly.getMean () << " drawn early, "
+            << culling.drawnLate.getMean () << " drawn late";
+      }
+
+      std::cout << std::endl;
+   }
+
+   DrawListCacheStatistics cacheStatistics = drawListCache.getStatistics ();
+   size_t frameChunks = cacheStatistics.frameHits + cacheStatistics.frameMisses;
+   uint64_t totalChunks = cacheStatistics.totalHits + cacheStatistics.totalMisses;
+
+   std::cout << "draw command cache: " << cacheStatistics.frameHits << " / " << frameChunks << " chunks replayed last frame, "
+      << (totalChunks ? 100.0 * cacheStatistics.totalHits / totalChunks : 0.0) << "% hit rate overall" << std::endl;
+}
+
+void HelloTriangleApplication::updateUniformBuffer (uint32_t frameIndex)
+{
+   PROFILE_ZONE ("updateUniformBuffer");
+
+   float time = static_cast<float> (timeSource.getTime ());
+
+   //The spin is applied to the camera, so the draw transforms and the command buffers they are recorded into stay valid
+   UniformBufferObject ubo = {};
+   ubo.view = glm::lookAt (glm::vec3 (2.0f, 2.0f, 2.0f), glm::vec3 (0.0f, 0.0f, 0.0f), glm::vec3 (0.0f, 0.0f, 1.0f));
+   ubo.view = glm::rotate (ubo.view, time * glm::radians (90.0f), glm::vec3 (0.0f, 0.0f, 1.0f));
+
+   ubo.proj = glm::perspective (glm::radians (45.0f), swapChainExtent.width / (float) swapChainExtent.height, 0.1f, 10.0f);
+   ubo.proj[1][1] *= -1; //glm is orignally designed for OpenGL which inverts its y-coordinate so we need to flip it
+
+   memcpy (static_cast<char*> (uniformBufferAllocation.mappedData) + frameIndex * uniformBufferStride, &ubo, sizeof (ubo));
+
+   //Each animated draw invalidates only its own chunk, so the cache still replays the others
+   size_t animatedDraws = std::min<size_t> (options.animatedDraws, drawList.size ());
+
+   for (size_t i = 0; i < animatedDraws; ++i)
+   {
+      float offset = 0.05f * std::sin (time * 4.0f + static_cast<float> (i));
+      setDrawTransform (i, glm::translate (glm::mat4 (1.0f), glm::vec3 (0.0f, 0.0f, offset)));
+   }
+
+   //The culler applies the draw transforms set above to the bounds itself
+   cullingView = ubo.view;
+   cullingProjection = ubo.proj;
+
+   if (options.precomputeTransforms)
+   {
+      PROFILE_ZONE ("multiplyTransforms");
+
+      char* transforms = static_cast<char*> (transformBufferAllocation.mappedData) + frameIndex * transformBufferStride;
+      drawTransforms.multiply (ubo.proj * ubo.view, reinterpret_cast<float*> (transforms));
+   }
+}
+
+void HelloTriangleApplication::drawFrame ()
+{
+   PROFILE_ZONE ("drawFrame");
+
+   {
+      PROFILE_ZONE ("retire deferred work");
+      processDeferredDestructions ();
+      transferScheduler.retireCompleted ();
+   }
+
+   if (resizePending && std::chrono::high_resolution_clock::now () - lastResizeEvent >= RESIZE_DEBOUNCE)
+   {
+      recreateSwapChain ();
+   }
+
+   auto waitStart = std::chrono::high_resolution_clock::now ();
+
+   //Everything recorded into this frame slot, including its uniform buffer region, is free again after this
+   {
+      PROFILE_ZONE ("wait for frame fence");
+      device.waitForFences (1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max ());
+   }
+
+   //The slot's queries and culling results are complete now, so reading them back does not wait
+   gpuProfiler.collect (currentFrame);
+   gpuCuller.collect (currentFrame);
+
+   uint32_t imageIndex;
+   vk::Result result = vk::Result::eSuccess;
+
+   if (options.headless)
+   {
+      imageIndex = nextOffscreenImage;
+      nextOffscreenImage = (nextOffscreenImage + 1) % static_cast<uint32_t> (swapChainImages.size ());
+   }
+   else
+   {
+      PROFILE_ZONE ("acquireNextImageKHR");
+      result = device.acquireNextImageKHR (swapChain, std::numeric_limits<uint64_t>::max (), imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+   }
+
+   if (result == vk::Result::eErrorOutOfDateKHR)
+   {
+      swapChainOutOfDate ();
+      return;
+   }
+   else if (result != vk::Result::eSuccess && result != vk::Result::eSuboptimalKHR)
+   {
+      throw std::runtime_error ("failed to acquire swap chain image!");
+   }
+
+   //Only counted once the frame is sure to be submitted, deferred destruction relies on every counted frame moving
+   //on to the next slot
+   ++frameNumber;
+
+   //The image can come back before the frame that last rendered to it has finished when there are more frames in flight than images
+   if (imagesInFlight[imageIndex])
+   {
+      PROFILE_ZONE ("wait for image fence");
+      device.waitForFences (1, &imagesInFlight[imageIndex], VK_TRUE, std::numeric_limits<uint64_t>::max ());
+   }
+
+   imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+
+   frameWaitTime += std::chrono::high_resolution_clock::now () - waitStart;
+
+   //Sampled only once the frame is sure to be rendered, so a replay lines up frame for frame
+   timeSource.beginFrame ();
+   updateUniformBuffer (currentFrame);
+
+   frameCommandPools.beginFrame (currentFrame);
+
+   vk::CommandBuffer commandBuffer = frameCommandPools.allocate ();
+   recordCommandBuffer (commandBuffer, imageIndex);
+
+   vk::SubmitInfo submitInfo = {};
+
+   vk::Semaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
+   vk::PipelineStageFlags waitStages[] = {vk::PipelineStageFlagBits::eColorAttachmentOutput};
+
+   //Offscreen frames are neither acquired nor presented, so there is nothing to wait on or signal
+   submitInfo.waitSemaphoreCount = options.headless ? 0 : 1;
+   submitInfo.pWaitSemaphores = waitSemaphores;
+   submitInfo.pWaitDstStageMask = waitStages;
+
+   submitInfo.commandBufferCount = 1;
+   submitInfo.pCommandBuffers = &commandBuffer;
+
+   vk::Semaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
+   submitInfo.signalSemaphoreCount = options.headless ? 0 : 1;
+   submitInfo.pSignalSemaphores = signalSemaphores;
+
+   device.resetFences (1, &inFlightFences[currentFrame]);
+
+   {
+      PROFILE_ZONE ("vkQueueSubmit");
+
+      if (graphicsQueue.submit (1, &submitInfo, inFlightFences[currentFrame]) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to submit draw command buffer!");
+      }
+   }
+
+   if (options.headless)
+   {
+      currentFrame = (currentFrame + 1) % framesInFlight;
+      return;
+   }
+
+   vk::PresentInfoKHR presentInfo = {};
+   presentInfo.waitSemaphoreCount = 1;
+   presentInfo.pWaitSemaphores = signalSemaphores;
+
+   vk::SwapchainKHR swapChains[] = {swapChain};
+   presentInfo.swapchainCount = 1;
+   presentInfo.pSwapchains = swapChains;
+   presentInfo.pImageIndices = &imageIndex;
+   presentInfo.pResults = nullptr;
+
+
+   {
+      PROFILE_ZONE ("vkQueuePresentKHR");
+      result = presentQueue.presentKHR (&presentInfo);
+   }
+
+   currentFrame = (currentFrame + 1) % framesInFlight;
+
+   if (result == vk::Result::eErrorOutOfDateKHR)
+   {
+      swapChainOutOfDate ();
+   }
+   else if (result == vk::Result::eSuboptimalKHR)
+   {
+      //Still presentable, so it can wait for the resize to settle like any other
+      if (!resizePending)
+      {
+         resizePending = true;
+         lastResizeEvent = std::chrono::high_resolution_clock::now ();
+      }
+   }
+   else if (result != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to present swap chain image!");
+   }
+}
+
+void HelloTriangleApplication::swapChainOutOfDate ()
+{
+   //Most drivers report every step of a window drag as out of date, so while a resize is settling the frame is just
+   //dropped and drawFrame recreates the swap chain once the debounce has passed
+   if (resizePending && std::chrono::high_resolution_clock::now () - lastResizeEvent < RESIZE_DEBOUNCE)
+   {
+      return;
+   }
+
+   uint32_t recreations = swapChainRecreations;
+   recreateSwapChain ();
+   outOfDateRecreations += swapChainRecreations - recreations;
+}
+
+void HelloTriangleApplication::recreateSwapChain ()
+{
+   PROFILE_ZONE ("recreateSwapChain");
+
+   int width = 0;
+   int height = 0;
+   glfwGetFramebufferSize (window, &width, &height);
+
+   //Minimized, the old swap chain is kept until there is something to present to again
+   if (width == 0 || height == 0)
+   {
+      resizePending = true;
+      lastResizeEvent = std::chrono::high_resolution_clock::now ();
+      return;
+   }
+
+   auto recreateStart = std::chrono::high_resolution_clock::now ();
+
+   resizePending = false;
+
+   vk::Format oldImageFormat = swapChainImageFormat;
+
+   std::function<void ()> retired = retireSwapChain ();
+
+   if (blockingSwapChainRecreation)
+   {
+      device.waitIdle ();
+      retired ();
+      swapChain = vk::SwapchainKHR ();
+   }
+   else
+   {
+      //The frames in flight still render to and present the old images, they go once those frames have finished
+      deferDestruction (retired);
+   }
+
+   createSwapChain ();
+   createImageViews ();
+
+   //The render pass only depends on the attachment formats and the viewport and scissor are dynamic, so the pipeline
+   //only has to be rebuilt when the surface format changed
+   if (swapChainImageFormat != oldImageFormat)
+   {
+      vk::Pipeline oldPipeline = graphicsPipeline;
+      vk::PipelineLayout oldPipelineLayout = pipelineLayout;
+      vk::RenderPass oldRenderPass = renderPass;
+      vk::RenderPass oldLateRenderPass = lateRenderPass;
+
+      deferDestruction ([this, oldPipeline, oldPipelineLayout, oldRenderPass, oldLateRenderPass] ()
+      {
+         device.destroyPipeline (oldPipeline, allocationCallbacks);
+         device.destroyPipelineLayout (oldPipelineLayout, allocationCallbacks);
+         device.destroyRenderPass (oldRenderPass, allocationCallbacks);
+         device.destroyRenderPass (oldLateRenderPass, allocationCallbacks);
+      });
+
+      createRenderPass ();
+      createGraphicsPipeline ();
+   }
+
+   createDepthResources ();
+   createFramebuffers ();
+
+   if (gpuCuller.isOcclusionCulling ())
+   {
+      gpuCuller.createDepthPyramid (swapChainExtent, depthImageView);
+   }
+
+   //The cached draw commands set the old viewport and scissor, and may reference the old render pass and pipeline
+   drawListCache.invalidateAll ();
+   lateDrawListCache.invalidateAll ();
+
+   imagesInFlight.assign (swapChainImages.size (), vk::Fence ());
+
+   auto recreateTime = std::chrono::high_resolution_clock::now () - recreateStart;
+   swapChainRecreateTime += recreateTime;
+   slowestSwapChainRecreate = std::max (slowestSwapChainRecreate, recreateTime);
+   ++swapChainRecreations;
+}
+
+std::function<void ()> HelloTriangleApplication::retireSwapChain ()
+{
+   //Everything that follows the window size, detached so the replacements can be created before these are destroyed.
+   //swapChain itself stays set until createSwapChain has passed it on as the old swap chain.
+   std::function<void ()> retiredDepthPyramid = gpuCuller.retireDepthPyramid ();
+   vk::SwapchainKHR oldSwapChain = swapChain;
+   std::vector<vk::ImageView> oldImageViews = swapChainImageViews;
+   std::vector<vk::Framebuffer> oldFramebuffers = swapChainFramebuffers;
+   vk::Image oldDepthImage = depthImage;
+   vk::ImageView oldDepthImageView = depthImageView;
+   vk::DeviceMemory oldTransientMemory = transientAttachmentMemory;
+   MemoryAllocation oldDepthAllocation = depthImageAllocation;
+
+   return [this, retiredDepthPyramid, oldSwapChain, oldImageViews, oldFramebuffers, oldDepthImage, oldDepthImageView,
+           oldTransientMemory, oldDepthAllocation] () mutable
+   {
+      retiredDepthPyramid ();
+
+      device.destroyImageView (oldDepthImageView, allocationCallbacks);
+      device.destroyImage (oldDepthImage, allocationCallbacks);
+
+      if (options.occlusionCulling)
+      {
+         memoryAllocator.free (oldDepthAllocation);
+      }
+      else
+      {
+         device.freeMemory (oldTransientMemory, allocationCallbacks);
+      }
+
+      for (auto framebuffer : oldFramebuffers)
+      {
+         device.destroyFramebuffer (framebuffer, allocationCallbacks);
+      }
+
+      for (auto imageView : oldImageViews)
+      {
+         device.destroyImageView (imageView, allocationCallbacks);
+      }
+
+      device.destroySwapchainKHR (oldSwapChain, allocationCallbacks);
+   };
+}
+
+void HelloTriangleApplication::cleanupSwapChain ()
+{
+   gpuCuller.destroyDepthPyramid ();
+
+   device.destroyImageView (depthImageView, allocationCallbacks);
+   device.destroyImage (depthImage, allocationCallbacks);
+
+   if (options.occlusionCulling)
+   {
+      memoryAllocator.free (depthImageAllocation);
+   }
+   else
+   {
+      device.freeMemory (transientAttachmentMemory, allocationCallbacks);
+   }
+
+   for (auto swapChainFramebuffer : swapChainFramebuffers)
+   {
+      device.destroyFramebuffer (swapChainFramebuffer, allocationCallbacks);
+   }
+
+   for (auto swapChainImageView : swapChainImageViews)
+   {
+      device.destroyImageView (swapChainImageView, allocationCallbacks);
+   }
+
+   if (options.headless)
+   {
+      for (size_t i = 0; i < swapChainImages.size (); ++i)
+      {
+         device.destroyImage (swapChainImages[i], allocationCallbacks);
+         memoryAllocator.free (offscreenImageAllocations[i]);
+      }
+
+      swapChainImages.clear ();
+      offscreenImageAllocations.clear ();
+   }
+   else
+   {
+      //Headless never enables the swap chain extension, so its commands must not be called at all
+      device.destroySwapchainKHR (swapChain, allocationCallbacks);
+   }
+}
+
+void HelloTriangleApplication::createVertexBuffer ()
+{
+   PROFILE_ZONE ("createVertexBuffer");
+
+   vk::DeviceSize bufferSize = sizeof (vertices[0]) * vertices.size ();
+
+   createDeviceLocalBuffer (vertices.data (), bufferSize, vk::BufferUsageFlagBits::eVertexBuffer,
+                            vk::AccessFlagBits::eVertexAttributeRead, vk::PipelineStageFlagBits::eVertexInput,
+                            vertexBuffer, vertexBufferAllocation);
+}
+
+void HelloTriangleApplication::createInstanceBuffer ()
+{
+   PROFILE_ZONE ("createInstanceBuffer");
+
+   std::vector<InstanceData> instances = buildInstanceGrid (std::max (options.instanceCount, 1u));
+
+   //Also read by the culling pass, as a storage buffer
+   createDeviceLocalBuffer (instances.data (), sizeof (instances[0]) * instances.size (), vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer,
+                            vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eShaderRead, vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eComputeShader,
+                            instanceBuffer, instanceBufferAllocation);
+}
+
+void HelloTriangleApplication::createGpuCuller ()
+{
+   if (!options.gpuCulling && !options.occlusionCulling)
+   {
+      return;
+   }
+
+   PROFILE_ZONE ("createGpuCuller");
+
+   //The culling pass is recorded into the same command buffer as the draws
+   QueueFamilyIndices queueFamilyIndices = findQueueFamilies (physicalDevice);
+
+   if (!(physicalDevice.getQueueFamilyProperties ()[queueFamilyIndices.graphicsFamily].queueFlags & vk::QueueFlagBits::eCompute))
+   {
+      throw std::runtime_error ("graphics queue does not support compute, needed for gpu culling!");
+   }
+
+   std::vector<vk::DrawIndexedIndirectCommand> drawCommands (drawList.size ());
+
+   for (size_t i = 0; i < drawList.size (); ++i)
+   {
+      drawCommands[i].indexCount = drawList[i].indexCount;
+      drawCommands[i].instanceCount = 0; //Filled in by the culling pass
+      drawCommands[i].firstIndex = drawList[i].firstIndex;
+      drawCommands[i].vertexOffset = 0;
+      drawCommands[i].firstInstance = 0;
+   }
+
+   std::vector<char> cullShaderCode = readFile (options.occlusionCulling ? "shaders/cull_occlusion.spv" : "shaders/cull.spv");
+   std::vector<char> reduceShaderCode;
+
+   if (options.occlusionCulling)
+   {
+      reduceShaderCode = readFile ("shaders/depth_reduce.spv");
+   }
+
+   gpuCuller.init (device, allocationCallbacks, memoryAllocator, physicalDevice.getProperties ().limits, cullShaderCode, reduceShaderCode,
+                   MAX_FRAMES_IN_FLIGHT, instanceBuffer, std::max (options.instanceCount, 1u), sizeof (InstanceData), drawCommands);
+
+   if (options.occlusionCulling)
+   {
+      gpuCuller.createDepthPyramid (swapChainExtent, depthImageView);
+   }
+}
+
+void HelloTriangleApplication::createIndexBuffer ()
+{
+   PROFILE_ZONE ("createIndexBuffer");
+
+   vk::DeviceSize bufferSize = sizeof (indices[0]) * indices.size ();
+
+   createDeviceLocalBuffer (indices.data (), bufferSize, vk::BufferUsageFlagBits::eIndexBuffer,
+                            vk::AccessFlagBits::eIndexRead, vk::PipelineStageFlagBits::eVertexInput,
+                            indexBuffer, indexBufferAllocation);
+}
+
+void HelloTriangleApplication::createUniformBuffer ()
+{
+   PROFILE_ZONE ("createUniformBuffer");
+
+   vk::DeviceSize alignment = physicalDevice.getProperties ().limits.minUniformBufferOffsetAlignment;
+   uniformBufferStride = (sizeof (UniformBufferObject) + alignment - 1) / alignment * alignment;
+
+   vk::DeviceSize  bufferSize = uniformBufferStride * MAX_FRAMES_IN_FLIGHT;
+   createBuffer (bufferSize, vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, uniformBuffer, uniformBufferAllocation);
+}
+
+void HelloTriangleApplication::createTransformBuffer ()
+{
+   PROFILE_ZONE ("createTransformBuffer");
+
+   vk::DeviceSize alignment = physicalDevice.getProperties ().limits.minStorageBufferOffsetAlignment;
+   transformBufferStride = (sizeof (glm::mat4) * drawList.size () + alignment - 1) / alignment * alignment;
+
+   vk::DeviceSize bufferSize = transformBufferStride * MAX_FRAMES_IN_FLIGHT;
+   createBuffer (bufferSize, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, transformBuffer, transformBufferAllocation);
+}
+
+void HelloTriangleApplication::createDescriptorPool ()
+{
+   PROFILE_ZONE ("createDescriptorPool");
+
+   //Room for a second set, memory compaction writes a fresh one while the old one may still be in use
+   std::array<vk::DescriptorPoolSize, 3> poolSize = {};
+   poolSize[0].type = vk::DescriptorType::eUniformBufferDynamic;
+   poolSize[0].descriptorCount = 2;
+   poolSize[1].type = vk::DescriptorType::eCombinedImageSampler;
+   poolSize[1].descriptorCount = 2;
+   poolSize[2].type = vk::DescriptorType::eStorageBufferDynamic;
+   poolSize[2].descriptorCount = 2;
+
+   vk::DescriptorPoolCreateInfo poolInfo = {};
+   poolInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+   poolInfo.poolSizeCount = poolSize.size ();
+   poolInfo.pPoolSizes = poolSize.data ();
+   poolInfo.maxSets = 2;
+
+   if (device.createDescriptorPool (&poolInfo, allocationCallbacks, &descriptorPool) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create descriptor pool!");
+   }
+}
+
+void HelloTriangleApplication::createDescriptorSet ()
+{
+   PROFILE_ZONE ("createDescriptorSet");
+
+   vk::DescriptorSetLayout layouts[] = {descriptorSetLayout};
+   vk::DescriptorSetAllocateInfo allocInfo = {};
+   allocInfo.descriptorPool = descriptorPool;
+   allocInfo.descriptorSetCount = 1;
+   allocInfo.pSetLayouts = layouts;
+
+   if (device.allocateDescriptorSets (&allocInfo, &descriptorSet) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to allocate descriptor set!");
+   }
+
+   writeDescriptorSet (descriptorSet);
+}
+
+void HelloTriangleApplication::writeDescriptorSet (vk::DescriptorSet set)
+{
+   vk::DescriptorBufferInfo bufferInfo = {};
+   bufferInfo.buffer = uniformBuffer;
+   bufferInfo.offset = 0;
+   bufferInfo.range = sizeof (UniformBufferObject);
+
+   vk::DescriptorImageInfo imageInfo = {};
+   imageInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+   imageInfo.imageView = textureImageView;
+   imageInfo.sampler = textureSampler;
+
+   vk::DescriptorBufferInfo transformInfo = {};
+   transformInfo.buffer = transformBuffer;
+   transformInfo.offset = 0;
+   transformInfo.range = sizeof (glm::mat4) * drawList.size ();
+
+   std::array<vk::WriteDescriptorSet, 3> descriptorWrite = {};
+   descriptorWrite[0].dstSet = set;
+   descriptorWrite[0].dstBinding = 0;
+   descriptorWrite[0].dstArrayElement = 0;
+   descriptorWrite[0].descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+   descriptorWrite[0].descriptorCount = 1;
+   descriptorWrite[0].pBufferInfo = &bufferInfo;
+
+   descriptorWrite[1].dstSet = set;
+   descriptorWrite[1].dstBinding = 1;
+   descriptorWrite[1].dstArrayElement = 0;
+   descriptorWrite[1].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+   descriptorWrite[1].descriptorCount = 1;
+   descriptorWrite[1].pImageInfo = &imageInfo;
+
+   descriptorWrite[2].dstSet = set;
+   descriptorWrite[2].dstBinding = 2;
+   descriptorWrite[2].dstArrayElement = 0;
+   descriptorWrite[2].descriptorType = vk::DescriptorType::eStorageBufferDynamic;
+   descriptorWrite[2].descriptorCount = 1;
+   descriptorWrite[2].pBufferInfo = &transformInfo;
+
+   device.updateDescriptorSets (static_cast<uint32_t>(descriptorWrite.size ()), descriptorWrite.data (), 0, nullptr);
+}
+
+
+void HelloTriangleApplication::createBuffer (vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Buffer& buffer, MemoryAllocation& bufferAllocation, vk::SharingMode sharingMode)
+{
+   vk::BufferCreateInfo bufferInfo = {};
+
+   bufferInfo.size = size;
+   bufferInfo.usage = usage;
+
+   QueueFamilyIndices indices = findQueueFamilies (physicalDevice);
+   uint32_t queueFamilies[] = {static_cast<uint32_t> (indices.graphicsFamily), static_cast<uint32_t> (indices.transferFamily)};
+
+   //Concurrent sharing can disable compression on some drivers, so it is only used when explicitly asked for
+   if (sharingMode == vk::SharingMode::eConcurrent && indices.graphicsFamily != indices.transferFamily)
+   {
+      bufferInfo.sharingMode = vk::SharingMode::eConcurrent;
+      bufferInfo.queueFamilyIndexCount = 2;
+      bufferInfo.pQueueFamilyIndices = queueFamilies;
+   }
+   else
+   {
+      bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+      bufferInfo.queueFamilyIndexCount = 0;
+      bufferInfo.pQueueFamilyIndices = nullptr;
+   }
+
+
+   if (device.createBuffer (&bufferInfo, allocationCallbacks, &buffer) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create buffer!");
+   }
+
+   bufferAllocation = memoryAllocator.allocateForBuffer (buffer, properties);
+
+   device.bindBufferMemory (buffer, bufferAllocation.memory, bufferAllocation.offset);
+}
+
+TransferHandle HelloTriangleApplication::createDeviceLocalBuffer (const void* srcData, vk::DeviceSize size, vk::BufferUsageFlags usage, vk::AccessFlags dstAccessMask, vk::PipelineStageFlags dstStageMask, vk::Buffer& buffer, MemoryAllocation& bufferAllocation, vk::SharingMode sharingMode)
+{
+   vk::Buffer stagingBuffer;
+   MemoryAllocation stagingBufferAllocation;
+
+   //The staging buffer is only ever touched by the transfer queue so it never needs to be shared
+   createBuffer (size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, stagingBuffer, stagingBufferAllocation);
+
+   memcpy (stagingBufferAllocation.mappedData, srcData, (size_t) size);
+
+   //Also a transfer source so memory compaction can move it later
+   createBuffer (size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc | usage, vk::MemoryPropertyFlagBits::eDeviceLocal, buffer, bufferAllocation, sharingMode);
+   TransferHandle upload = copyBuffer (stagingBuffer, buffer, size, sharingMode, dstAccessMask, dstStageMask);
+
+   releaseStagingBuffer (stagingBuffer, stagingBufferAllocation, upload);
+
+   return upload;
+}
+
+TransferHandle HelloTriangleApplication::copyBuffer (vk::Buffer srcBuffer, vk::Buffer dstBuffer, vk::DeviceSize size, vk::SharingMode dstSharingMode, vk::AccessFlags dstAccessMask, vk::PipelineStageFlags dstStageMask)
+{
+   QueueFamilyIndices indices = findQueueFamilies (physicalDevice);
+
+   //An exclusive buffer written on the transfer queue has to be released to and acquired by the graphics queue.
+   //An upload batch records on the graphics queue, so the buffer is already owned by the queue that reads it.
+   bool transferOwnership = !uploadBatch.commandBuffer && dstSharingMode == vk::SharingMode::eExclusive && indices.graphicsFamily != indices.transferFamily;
+
+   vk::CommandBuffer commandBuffer = beginUploadCommands (commandPoolTransfer);
+
+   vk::BufferCopy copyRegion = {};
+   copyRegion.size = size;
+
+   commandBuffer.copyBuffer (srcBuffer, dstBuffer, 1, &copyRegion);
+
+   vk::BufferMemoryBarrier barrier = {};
+   barrier.buffer = dstBuffer;
+   barrier.offset = 0;
+   barrier.size = VK_WHOLE_SIZE;
+
+   if (transferOwnership)
+   {
+      barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+      barrier.srcQueueFamilyIndex = indices.transferFamily;
+      barrier.dstQueueFamilyIndex = indices.graphicsFamily;
+
+      commandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags (), 0, nullptr, 1, &barrier, 0, nullptr);
+   }
+   else if (uploadBatch.commandBuffer)
+   {
+      barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+      barrier.dstAccessMask = dstAccessMask;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+      commandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eTransfer, dstStageMask, vk::DependencyFlags (), 0, nullptr, 1, &barrier, 0, nullptr);
+   }
+
+   TransferHandle release = endUploadCommands (commandBuffer, commandPoolTransfer, transferQueue);
+
+   if (!transferOwnership)
+   {
+      return release;
+   }
+
+   commandBuffer = beginSingleTimeCommands (commandPoolGraphics);
+
+   barrier.srcAccessMask = vk::AccessFlags ();
+   barrier.dstAccessMask = dstAccessMask;
+
+   commandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eTopOfPipe, dstStageMask, vk::DependencyFlags (), 0, nullptr, 1, &barrier, 0, nullptr);
+
+   return endSingleTimeCommands (commandBuffer, commandPoolGraphics, graphicsQueue, {release});
+}
+
+void HelloTriangleApplication::createDescriptorSetLayout ()
+{
+   PROFILE_ZONE ("createDescriptorSetLayout");
+
+   vk::DescriptorSetLayoutBinding uboLayoutBinding = {};
+   uboLayoutBinding.binding = 0;
+   uboLayoutBinding.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+   uboLayoutBinding.descriptorCount = 1;
+
+   uboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex;
+   uboLayoutBinding.pImmutableSamplers = nullptr;
+
+   vk::DescriptorSetLayoutBinding samplerLayoutBinding = {};
+   samplerLayoutBinding.binding = 1;
+   samplerLayoutBinding.descriptorCount = 1;
+   samplerLayoutBinding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+   samplerLayoutBinding.pImmutableSamplers = nullptr;
+   samplerLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eFragment;
+
+   vk::DescriptorSetLayoutBinding transformLayoutBinding = {};
+   transformLayoutBinding.binding = 2;
+   transformLayoutBinding.descriptorCount = 1;
+   transformLayoutBinding.descriptorType = vk::DescriptorType::eStorageBufferDynamic;
+   transformLayoutBinding.pImmutableSamplers = nullptr;
+   transformLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex;
+
+   std::array<vk::DescriptorSetLayoutBinding, 3> bindings = {uboLayoutBinding, samplerLayoutBinding, transformLayoutBinding};
+
+   vk::DescriptorSetLayoutCreateInfo layoutInfo = {};
+   layoutInfo.bindingCount = bindings.size ();
+   layoutInfo.pBindings = bindings.data ();
+
+   if (device.createDescriptorSetLayout (&layoutInfo, allocationCallbacks, &descriptorSetLayout) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create descriptor set layout!");
+   }
+}
+
+void HelloTriangleApplication::createTextureImage ()
+{
+   DecodedImage decoded = textureDecode.valid () ? textureDecode.get () : decodeImage (texturePath ());
+
+   int texWidth = decoded.width;
+   int texHeight = decoded.height;
+   stbi_uc* pixels = decoded.pixels.get ();
+   vk::DeviceSize imageSize = texWidth * texHeight * 4; //4 bytes per pixel
+
+   vk::Buffer stagingBuffer;
+   MemoryAllocation stagingBufferAllocation;
+
+   createBuffer (imageSize, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, stagingBuffer, stagingBufferAllocation);
+
+   memcpy (stagingBufferAllocation.mappedData, pixels, static_cast<size_t>(imageSize));
+
+   decoded.pixels.reset ();
+
+   textureExtent = vk::Extent2D (static_cast<uint32_t> (texWidth), static_cast<uint32_t> (texHeight));
+
+   createImage (texWidth, texHeight, vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal, textureImage, textureImageAllocation);
+
+   //The upload happens entirely on the transfer queue, the final layout transition doubles as the ownership transfer
+   transitionImageLayout (textureImage, vk::Format::eR8G8B8A8Unorm, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, commandPoolTransfer, transferQueue);
+   TransferHandle copy = copyBufferToImage (stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+   transferImageOwnership (textureImage, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, vk::AccessFlagBits::eShaderRead, vk::PipelineStageFlagBits::eFragmentShader);
+
+   releaseStagingBuffer (stagingBuffer, stagingBufferAllocation, copy);
+}
+
+void HelloTriangleApplication::createImage (uint32_t width, uint32_t height, vk::Format format, vk::ImageTiling tiling, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Image & image, MemoryAllocation& imageAllocation)
+{
+   vk::ImageCreateInfo imageInfo = {};
+   imageInfo.imageType = vk::ImageType::e2D;
+   imageInfo.extent.width = static_cast<uint32_t> (width);
+   imageInfo.extent.height = static_cast<uint32_t> (height);
+   imageInfo.extent.depth = 1;
+   imageInfo.mipLevels = 1;
+   imageInfo.arrayLayers = 1;
+
+   imageInfo.format = format;
+
+   imageInfo.tiling = tiling;
+   imageInfo.initialLayout = vk::ImageLayout::eUndefined;;
+
+   imageInfo.usage = usage;
+   imageInfo.samples = vk::SampleCountFlagBits::e1;
+   imageInfo.sharingMode = vk::SharingMode::eExclusive;
+
+
+   if (device.createImage (&imageInfo, allocationCallbacks, &image) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create image!");
+   }
+
+   imageAllocation = memoryAllocator.allocateForImage (image, properties);
+
+   device.bindImageMemory (image, imageAllocation.memory, imageAllocation.offset);
+}
+
+TransferHandle HelloTriangleApplication::transitionImageLayout (vk::Image image, vk::Format format, vk::ImageLayout oldLayout, vk::ImageLayout newLayout, vk::CommandPool commandPool, vk::Queue queue)
+{
+   vk::CommandBuffer commandBuffer = beginUploadCommands (commandPool);
+
+   vk::ImageMemoryBarrier barrier = {};
+   barrier.oldLayout = oldLayout;
+   barrier.newLayout = newLayout;
+
+   barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+   barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+   barrier.image = image;
+
+   if (newLayout == vk::ImageLayout::eDepthStencilAttachmentOptimal)
+   {
+      barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eDepth;
+
+      if (hasStencilComponent (format))
+      {
+         barrier.subresourceRange.aspectMask |= vk::ImageAspectFlagBits::eStencil;
+      }
+   }
+   else
+   {
+      barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+   }
+
+   barrier.subresourceRange.baseMipLevel = 0;
+   barrier.subresourceRange.levelCount = 1;
+   barrier.subresourceRange.baseArrayLayer = 0;
+   barrier.subresourceRange.layerCount = 1;
+
+   vk::PipelineStageFlags sourceStage;
+   vk::PipelineStageFlags destinationStage;
+
+   if (oldLayout == vk::ImageLayout::eUndefined && newLayout == vk::ImageLayout::eTransferDstOptimal)
+   {
+      barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+
+      sourceStage = vk::PipelineStageFlagBits::eTopOfPipe;
+      destinationStage = vk::PipelineStageFlagBits::eTransfer;
+   }
+   else if (oldLayout == vk::ImageLayout::eTransferDstOptimal && newLayout == vk::ImageLayout::eShaderReadOnlyOptimal)
+   {
+      barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+      barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+      sourceStage = vk::PipelineStageFlagBits::eTransfer;
+      destinationStage = vk::PipelineStageFlagBits::eFragmentShader;
+   }
+   else if (oldLayout == vk::ImageLayout::eUndefined && newLayout == vk::ImageLayout::eDepthStencilAttachmentOptimal)
+   {
+      barrier.dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+
+      sourceStage = vk::PipelineStageFlagBits::eTopOfPipe;
+      destinationStage = vk::PipelineStageFlagBits::eEarlyFragmentTests;
+   }
+   else
+   {
+      throw std::invalid_argument ("unsupported layout transition!");
+   }
+
+   commandBuffer.pipelineBarrier (sourceStage, destinationStage, vk::DependencyFlags (), 0, nullptr, 0, nullptr, 1, &barrier);
+
+
+   return endUploadCommands (commandBuffer, commandPool, queue);
+}
+
+TransferHandle HelloTriangleApplication::transferImageOwnership (vk::Image image, vk::ImageLayout oldLayout, vk::ImageLayout newLayout, vk::AccessFlags dstAccessMask, vk::PipelineStageFlags dstStageMask)
+{
+   QueueFamilyIndices indices = findQueueFamilies (physicalDevice);
+
+   vk::ImageMemoryBarrier barrier = {};
+   barrier.oldLayout = oldLayout;
+   barrier.newLayout = newLayout;
+   barrier.image = image;
+   barrier.subresourceRange = {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+
+   if (uploadBatch.commandBuffer || indices.graphicsFamily == indices.transferFamily)
+   {
+      barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+      barrier.dstAccessMask = dstAccessMask;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+      vk::CommandBuffer commandBuffer = beginUploadCommands (commandPoolGraphics);
+      commandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eTransfer, dstStageMask, vk::DependencyFlags (), 0, nullptr, 0, nullptr, 1, &barrier);
+      return endUploadCommands (commandBuffer, commandPoolGraphics, graphicsQueue);
+   }
+
+   barrier.srcQueueFamilyIndex = indices.transferFamily;
+   barrier.dstQueueFamilyIndex = indices.graphicsFamily;
+
+   //Release, the destination access is ignored by the transfer queue
+   barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+
+   vk::CommandBuffer commandBuffer = beginSingleTimeCommands (commandPoolTransfer);
+   commandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags (), 0, nullptr, 0, nullptr, 1, &barrier);
+   TransferHandle release = endSingleTimeCommands (commandBuffer, commandPoolTransfer, transferQueue);
+
+   //Acquire, the layout transition is repeated exactly as it was released
+   barrier.srcAccessMask = vk::AccessFlags ();
+   barrier.dstAccessMask = dstAccessMask;
+
+   commandBuffer = beginSingleTimeCommands (commandPoolGraphics);
+   commandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eTopOfPipe, dstStageMask, vk::DependencyFlags (), 0, nullptr, 0, nullptr, 1, &barrier);
+   return endSingleTimeCommands (commandBuffer, commandPoolGraphics, graphicsQueue, {release});
+}
+
+TransferHandle HelloTriangleApplication::copyBufferToImage (vk::Buffer buffer, vk::Image image, uint32_t width, uint32_t height)
+{
+   vk::CommandBuffer commandBuffer = beginUploadCommands (commandPoolTransfer);
+
+   vk::BufferImageCopy region = {};
+   region.bufferOffset = 0;
+   region.bufferRowLength = 0;
+   region.bufferImageHeight = 0;
+
+   region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+   region.imageSubresource.mipLevel = 0;
+   region.imageSubresource.baseArrayLayer = 0;
+   region.imageSubresource.layerCount = 1;
+
+   region.imageOffset = {0, 0, 0};
+   region.imageExtent = {width, height, 1};
+
+   commandBuffer.copyBufferToImage (buffer, image, vk::ImageLayout::eTransferDstOptimal, 1, &region);
+
+   return endUploadCommands (commandBuffer, commandPoolTransfer, transferQueue);
+}
+
+void HelloTriangleApplication::createTextureImageView ()
+{
+   textureImageView = createImageView (textureImage, vk::Format::eR8G8B8A8Unorm, vk::ImageAspectFlagBits::eColor);
+}
+
+void HelloTriangleApplication::createTextureSampler ()
+{
+   vk::SamplerCreateInfo samplerInfo = {};
+   samplerInfo.magFilter = vk::Filter::eLinear;
+   samplerInfo.minFilter = vk::Filter::eLinear;
+
+   samplerInfo.addressModeU = vk::SamplerAddressMode::eRepeat;
+   samplerInfo.addressModeV = vk::SamplerAddressMode::eRepeat;
+   samplerInfo.addressModeW = vk::SamplerAddressMode::eRepeat;
+
+   samplerInfo.anisotropyEnable = VK_TRUE;
+   samplerInfo.maxAnisotropy = 16;
+
+   samplerInfo.borderColor = vk::BorderColor::eFloatOpaqueBlack;
+
+   samplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+   samplerInfo.compareEnable = VK_FALSE;
+   samplerInfo.compareOp = vk::CompareOp::eAlways;
+
+   samplerInfo.mipmapMode = vk::SamplerMipmapMode::eLinear;
+   samplerInfo.mipLodBias = 0.0f;
+   samplerInfo.minLod = 0.0f;
+   samplerInfo.maxLod = 0.0f;
+
+   if (device.createSampler (&samplerInfo, allocationCallbacks, &textureSampler) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create texture sampler!");
+   }
+}
+
+void HelloTriangleApplication::createDepthResources ()
+{
+   PROFILE_ZONE ("createDepthResources");
+
+   vk::Format depthFormat = findDepthFormat ();
+
+   //The depth pyramid is reduced from the depth image, so with occlusion culling it has to be stored and sampled
+   if (options.occlusionCulling)
+   {
+      createImage (swapChainExtent.width, swapChainExtent.height, depthFormat, vk::ImageTiling::eOptimal,
+                   vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal,
+                   depthImage, depthImageAllocation);
+   }
+   else
+   {
+      depthImage = createTransientAttachmentImage (swapChainExtent.width, swapChainExtent.height, depthFormat, vk::ImageUsageFlagBits::eDepthStencilAttachment);
+
+      //Depth is the only transient target today, any later one whose lifetime does not overlap it joins this list
+      createTransientAttachmentMemory ({depthImage});
+   }
+
+   depthImageView = createImageView (depthImage, depthFormat, vk::ImageAspectFlagBits::eDepth);
+
+   transitionImageLayout (depthImage, depthFormat, vk::ImageLayout::eUndefined, vk::ImageLayout::eDepthStencilAttachmentOptimal, commandPoolGraphics, graphicsQueue);
+
+}
+
+vk::Image HelloTriangleApplication::createTransientAttachmentImage (uint32_t width, uint32_t height, vk::Format format, vk::ImageUsageFlags usage)
+{
+   vk::ImageCreateInfo imageInfo = {};
+   imageInfo.imageType = vk::ImageType::e2D;
+   imageInfo.extent = vk::Extent3D (width, height, 1);
+   imageInfo.mipLevels = 1;
+   imageInfo.arrayLayers = 1;
+   imageInfo.format = format;
+   imageInfo.tiling = vk::ImageTiling::eOptimal;
+   imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+   imageInfo.usage = usage | vk::ImageUsageFlagBits::eTransientAttachment;
+   imageInfo.samples = vk::SampleCountFlagBits::e1;
+   imageInfo.sharingMode = vk::SharingMode::eExclusive;
+
+   vk::Image image;
+
+   if (device.createImage (&imageInfo, allocationCallbacks, &image) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to create image!");
+   }
+
+   return image;
+}
+
+void HelloTriangleApplication::createTransientAttachmentMemory (const std::vector<vk::Image>& aliasedImages)
+{
+   //All images are bound at offset 0 of the same memory, so they must never be in use at the same time
+   vk::MemoryRequirements aliasedRequirements = {};
+   aliasedRequirements.memoryTypeBits = ~0u;
+
+   for (auto image : aliasedImages)
+   {
+      vk::MemoryRequirements memRequirements;
+      device.getImageMemoryRequirements (image, &memRequirements);
+
+      aliasedRequirements.size = std::max (aliasedRequirements.size, memRequirements.size);
+      aliasedRequirements.alignment = std::max (aliasedRequirements.alignment, memRequirements.alignment);
+      aliasedRequirements.memoryTypeBits &= memRequirements.memoryTypeBits;
+   }
+
+   //Lazily allocated memory is only backed on demand, on tiled GPUs the attachment never leaves tile memory at all
+   uint32_t memoryTypeIndex;
+   bool lazilyAllocated = memoryAllocator.tryFindMemoryType (aliasedRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eLazilyAllocated, memoryTypeIndex);
+
+   if (!lazilyAllocated)
+   {
+      memoryTypeIndex = memoryAllocator.findMemoryType (aliasedRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+   }
+
+   vk::MemoryAllocateInfo allocInfo = {};
+   allocInfo.allocationSize = aliasedRequirements.size;
+   allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+   if (device.allocateMemory (&allocInfo, allocationCallbacks, &transientAttachmentMemory) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to allocate transient attachment memory!");
+   }
+
+   for (auto image : aliasedImages)
+   {
+      device.bindImageMemory (image, transientAttachmentMemory, 0);
+   }
+
+   std::cout << "transient attachments: " << aliasedImages.size () << " image(s) aliased in " << aliasedRequirements.size << " bytes of "
+      << (lazilyAllocated ? "lazily allocated" : "device local") << " memory" << std::endl;
+}
+
+vk::Format HelloTriangleApplication::findSupportedFormat (const std::vector<vk::Format>& candidates, vk::ImageTiling tiling, vk::FormatFeatureFlags features)
+{
+   for (auto format : candidates)
+   {
+      vk::FormatProperties props;
+      physicalDevice.getFormatProperties (format, &props);
+
+      if (tiling == vk::ImageTiling::eLinear && (props.linearTilingFeatures & features) == features)
+      {
+         return format;
+      }
+      else if (tiling == vk::ImageTiling::eOptimal && (props.optimalTilingFeatures & features) == features)
+      {
+         return format;
+      }
+
+   }
+
+   throw std::runtime_error ("failed to find supported format!");
+
+}
+
+vk::Format HelloTriangleApplication::findDepthFormat ()
+{
+   return findSupportedFormat (
+      {vk::Format::eD32Sfloat, vk::Format::eD32SfloatS8Uint, vk::Format::eD24UnormS8Uint},
+      vk::ImageTiling::eOptimal,
+      options.occlusionCulling ? vk::FormatFeatureFlagBits::eDepthStencilAttachment | vk::FormatFeatureFlagBits::eSampledImage : vk::FormatFeatureFlags (vk::FormatFeatureFlagBits::eDepthStencilAttachment)
+   );
 }
 
-void HelloTriangleApplication::recreateSwapChain ()
+bool HelloTriangleApplication::hasStencilComponent (vk::Format format)
 {
-   device.waitIdle ();
+   return format == vk::Format::eD32SfloatS8Uint || format == vk::Format::eD24UnormS8Uint;
+}
 
-   cleanupSwapChain ();
+void HelloTriangleApplication::startAssetLoading ()
+{
+   if (options.sequentialInit)
+   {
+      return;
+   }
 
-   createSwapChain ();
-   createImageViews ();
-   createRenderPass ();
-   createGraphicsPipeline ();
-   createDepthResources ();
-   createFramebuffers ();
-   createCommandBuffers ();
+   //Each task only touches state nothing else reads until it has been joined
+   std::string texture = texturePath ();
+   textureDecode = std::async (std::launch::async, [texture] () { Profiler::setThreadName ("texture decode"); return decodeImage (texture); });
+   modelLoad = std::async (std::launch::async, [this] () { Profiler::setThreadName ("model load"); loadModel (); });
 }
 
-void HelloTriangleApplication::cleanupSwapChain ()
+void HelloTriangleApplication::waitForModel ()
 {
-   device.destroyImageView (depthImageView, nullptr);
-   device.destroyImage (depthImage, nullptr);
-   device.freeMemory (depthImageMemory, nullptr);
+   PROFILE_ZONE ("waitForModel");
 
-   for (auto swapChainFramebuffer : swapChainFramebuffers)
+   if (modelLoad.valid ())
    {
-      device.destroyFramebuffer (swapChainFramebuffer, nullptr);
+      modelLoad.get ();
    }
+   else
+   {
+      loadModel ();
+   }
+}
 
-   device.freeCommandBuffers (commandPoolGraphics, static_cast<uint32_t> (commandBuffers.size ()), commandBuffers.data ());
-
-   device.destroyPipeline (graphicsPipeline, nullptr);
+void HelloTriangleApplication::buildDrawList ()
+{
+   PROFILE_ZONE ("buildDrawList");
 
-   device.destroyPipelineLayout (pipelineLayout, nullptr);
+   //Splits on triangle boundaries, every draw gets the same share give or take one triangle
+   size_t triangleCount = indices.size () / 3;
+   size_t drawCount = std::min<size_t> (std::max (options.drawCount, 1u), std::max<size_t> (triangleCount, 1));
 
-   device.destroyRenderPass (renderPass, nullptr);
+   drawList.clear ();
+   drawList.reserve (drawCount);
 
-   for (auto swapChainImageView : swapChainImageViews)
+   for (size_t i = 0; i < drawCount; ++i)
    {
-      device.destroyImageView (swapChainImageView, nullptr);
+      size_t firstTriangle = triangleCount * i / drawCount;
+      size_t lastTriangle = triangleCount * (i + 1) / drawCount;
+
+      DrawCommand draw;
+      draw.firstIndex = static_cast<uint32_t> (firstTriangle * 3);
+      draw.indexCount = static_cast<uint32_t> ((lastTriangle - firstTriangle) * 3);
+      drawList.push_back (draw);
    }
 
-   device.destroySwapchainKHR (swapChain, nullptr);
+   drawTransforms.resize (drawCount);
 }
 
-void HelloTriangleApplication::createVertexBuffer ()
+void HelloTriangleApplication::createDrawListCache ()
 {
-   vk::DeviceSize bufferSize = sizeof (vertices[0]) * vertices.size ();
+   PROFILE_ZONE ("createDrawListCache");
 
-   vk::Buffer stagingBuffer;
-   vk::DeviceMemory stagingBufferMemory;
-
-   createBuffer (bufferSize, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, stagingBuffer, stagingBufferMemory);
+   drawListCache.init (device, allocationCallbacks, findQueueFamilies (physicalDevice).graphicsFamily, framesInFlight, drawList.size (), DRAWS_PER_CHUNK);
 
-   void* data;
-   data = device.mapMemory (stagingBufferMemory, 0, bufferSize);
-   memcpy (data, vertices.data (), (size_t) bufferSize);
-   device.unmapMemory (stagingBufferMemory);
+   if (options.occlusionCulling)
+   {
+      lateDrawListCache.init (device, allocationCallbacks, findQueueFamilies (physicalDevice).graphicsFamily, framesInFlight, drawList.size (), DRAWS_PER_CHUNK);
+   }
+}
 
-   createBuffer (bufferSize, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, vertexBuffer, vertexBufferMemory);
-   copyBuffer (stagingBuffer, vertexBuffer, bufferSize);
+void HelloTriangleApplication::loadModel ()
+{
+   PROFILE_ZONE ("loadModel");
 
-   device.destroyBuffer (stagingBuffer, nullptr);
-   device.freeMemory (stagingBufferMemory, nullptr);
+   tinyobj::attrib_t attrib;
+   std::vector<tinyobj::shape_t> shapes;
+   std::vector<tinyobj::material_t> materials;
+   std::string err;
 
-}
+   if (!tinyobj::LoadObj (&attrib, &shapes, &materials, &err, modelPath ().c_str ()))
+   {
+      throw std::runtime_error (err);
+   }
+   std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
 
-void HelloTriangleApplication::createIndexBuffer ()
-{
-   vk::DeviceSize bufferSize = sizeof (indices[0]) * indices.size ();
+   for (const auto& shape : shapes)
+   {
+      for (const auto& index : shape.mesh.indices)
+      {
+         Vertex vertex = {};
 
-   vk::Buffer stagingBuffer;
-   vk::DeviceMemory stagingBufferMemory;
+         vertex.pos = {
+            attrib.vertices[3 * index.vertex_index + 0],
+            attrib.vertices[3 * index.vertex_index + 1],
+            attrib.vertices[3 * index.vertex_index + 2]
+         };
 
-   createBuffer (bufferSize, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, stagingBuffer, stagingBufferMemory);
+         vertex.texCoord = {
+            attrib.texcoords[2 * index.texcoord_index + 0],
+            1.0f - attrib.texcoords[2 * index.texcoord_index + 1] //Origin of texture was assumed bottom left, but Vulkan assumes top-left
+         };
 
-   void* data;
-   data = device.mapMemory (stagingBufferMemory, 0, bufferSize);
-   memcpy (data, indices.data (), (size_t) bufferSize);
-   device.unmapMemory (stagingBufferMemory);
+         vertex.color = {1.0f, 1.0f, 1.0f};
 
-   createBuffer (bufferSize, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, indexBuffer, indexBufferMemory);
-   copyBuffer (stagingBuffer, indexBuffer, bufferSize);
+         if (uniqueVertices.count (vertex) == 0)
+         {
+            uniqueVertices[vertex] = static_cast<uint32_t> (vertices.size ());
+            vertices.push_back (vertex);
+         }
 
-   device.destroyBuffer (stagingBuffer, nullptr);
-   device.freeMemory (stagingBufferMemory, nullptr);
-}
+         indices.push_back (uniqueVertices[vertex]);
+      }
+   }
 
-void HelloTriangleApplication::createUniformBuffer ()
-{
-   vk::DeviceSize  bufferSize = sizeof (UniformBufferObject);
-   createBuffer (bufferSize, vk::BufferUsageFlagBits::eUniformBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, uniformBuffer, uniformBufferMemory);
-}
 
-void HelloTriangleApplication::createDescriptorPool ()
-{
-   std::array<vk::DescriptorPoolSize, 2> poolSize = {};
-   poolSize[0].type = vk::DescriptorType::eUniformBuffer;
-   poolSize[0].descriptorCount = 1;
-   poolSize[1].type = vk::DescriptorType::eCombinedImageSampler;
-   poolSize[1].descriptorCount = 1;
+   //Normalize models
+   float maxCoord = 0.0f;
+   for (auto& Vert : vertices)
+   {
+      float maxInVert = std::max ({std::abs (Vert.pos.x), std::abs (Vert.pos.y), std::abs (Vert.pos.z)});
 
-   vk::DescriptorPoolCreateInfo poolInfo = {};
-   poolInfo.poolSizeCount = poolSize.size ();
-   poolInfo.pPoolSizes = poolSize.data ();
-   poolInfo.maxSets = 1;
+      if (maxInVert > maxCoord)
+      {
+         maxCoord = maxInVert;
+      }
+   }
 
-   if (device.createDescriptorPool (&poolInfo, nullptr, &descriptorPool) != vk::Result::eSuccess)
+   for (auto& Vert : vertices)
    {
-      throw std::runtime_error ("failed to create descriptor pool!");
+      Vert.pos /= maxCoord;
    }
-}
 
-void HelloTriangleApplication::createDescriptorSet ()
-{
-   vk::DescriptorSetLayout layouts[] = {descriptorSetLayout};
-   vk::DescriptorSetAllocateInfo allocInfo = {};
-   allocInfo.descriptorPool = descriptorPool;
-   allocInfo.descriptorSetCount = 1;
-   allocInfo.pSetLayouts = layouts;
+   //Centered on the axis aligned bounds, which is close enough to the smallest sphere for culling
+   glm::vec3 minPos (std::numeric_limits<float>::max ());
+   glm::vec3 maxPos (-std::numeric_limits<float>::max ());
 
-   if (device.allocateDescriptorSets (&allocInfo, &descriptorSet) != vk::Result::eSuccess)
+   for (auto& Vert : vertices)
    {
-      throw std::runtime_error ("failed to allocate descriptor set!");
+      minPos = glm::min (minPos, Vert.pos);
+      maxPos = glm::max (maxPos, Vert.pos);
    }
 
-   vk::DescriptorBufferInfo bufferInfo = {};
-   bufferInfo.buffer = uniformBuffer;
-   bufferInfo.offset = 0;
-   bufferInfo.range = sizeof (UniformBufferObject);
+   glm::vec3 center = (minPos + maxPos) * 0.5f;
+   float radius = 0.0f;
 
-   vk::DescriptorImageInfo imageInfo = {};
-   imageInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-   imageInfo.imageView = textureImageView;
-   imageInfo.sampler = textureSampler;
+   for (auto& Vert : vertices)
+   {
+      radius = std::max (radius, glm::length (Vert.pos - center));
+   }
 
-   std::array<vk::WriteDescriptorSet, 2> descriptorWrite = {};
-   descriptorWrite[0].dstSet = descriptorSet;
-   descriptorWrite[0].dstBinding = 0;
-   descriptorWrite[0].dstArrayElement = 0;
-   descriptorWrite[0].descriptorType = vk::DescriptorType::eUniformBuffer;
-   descriptorWrite[0].descriptorCount = 1;
-   descriptorWrite[0].pBufferInfo = &bufferInfo;
+   modelBounds = glm::vec4 (center, radius);
 
-   descriptorWrite[1].dstSet = descriptorSet;
-   descriptorWrite[1].dstBinding = 1;
-   descriptorWrite[1].dstArrayElement = 0;
-   descriptorWrite[1].descriptorType = vk::DescriptorType::eCombinedImageSampler;
-   descriptorWrite[1].descriptorCount = 1;
-   descriptorWrite[1].pImageInfo = &imageInfo;
 
-   device.updateDescriptorSets (static_cast<uint32_t>(descriptorWrite.size ()), descriptorWrite.data (), 0, nullptr);
+   std::cout << "Model loaded." << std::endl;
 }
 
-
-void HelloTriangleApplication::createBuffer (vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Buffer& buffer, vk::DeviceMemory& bufferMemory)
+void HelloTriangleApplication::deferDestruction (std::function<void ()> destroy)
 {
-   vk::BufferCreateInfo bufferInfo = {};
-
-   bufferInfo.size = size;
-   bufferInfo.usage = usage;
-   bufferInfo.sharingMode = vk::SharingMode::eConcurrent;
-
-   QueueFamilyIndices indices = findQueueFamilies (physicalDevice);
-   uint32_t queueFamilies[] = {static_cast<uint32_t> (indices.graphicsFamily), static_cast<uint32_t> (indices.transferFamily)};
-   bufferInfo.queueFamilyIndexCount = 2;
-   bufferInfo.pQueueFamilyIndices = queueFamilies;
-
+   deferredDestructions.push_back ({frameNumber, destroy});
+}
 
-   if (device.createBuffer (&bufferInfo, nullptr, &buffer) != vk::Result::eSuccess)
+void HelloTriangleApplication::processDeferredDestructions ()
+{
+   auto retired = std::stable_partition (deferredDestructions.begin (), deferredDestructions.end (), [&] (const DeferredDestruction& deferred)
    {
-      throw std::runtime_error ("failed to create buffer!");
-   }
-
-   vk::MemoryRequirements memRequirements;
-   device.getBufferMemoryRequirements (buffer, &memRequirements);
-
-   vk::MemoryAllocateInfo allocInfo = {};
-   allocInfo.allocationSize = memRequirements.size;
-   allocInfo.memoryTypeIndex = findMemoryType (memRequirements.memoryTypeBits, properties);
+      return deferred.frameNumber + DEFERRED_DESTRUCTION_FRAMES > frameNumber;
+   });
 
-   if (device.allocateMemory (&allocInfo, nullptr, &bufferMemory) != vk::Result::eSuccess)
+   for (auto deferred = retired; deferred != deferredDestructions.end (); ++deferred)
    {
-      throw std::runtime_error ("failed to allocate buffer memory!");
+      deferred->destroy ();
    }
 
-   device.bindBufferMemory (buffer, bufferMemory, 0);
+   deferredDestructions.erase (retired, deferredDestructions.end ());
 }
 
-void HelloTriangleApplication::copyBuffer (vk::Buffer srcBuffer, vk::Buffer dstBuffer, vk::DeviceSize size)
+void HelloTriangleApplication::flushDeferredDestructions ()
 {
-   vk::CommandBuffer commandBuffer = beginSingleTimeCommands (commandPoolTransfer);
-
-   vk::BufferCopy copyRegion = {};
-   copyRegion.size = size;
-
-   commandBuffer.copyBuffer (srcBuffer, dstBuffer, 1, &copyRegion);
+   for (auto& deferred : deferredDestructions)
+   {
+      deferred.destroy ();
+   }
 
-   endSingleTimeCommands (commandBuffer, commandPoolTransfer, transferQueue);
+   deferredDestructions.clear ();
 }
 
-void HelloTriangleApplication::createDescriptorSetLayout ()
+void HelloTriangleApplication::beginMemoryCompaction ()
 {
-   vk::DescriptorSetLayoutBinding uboLayoutBinding = {};
-   uboLayoutBinding.binding = 0;
-   uboLayoutBinding.descriptorType = vk::DescriptorType::eUniformBuffer;
-   uboLayoutBinding.descriptorCount = 1;
+   if (compactionInProgress || !memoryAllocator.beginDefragmentation (COMPACTION_MAX_OCCUPANCY))
+   {
+      return;
+   }
 
-   uboLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex;
-   uboLayoutBinding.pImmutableSamplers = nullptr;
+   vk::CommandBufferAllocateInfo allocInfo = {};
+   allocInfo.commandPool = commandPoolGraphics;
+   allocInfo.level = vk::CommandBufferLevel::ePrimary;
+   allocInfo.commandBufferCount = 1;
 
-   vk::DescriptorSetLayoutBinding samplerLayoutBinding = {};
-   samplerLayoutBinding.binding = 1;
-   samplerLayoutBinding.descriptorCount = 1;
-   samplerLayoutBinding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
-   samplerLayoutBinding.pImmutableSamplers = nullptr;
-   samplerLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eFragment;
+   if (device.allocateCommandBuffers (&allocInfo, &compactionCommandBuffer) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to allocate command buffers!");
+   }
+
+   vk::CommandBufferBeginInfo beginInfo = {};
+   beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
 
-   std::array<vk::DescriptorSetLayoutBinding, 2> bindings = {uboLayoutBinding, samplerLayoutBinding};
+   compactionCommandBuffer.begin (&beginInfo);
+
+   //The copies run on the graphics queue, which already owns every exclusive resource, so no ownership transfers are needed
+   vk::DeviceSize bytesMoved = 0;
+
+   relocateBuffer (vertexBuffer, vertexBufferAllocation, sizeof (vertices[0]) * vertices.size (),
+                   vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eVertexBuffer,
+                   vk::MemoryPropertyFlagBits::eDeviceLocal, bytesMoved);
+   relocateBuffer (indexBuffer, indexBufferAllocation, sizeof (indices[0]) * indices.size (),
+                   vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eIndexBuffer,
+                   vk::MemoryPropertyFlagBits::eDeviceLocal, bytesMoved);
+   relocateBuffer (instanceBuffer, instanceBufferAllocation, sizeof (InstanceData) * std::max (options.instanceCount, 1u),
+                   vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer,
+                   vk::MemoryPropertyFlagBits::eDeviceLocal, bytesMoved);
+   relocateBuffer (uniformBuffer, uniformBufferAllocation, uniformBufferStride * MAX_FRAMES_IN_FLIGHT,
+                   vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst,
+                   vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, bytesMoved);
+   relocateBuffer (transformBuffer, transformBufferAllocation, transformBufferStride * MAX_FRAMES_IN_FLIGHT,
+                   vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst,
+                   vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, bytesMoved);
+   relocateImage (textureImage, textureImageView, textureImageAllocation, textureExtent, vk::Format::eR8G8B8A8Unorm,
+                  vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eSampled, bytesMoved);
+
+   vk::MemoryBarrier barrier = {};
+   barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+   barrier.dstAccessMask = vk::AccessFlagBits::eMemoryRead;
+
+   compactionCommandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags (), 1, &barrier, 0, nullptr, 0, nullptr);
+
+   compactionCommandBuffer.end ();
+
+   if (bufferRelocations.empty () && imageRelocations.empty ())
+   {
+      device.freeCommandBuffers (commandPoolGraphics, 1, &compactionCommandBuffer);
+      memoryAllocator.endDefragmentation ();
+      return;
+   }
 
-   vk::DescriptorSetLayoutCreateInfo layoutInfo = {};
-   layoutInfo.bindingCount = bindings.size ();
-   layoutInfo.pBindings = bindings.data ();
+   vk::SubmitInfo submitInfo = {};
+   submitInfo.commandBufferCount = 1;
+   submitInfo.pCommandBuffers = &compactionCommandBuffer;
 
-   if (device.createDescriptorSetLayout (&layoutInfo, nullptr, &descriptorSetLayout) != vk::Result::eSuccess)
+   //Nothing waits on the fence here, updateMemoryCompaction polls it once per frame
+   if (graphicsQueue.submit (1, &submitInfo, compactionFence) != vk::Result::eSuccess)
    {
-      throw std::runtime_error ("failed to create descriptor set layout!");
+      throw std::runtime_error ("failed to submit memory compaction command buffer!");
    }
+
+   compactionInProgress = true;
 }
 
-void HelloTriangleApplication::createTextureImage ()
+void HelloTriangleApplication::relocateBuffer (vk::Buffer& buffer, MemoryAllocation& allocation, vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize& bytesMoved)
 {
-   int texWidth, texHeight, texChannels;
+   if (!memoryAllocator.isDefragmentationSource (allocation) || bytesMoved + allocation.size > COMPACTION_MAX_BYTES_PER_PASS)
+   {
+      return;
+   }
 
-   stbi_uc* pixels = stbi_load (TEXTURE_PATH.c_str (), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-   vk::DeviceSize imageSize = texWidth * texHeight * 4; //4 bytes per pixel
+   BufferRelocation relocation = {};
+   relocation.buffer = &buffer;
+   relocation.allocation = &allocation;
 
-   if (!pixels)
+   vk::BufferCreateInfo bufferInfo = {};
+   bufferInfo.size = size;
+   bufferInfo.usage = usage;
+   bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+
+   if (device.createBuffer (&bufferInfo, allocationCallbacks, &relocation.newBuffer) != vk::Result::eSuccess)
    {
-      std::runtime_error ("failed to load texture image!");
+      throw std::runtime_error ("failed to create buffer!");
    }
 
-   vk::Buffer stagingBuffer;
-   vk::DeviceMemory stagingBufferMemory;
-
-   createBuffer (imageSize, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, stagingBuffer, stagingBufferMemory);
+   vk::MemoryRequirements memRequirements;
+   device.getBufferMemoryRequirements (relocation.newBuffer, &memRequirements);
 
-   void* data;
-   data = device.mapMemory (stagingBufferMemory, 0, imageSize);
-   memcpy (data, pixels, static_cast<size_t>(imageSize));
-   device.unmapMemory (stagingBufferMemory);
+   //Only dense blocks are valid destinations, if none has room the buffer simply stays where it is
+   if (!memoryAllocator.tryAllocate (memRequirements, properties, relocation.newAllocation))
+   {
+      device.destroyBuffer (relocation.newBuffer, allocationCallbacks);
+      return;
+   }
 
-   stbi_image_free (pixels);
+   device.bindBufferMemory (relocation.newBuffer, relocation.newAllocation.memory, relocation.newAllocation.offset);
 
-   createImage (texWidth, texHeight, vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal, textureImage, textureImageMemory);
+   vk::BufferCopy copyRegion = {};
+   copyRegion.size = size;
 
-   transitionImageLayout (textureImage, vk::Format::eR8G8B8A8Unorm, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, commandPoolGraphics, graphicsQueue);
-   copyBufferToImage (stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-   transitionImageLayout (textureImage, vk::Format::eR8G8B8A8Unorm, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, commandPoolGraphics, graphicsQueue);
+   compactionCommandBuffer.copyBuffer (buffer, relocation.newBuffer, 1, &copyRegion);
 
-   device.destroyBuffer (stagingBuffer, nullptr);
-   device.freeMemory (stagingBufferMemory, nullptr);
+   bytesMoved += allocation.size;
+   bufferRelocations.push_back (relocation);
 }
 
-void HelloTriangleApplication::createImage (uint32_t width, uint32_t height, vk::Format format, vk::ImageTiling tiling, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Image & image, vk::DeviceMemory & imageMemory)
+void HelloTriangleApplication::relocateImage (vk::Image& image, vk::ImageView& imageView, MemoryAllocation& allocation, vk::Extent2D extent, vk::Format format, vk::ImageUsageFlags usage, vk::DeviceSize& bytesMoved)
 {
+   //Only sampled images resting in eShaderReadOnlyOptimal are relocated, attachments are recreated with the swap chain instead
+   if (!memoryAllocator.isDefragmentationSource (allocation) || bytesMoved + allocation.size > COMPACTION_MAX_BYTES_PER_PASS)
+   {
+      return;
+   }
+
+   ImageRelocation relocation = {};
+   relocation.image = &image;
+   relocation.imageView = &imageView;
+   relocation.allocation = &allocation;
+
    vk::ImageCreateInfo imageInfo = {};
    imageInfo.imageType = vk::ImageType::e2D;
-   imageInfo.extent.width = static_cast<uint32_t> (width);
-   imageInfo.extent.height = static_cast<uint32_t> (height);
-   imageInfo.extent.depth = 1;
+   imageInfo.extent = vk::Extent3D (extent.width, extent.height, 1);
    imageInfo.mipLevels = 1;
    imageInfo.arrayLayers = 1;
-
    imageInfo.format = format;
-
-   imageInfo.tiling = tiling;
-   imageInfo.initialLayout = vk::ImageLayout::eUndefined;;
-
+   imageInfo.tiling = vk::ImageTiling::eOptimal;
+   imageInfo.initialLayout = vk::ImageLayout::eUndefined;
    imageInfo.usage = usage;
    imageInfo.samples = vk::SampleCountFlagBits::e1;
    imageInfo.sharingMode = vk::SharingMode::eExclusive;
 
-
-   if (device.createImage (&imageInfo, nullptr, &image) != vk::Result::eSuccess)
+   if (device.createImage (&imageInfo, allocationCallbacks, &relocation.newImage) != vk::Result::eSuccess)
    {
       throw std::runtime_error ("failed to create image!");
    }
 
    vk::MemoryRequirements memRequirements;
-   device.getImageMemoryRequirements (image, &memRequirements);
+   device.getImageMemoryRequirements (relocation.newImage, &memRequirements);
 
-   vk::MemoryAllocateInfo allocInfo = {};
-   allocInfo.allocationSize = memRequirements.size;
-   allocInfo.memoryTypeIndex = findMemoryType (memRequirements.memoryTypeBits, properties);
+   if (!memoryAllocator.tryAllocate (memRequirements, vk::MemoryPropertyFlagBits::eDeviceLocal, relocation.newAllocation))
+   {
+      device.destroyImage (relocation.newImage, allocationCallbacks);
+      return;
+   }
 
-   if (device.allocateMemory (&allocInfo, nullptr, &imageMemory) != vk::Result::eSuccess)
+   device.bindImageMemory (relocation.newImage, relocation.newAllocation.memory, relocation.newAllocation.offset);
+   relocation.newImageView = createImageView (relocation.newImage, format, vk::ImageAspectFlagBits::eColor);
+
+   std::array<vk::ImageMemoryBarrier, 2> barriers = {};
+   barriers[0].image = image;
+   barriers[0].oldLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+   barriers[0].newLayout = vk::ImageLayout::eTransferSrcOptimal;
+   barriers[0].srcAccessMask = vk::AccessFlagBits::eShaderRead;
+   barriers[0].dstAccessMask = vk::AccessFlagBits::eTransferRead;
+
+   barriers[1].image = relocation.newImage;
+   barriers[1].oldLayout = vk::ImageLayout::eUndefined;
+   barriers[1].newLayout = vk::ImageLayout::eTransferDstOptimal;
+   barriers[1].dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+
+   for (auto& barrier : barriers)
    {
-      throw std::runtime_error ("failed to allocate image memory!");
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.subresourceRange = {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
    }
 
-   device.bindImageMemory (image, imageMemory, 0);
-}
+   compactionCommandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags (), 0, nullptr, 0, nullptr, static_cast<uint32_t> (barriers.size ()), barriers.data ());
 
-void HelloTriangleApplication::transitionImageLayout (vk::Image image, vk::Format format, vk::ImageLayout oldLayout, vk::ImageLayout newLayout, vk::CommandPool commandPool, vk::Queue queue)
-{
-   vk::CommandBuffer commandBuffer = beginSingleTimeCommands (commandPool);
+   vk::ImageCopy region = {};
+   region.srcSubresource = {vk::ImageAspectFlagBits::eColor, 0, 0, 1};
+   region.dstSubresource = {vk::ImageAspectFlagBits::eColor, 0, 0, 1};
+   region.extent = imageInfo.extent;
 
-   vk::ImageMemoryBarrier barrier = {};
-   barrier.oldLayout = oldLayout;
-   barrier.newLayout = newLayout;
+   compactionCommandBuffer.copyImage (image, vk::ImageLayout::eTransferSrcOptimal, relocation.newImage, vk::ImageLayout::eTransferDstOptimal, 1, &region);
 
-   barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-   barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+   //Frames recorded before the commit keep sampling the old image, so it goes back to the layout they expect
+   barriers[0].oldLayout = vk::ImageLayout::eTransferSrcOptimal;
+   barriers[0].newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+   barriers[0].srcAccessMask = vk::AccessFlagBits::eTransferRead;
+   barriers[0].dstAccessMask = vk::AccessFlagBits::eShaderRead;
 
-   barrier.image = image;
+   barriers[1].oldLayout = vk::ImageLayout::eTransferDstOptimal;
+   barriers[1].newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+   barriers[1].srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+   barriers[1].dstAccessMask = vk::AccessFlagBits::eShaderRead;
 
-   if (newLayout == vk::ImageLayout::eDepthStencilAttachmentOptimal)
-   {
-      barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eDepth;
+   compactionCommandBuffer.pipelineBarrier (vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags (), 0, nullptr, 0, nullptr, static_cast<uint32_t> (barriers.size ()), barriers.data ());
 
-      if (hasStencilComponent (format))
-      {
-         barrier.subresourceRange.aspectMask |= vk::ImageAspectFlagBits::eStencil;
-      }
-   }
-   else
+   bytesMoved += allocation.size;
+   imageRelocations.push_back (relocation);
+}
+
+void HelloTriangleApplication::updateMemoryCompaction ()
+{
+   if (!compactionInProgress || device.getFenceStatus (compactionFence) != vk::Result::eSuccess)
    {
-      barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+      return;
    }
 
-   barrier.subresourceRange.baseMipLevel = 0;
-   barrier.subresourceRange.levelCount = 1;
-   barrier.subresourceRange.baseArrayLayer = 0;
-   barrier.subresourceRange.layerCount = 1;
-
-   vk::PipelineStageFlags sourceStage;
-   vk::PipelineStageFlags destinationStage;
+   MemoryStatistics before = memoryAllocator.getStatistics ();
 
-   if (oldLayout == vk::ImageLayout::eUndefined && newLayout == vk::ImageLayout::eTransferDstOptimal)
+   device.resetFences (1, &compactionFence);
+   device.freeCommandBuffers (commandPoolGraphics, 1, &compactionCommandBuffer);
+
+   for (auto& relocation : bufferRelocations)
    {
-      barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+      vk::Buffer oldBuffer = *relocation.buffer;
+      MemoryAllocation oldAllocation = *relocation.allocation;
 
-      sourceStage = vk::PipelineStageFlagBits::eTopOfPipe;
-      destinationStage = vk::PipelineStageFlagBits::eTransfer;
+      *relocation.buffer = relocation.newBuffer;
+      *relocation.allocation = relocation.newAllocation;
+
+      deferDestruction ([this, oldBuffer, oldAllocation] () mutable
+      {
+         device.destroyBuffer (oldBuffer, allocationCallbacks);
+         memoryAllocator.free (oldAllocation);
+      });
    }
-   else if (oldLayout == vk::ImageLayout::eTransferDstOptimal && newLayout == vk::ImageLayout::eShaderReadOnlyOptimal)
+
+   for (auto& relocation : imageRelocations)
    {
-      barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-      barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+      vk::Image oldImage = *relocation.image;
+      vk::ImageView oldImageView = *relocation.imageView;
+      MemoryAllocation oldAllocation = *relocation.allocation;
 
-      sourceStage = vk::PipelineStageFlagBits::eTransfer;
-      destinationStage = vk::PipelineStageFlagBits::eFragmentShader;
+      *relocation.image = relocation.newImage;
+      *relocation.imageView = relocation.newImageView;
+      *relocation.allocation = relocation.newAllocation;
+
+      deferDestruction ([this, oldImage, oldImageView, oldAllocation] () mutable
+      {
+         device.destroyImageView (oldImageView, allocationCallbacks);
+         device.destroyImage (oldImage, allocationCallbacks);
+         memoryAllocator.free (oldAllocation);
+      });
    }
-   else if (oldLayout == vk::ImageLayout::eUndefined && newLayout == vk::ImageLayout::eDepthStencilAttachmentOptimal)
+
+   //The descriptor set is rebuilt instead of updated in place, because frames in flight may still be using it. Cached
+   //draw commands still bind the old handles, so they are all re-recorded before their frame slot is submitted again.
+   vk::DescriptorSet oldDescriptorSet = descriptorSet;
+
+   createDescriptorSet ();
+   drawListCache.invalidateAll ();
+   lateDrawListCache.invalidateAll ();
+   gpuCuller.setInstanceBuffer (instanceBuffer);
+
+   deferDestruction ([this, oldDescriptorSet] ()
    {
-      barrier.dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+      device.freeDescriptorSets (descriptorPool, 1, &oldDescriptorSet);
+   });
 
-      sourceStage = vk::PipelineStageFlagBits::eTopOfPipe;
-      destinationStage = vk::PipelineStageFlagBits::eEarlyFragmentTests;
+   std::cout << "memory compaction moved " << bufferRelocations.size () << " buffers and " << imageRelocations.size () << " images, "
+      << before.blockCount << " blocks (" << before.usedBytes << " / " << before.blockBytes << " bytes used) before release" << std::endl;
+
+   bufferRelocations.clear ();
+   imageRelocations.clear ();
+
+   memoryAllocator.endDefragmentation ();
+   compactionInProgress = false;
+}
+
+void HelloTriangleApplication::printMemoryStatistics ()
+{
+   MemoryStatistics statistics = memoryAllocator.getStatistics ();
+
+   std::cout << "device memory: " << statistics.allocationCount << " sub-allocations in " << statistics.blockCount << " blocks ("
+      << statistics.usedBytes << " / " << statistics.blockBytes << " bytes used), "
+      << statistics.dedicatedAllocationCount << " dedicated allocations (" << statistics.dedicatedBytes << " bytes; "
+      << statistics.dedicatedRequiredCount << " required, " << statistics.dedicatedPreferredCount << " preferred, "
+      << statistics.dedicatedLargeCount << " large)" << std::endl;
+}
+
+void HelloTriangleApplication::benchmarkBufferSharingModes ()
+{
+   static const uint32_t DRAWS_PER_SUBMIT = 64;
+   static const uint32_t SUBMIT_COUNT = 200;
+
+   //Every submit renders into the same acquired swap chain image, it is presented once at the end
+   uint32_t imageIndex;
+   if (device.acquireNextImageKHR (swapChain, std::numeric_limits<uint64_t>::max (), imageAvailableSemaphores[0], VK_NULL_HANDLE, &imageIndex) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to acquire swap chain image!");
    }
-   else
+
+   vk::FenceCreateInfo fenceInfo = {};
+   vk::Fence fence;
+
+   if (device.createFence (&fenceInfo, allocationCallbacks, &fence) != vk::Result::eSuccess)
    {
-      throw std::invalid_argument ("unsupported layout transition!");
+      throw std::runtime_error ("failed to create fence!");
    }
 
-   commandBuffer.pipelineBarrier (sourceStage, destinationStage, vk::DependencyFlags (), 0, nullptr, 0, nullptr, 1, &barrier);
+   bool waitForImage = true;
 
+   for (auto sharingMode : {vk::SharingMode::eExclusive, vk::SharingMode::eConcurrent})
+   {
+      vk::Buffer benchmarkVertexBuffer;
+      MemoryAllocation benchmarkVertexBufferAllocation;
+      vk::Buffer benchmarkIndexBuffer;
+      MemoryAllocation benchmarkIndexBufferAllocation;
+
+      TransferHandle vertexUpload = createDeviceLocalBuffer (vertices.data (), sizeof (vertices[0]) * vertices.size (), vk::BufferUsageFlagBits::eVertexBuffer,
+                                                             vk::AccessFlagBits::eVertexAttributeRead, vk::PipelineStageFlagBits::eVertexInput,
+                                                             benchmarkVertexBuffer, benchmarkVertexBufferAllocation, sharingMode);
+      TransferHandle indexUpload = createDeviceLocalBuffer (indices.data (), sizeof (indices[0]) * indices.size (), vk::BufferUsageFlagBits::eIndexBuffer,
+                                                            vk::AccessFlagBits::eIndexRead, vk::PipelineStageFlagBits::eVertexInput,
+                                                            benchmarkIndexBuffer, benchmarkIndexBufferAllocation, sharingMode);
+
+      //Concurrent buffers are written on the transfer queue without any acquire on the graphics queue to order against
+      transferScheduler.wait (vertexUpload);
+      transferScheduler.wait (indexUpload);
+
+      vk::CommandBufferAllocateInfo allocInfo = {};
+      allocInfo.commandPool = commandPoolGraphics;
+      allocInfo.level = vk::CommandBufferLevel::ePrimary;
+      allocInfo.commandBufferCount = 1;
+
+      vk::CommandBuffer commandBuffer;
+      if (device.allocateCommandBuffers (&allocInfo, &commandBuffer) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to allocate command buffers!");
+      }
 
-   endSingleTimeCommands (commandBuffer, commandPool, queue);
-}
+      vk::CommandBufferBeginInfo beginInfo = {};
+      commandBuffer.begin (&beginInfo);
 
-void HelloTriangleApplication::copyBufferToImage (vk::Buffer buffer, vk::Image image, uint32_t width, uint32_t height)
-{
-   vk::CommandBuffer commandBuffer = beginSingleTimeCommands (commandPoolTransfer);
+      std::array<vk::ClearValue, 2> clearValues = {};
+      clearValues[0].setColor (vk::ClearColorValue (std::array<float, 4> {0.0f, 0.0f, 0.0f, 1.0f}));
+      clearValues[1].depthStencil = {1.0f, 0};
 
-   vk::BufferImageCopy region = {};
-   region.bufferOffset = 0;
-   region.bufferRowLength = 0;
-   region.bufferImageHeight = 0;
+      vk::RenderPassBeginInfo renderPassInfo = {};
+      renderPassInfo.renderPass = renderPass;
+      renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+      renderPassInfo.renderArea.offset = {0, 0};
+      renderPassInfo.renderArea.extent = swapChainExtent;
+      renderPassInfo.clearValueCount = static_cast<uint32_t> (clearValues.size ());
+      renderPassInfo.pClearValues = clearValues.data ();
 
-   region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
-   region.imageSubresource.mipLevel = 0;
-   region.imageSubresource.baseArrayLayer = 0;
-   region.imageSubresource.layerCount = 1;
+      commandBuffer.beginRenderPass (&renderPassInfo, vk::SubpassContents::eInline);
+      commandBuffer.bindPipeline (vk::PipelineBindPoint::eGraphics, graphicsPipeline);
+      setViewportAndScissor (commandBuffer);
+      uint32_t dynamicOffsets[] = {0, 0};
+      commandBuffer.bindDescriptorSets (vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 1, &descriptorSet, 2, dynamicOffsets);
 
-   region.imageOffset = {0, 0, 0};
-   region.imageExtent = {width, height, 1};
+      vk::Buffer vertexBuffers[] = {benchmarkVertexBuffer, instanceBuffer};
+      vk::DeviceSize offsets[] = {0, 0};
+      commandBuffer.bindVertexBuffers (0, 2, vertexBuffers, offsets);
+      commandBuffer.bindIndexBuffer (benchmarkIndexBuffer, 0, vk::IndexType::eUint32);
 
-   commandBuffer.copyBufferToImage (buffer, image, vk::ImageLayout::eTransferDstOptimal, 1, &region);
+      PushConstants pushConstants;
+      pushConstants.model = glm::mat4 (1.0f);
+      pushConstants.drawIndex = 0;
+      commandBuffer.pushConstants (pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof (pushConstants), &pushConstants);
 
-   endSingleTimeCommands (commandBuffer, commandPoolTransfer, transferQueue);
-}
+      for (uint32_t i = 0; i < DRAWS_PER_SUBMIT; ++i)
+      {
+         commandBuffer.drawIndexed (static_cast<uint32_t> (indices.size ()), 1, 0, 0, 0);
+      }
 
-void HelloTriangleApplication::createTextureImageView ()
-{
-   textureImageView = createImageView (textureImage, vk::Format::eR8G8B8A8Unorm, vk::ImageAspectFlagBits::eColor);
-}
+      commandBuffer.endRenderPass ();
+      commandBuffer.end ();
 
-void HelloTriangleApplication::createTextureSampler ()
-{
-   vk::SamplerCreateInfo samplerInfo = {};
-   samplerInfo.magFilter = vk::Filter::eLinear;
-   samplerInfo.minFilter = vk::Filter::eLinear;
+      vk::PipelineStageFlags waitStages[] = {vk::PipelineStageFlagBits::eColorAttachmentOutput};
 
-   samplerInfo.addressModeU = vk::SamplerAddressMode::eRepeat;
-   samplerInfo.addressModeV = vk::SamplerAddressMode::eRepeat;
-   samplerInfo.addressModeW = vk::SamplerAddressMode::eRepeat;
+      vk::SubmitInfo submitInfo = {};
+      submitInfo.commandBufferCount = 1;
+      submitInfo.pCommandBuffers = &commandBuffer;
 
-   samplerInfo.anisotropyEnable = VK_TRUE;
-   samplerInfo.maxAnisotropy = 16;
+      auto startTime = std::chrono::high_resolution_clock::now ();
 
-   samplerInfo.borderColor = vk::BorderColor::eFloatOpaqueBlack;
+      //The first submit is a warm up and is not timed
+      for (uint32_t submit = 0; submit <= SUBMIT_COUNT; ++submit)
+      {
+         if (submit == 1)
+         {
+            startTime = std::chrono::high_resolution_clock::now ();
+         }
 
-   samplerInfo.unnormalizedCoordinates = VK_FALSE;
+         submitInfo.waitSemaphoreCount = waitForImage ? 1 : 0;
+         submitInfo.pWaitSemaphores = &imageAvailableSemaphores[0];
+         submitInfo.pWaitDstStageMask = waitStages;
+         waitForImage = false;
 
-   samplerInfo.compareEnable = VK_FALSE;
-   samplerInfo.compareOp = vk::CompareOp::eAlways;
+         if (graphicsQueue.submit (1, &submitInfo, fence) != vk::Result::eSuccess)
+         {
+            throw std::runtime_error ("failed to submit draw command buffer!");
+         }
 
-   samplerInfo.mipmapMode = vk::SamplerMipmapMode::eLinear;
-   samplerInfo.mipLodBias = 0.0f;
-   samplerInfo.minLod = 0.0f;
-   samplerInfo.maxLod = 0.0f;
+         device.waitForFences (1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max ());
+         device.resetFences (1, &fence);
+      }
 
-   if (device.createSampler (&samplerInfo, nullptr, &textureSampler) != vk::Result::eSuccess)
-   {
-      throw std::runtime_error ("failed to create texture sampler!");
+      auto endTime = std::chrono::high_resolution_clock::now ();
+      double seconds = std::chrono::duration<double, std::chrono::seconds::period> (endTime - startTime).count ();
+
+      double draws = static_cast<double> (DRAWS_PER_SUBMIT) * SUBMIT_COUNT;
+      double triangles = draws * (indices.size () / 3);
+
+      std::cout << (sharingMode == vk::SharingMode::eExclusive ? "exclusive" : "concurrent") << " sharing: "
+         << draws / seconds << " draws/s, "
+         << triangles / seconds << " triangles/s, "
+         << 1000.0 * seconds / SUBMIT_COUNT << " ms/submit" << std::endl;
+
+      device.freeCommandBuffers (commandPoolGraphics, 1, &commandBuffer);
+
+      device.destroyBuffer (benchmarkIndexBuffer, allocationCallbacks);
+      memoryAllocator.free (benchmarkIndexBufferAllocation);
+      device.destroyBuffer (benchmarkVertexBuffer, allocationCallbacks);
+      memoryAllocator.free (benchmarkVertexBufferAllocation);
    }
-}
 
-void HelloTriangleApplication::createDepthResources ()
-{
-   vk::Format depthFormat = findDepthFormat ();
+   device.destroyFence (fence, allocationCallbacks);
 
-   createImage (swapChainExtent.width, swapChainExtent.height, depthFormat, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eDepthStencilAttachment, vk::MemoryPropertyFlagBits::eDeviceLocal, depthImage, depthImageMemory);
-   depthImageView = createImageView (depthImage, depthFormat, vk::ImageAspectFlagBits::eDepth);
+   //Hand the acquired image back to the presentation engine
+   vk::SubmitInfo signalInfo = {};
+   signalInfo.signalSemaphoreCount = 1;
+   signalInfo.pSignalSemaphores = &renderFinishedSemaphores[0];
+   graphicsQueue.submit (1, &signalInfo, VK_NULL_HANDLE);
 
-   transitionImageLayout (depthImage, depthFormat, vk::ImageLayout::eUndefined, vk::ImageLayout::eDepthStencilAttachmentOptimal, commandPoolGraphics, graphicsQueue);
+   vk::PresentInfoKHR presentInfo = {};
+   presentInfo.waitSemaphoreCount = 1;
+   presentInfo.pWaitSemaphores = &renderFinishedSemaphores[0];
+   presentInfo.swapchainCount = 1;
+   presentInfo.pSwapchains = &swapChain;
+   presentInfo.pImageIndices = &imageIndex;
 
+   presentQueue.presentKHR (&presentInfo);
+
+   device.waitIdle ();
 }
 
-vk::Format HelloTriangleApplication::findSupportedFormat (const std::vector<vk::Format>& candidates, vk::ImageTiling tiling, vk::FormatFeatureFlags features)
+void HelloTriangleApplication::benchmarkFramesInFlight ()
 {
-   for (auto format : candidates)
+   static const uint32_t WARMUP_FRAMES = 60;
+   static const uint32_t MEASURED_FRAMES = 600;
+
+   for (uint32_t count = 1; count <= MAX_FRAMES_IN_FLIGHT; ++count)
    {
-      vk::FormatProperties props;
-      physicalDevice.getFormatProperties (format, &props);
+      setFramesInFlight (count);
 
-      if (tiling == vk::ImageTiling::eLinear && (props.linearTilingFeatures & features) == features)
+      for (uint32_t i = 0; i < WARMUP_FRAMES; ++i)
       {
-         return format;
+         glfwPollEvents ();
+         drawFrame ();
       }
-      else if (tiling == vk::ImageTiling::eOptimal && (props.optimalTilingFeatures & features) == features)
+
+      frameWaitTime = std::chrono::high_resolution_clock::duration (0);
+      auto startTime = std::chrono::high_resolution_clock::now ();
+
+      for (uint32_t i = 0; i < MEASURED_FRAMES; ++i)
       {
-         return format;
+         glfwPollEvents ();
+         drawFrame ();
       }
 
-   }
-
-   throw std::runtime_error ("failed to find supported format!");
+      device.waitIdle ();
 
-}
+      auto endTime = std::chrono::high_resolution_clock::now ();
+      double seconds = std::chrono::duration<double, std::chrono::seconds::period> (endTime - startTime).count ();
+      double waitSeconds = std::chrono::duration<double, std::chrono::seconds::period> (frameWaitTime).count ();
 
-vk::Format HelloTriangleApplication::findDepthFormat ()
-{
-   return findSupportedFormat (
-      {vk::Format::eD32Sfloat, vk::Format::eD32SfloatS8Uint, vk::Format::eD24UnormS8Uint},
-      vk::ImageTiling::eOptimal,
-      vk::FormatFeatureFlagBits::eDepthStencilAttachment
-   );
+      //Idle is the share of wall time drawFrame spent blocked on fences or image acquisition
+      std::cout << count << " frames in flight: " << MEASURED_FRAMES / seconds << " fps, "
+         << 100.0 * waitSeconds / seconds << "% CPU idle" << std::endl;
+   }
 }
 
-bool HelloTriangleApplication::hasStencilComponent (vk::Format format)
+void HelloTriangleApplication::benchmarkResizeStorm ()
 {
-   return format == vk::Format::eD32SfloatS8Uint || format == vk::Format::eD24UnormS8Uint;
-}
+   static const uint32_t WARMUP_FRAMES = 60;
+   static const uint32_t STORM_FRAMES = 600;
+   static const int STORM_AMPLITUDE = 200; //Pixels the window grows and shrinks by, a full swing takes twice as many frames
 
-void HelloTriangleApplication::loadModel ()
-{
-   tinyobj::attrib_t attrib;
-   std::vector<tinyobj::shape_t> shapes;
-   std::vector<tinyobj::material_t> materials;
-   std::string err;
+   int originalWidth = 0;
+   int originalHeight = 0;
+   glfwGetWindowSize (window, &originalWidth, &originalHeight);
 
-   if (!tinyobj::LoadObj (&attrib, &shapes, &materials, &err, MODEL_PATH.c_str ()))
+   for (bool blocking : {true, false})
    {
-      throw std::runtime_error (err);
-   }
-   std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
+      blockingSwapChainRecreation = blocking;
 
-   for (const auto& shape : shapes)
-   {
-      for (const auto& index : shape.mesh.indices)
+      for (uint32_t i = 0; i < WARMUP_FRAMES; ++i)
       {
-         Vertex vertex = {};
+         glfwPollEvents ();
+         drawFrame ();
+      }
 
-         vertex.pos = {
-            attrib.vertices[3 * index.vertex_index + 0],
-            attrib.vertices[3 * index.vertex_index + 1],
-            attrib.vertices[3 * index.vertex_index + 2]
-         };
+      frameWaitTime = std::chrono::high_resolution_clock::duration (0);
+      resizeEvents = 0;
+      swapChainRecreations = 0;
+      outOfDateRecreations = 0;
+      swapChainRecreateTime = std::chrono::high_resolution_clock::duration (0);
+      slowestSwapChainRecreate = std::chrono::high_resolution_clock::duration (0);
 
-         vertex.texCoord = {
-            attrib.texcoords[2 * index.texcoord_index + 0],
-            1.0f - attrib.texcoords[2 * index.texcoord_index + 1] //Origin of texture was assumed bottom left, but Vulkan assumes top-left
-         };
+      RollingStatistics frameTimes (STORM_FRAMES);
+      auto startTime = std::chrono::high_resolution_clock::now ();
+      auto frameStart = startTime;
 
-         vertex.color = {1.0f, 1.0f, 1.0f};
+      //Like dragging a window edge back and forth, a new size every frame
+      for (uint32_t i = 0; i < STORM_FRAMES; ++i)
+      {
+         int phase = static_cast<int> (i % (2 * STORM_AMPLITUDE));
+         int offset = phase < STORM_AMPLITUDE ? phase : 2 * STORM_AMPLITUDE - phase;
 
-         if (uniqueVertices.count (vertex) == 0)
-         {
-            uniqueVertices[vertex] = static_cast<uint32_t> (vertices.size ());
-            vertices.push_back (vertex);
-         }
+         glfwSetWindowSize (window, originalWidth + offset, originalHeight + offset / 2);
+         glfwPollEvents ();
+         drawFrame ();
 
-         indices.push_back (uniqueVertices[vertex]);
+         auto frameEnd = std::chrono::high_resolution_clock::now ();
+         frameTimes.add (std::chrono::duration<double, std::chrono::milliseconds::period> (frameEnd - frameStart).count ());
+         frameStart = frameEnd;
       }
-   }
 
+      device.waitIdle ();
 
-   //Normalize models
-   float maxCoord = 0.0f;
-   for (auto& Vert : vertices)
-   {
-      float maxInVert = std::max ({std::abs (Vert.pos.x), std::abs (Vert.pos.y), std::abs (Vert.pos.z)});
+      auto endTime = std::chrono::high_resolution_clock::now ();
+      double seconds = std::chrono::duration<double, std::chrono::seconds::period> (endTime - startTime).count ();
+      double waitSeconds = std::chrono::duration<double, std::chrono::seconds::period> (frameWaitTime).count ();
+      double recreateMilliseconds = std::chrono::duration<double, std::chrono::milliseconds::period> (swapChainRecreateTime).count ();
+      double slowestRecreateMilliseconds = std::chrono::duration<double, std::chrono::milliseconds::period> (slowestSwapChainRecreate).count ();
 
-      if (maxInVert > maxCoord)
-      {
-         maxCoord = maxInVert;
-      }
-   }
+      std::cout << (blocking ? "blocking" : "deferred") << " swap chain recreation: " << resizeEvents << " resize events, "
+         << swapChainRecreations << " recreations (" << outOfDateRecreations << " forced by out of date results) taking "
+         << recreateMilliseconds << " ms (" << slowestRecreateMilliseconds << " ms worst), "
+         << STORM_FRAMES / seconds << " fps, " << frameTimes.getPercentile (99.0) << " ms 99th percentile frame, "
+         << frameTimes.getMax () << " ms worst frame, " << 100.0 * waitSeconds / seconds << "% CPU idle" << std::endl;
 
-   for (auto& Vert : vertices)
-   {
-      Vert.pos /= maxCoord;
+      glfwSetWindowSize (window, originalWidth, originalHeight);
+      glfwPollEvents ();
    }
 
+   blockingSwapChainRecreation = false;
+}
 
-   std::cout << "Model loaded." << std::endl;
+vk::CommandBuffer HelloTriangleApplication::beginSingleTimeCommands (vk::CommandPool & commandPool)
+{
+   return transferScheduler.begin (commandPool);
+}
+
+TransferHandle HelloTriangleApplication::endSingleTimeCommands (vk::CommandBuffer commandBuffer, vk::CommandPool commandPool, vk::Queue queue, const std::vector<TransferHandle>& waitFor)
+{
+   //Never blocks, the command buffer goes back to the scheduler's free list once the returned handle completes
+   return transferScheduler.submit (commandBuffer, commandPool, queue, waitFor);
+}
+
+void HelloTriangleApplication::beginUploadBatch ()
+{
+   PROFILE_ZONE ("beginUploadBatch");
+
+   //The graphics queue can also transfer, recording everything there avoids the release/acquire pairs entirely
+   uploadBatch.commandBuffer = beginSingleTimeCommands (commandPoolGraphics);
 }
 
-uint32_t HelloTriangleApplication::findMemoryType (uint32_t typeFilter, vk::MemoryPropertyFlags properties)
+void HelloTriangleApplication::endUploadBatch ()
 {
-   vk::PhysicalDeviceMemoryProperties memProperties;
-   physicalDevice.getMemoryProperties (&memProperties);
+   PROFILE_ZONE ("endUploadBatch");
+
+   UploadBatch batch = uploadBatch;
+   uploadBatch = UploadBatch ();
+
+   TransferHandle upload = endSingleTimeCommands (batch.commandBuffer, commandPoolGraphics, graphicsQueue);
 
-   for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+   for (auto& staging : batch.stagingBuffers)
    {
-      if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties))
-      {
-         return i;
-      }
+      releaseStagingBuffer (staging.buffer, staging.allocation, upload);
    }
 
-   throw std::runtime_error ("failed to find suitable memory type!");
+   transferScheduler.wait (upload);
 }
 
-vk::CommandBuffer HelloTriangleApplication::beginSingleTimeCommands (vk::CommandPool & commandPool)
+vk::CommandBuffer HelloTriangleApplication::beginUploadCommands (vk::CommandPool& commandPool)
 {
-   vk::CommandBufferAllocateInfo allocInfo = {};
-   allocInfo.level = vk::CommandBufferLevel::ePrimary;
-   allocInfo.commandPool = commandPool;
-   allocInfo.commandBufferCount = 1;
-
-   vk::CommandBuffer commandBuffer;
-   device.allocateCommandBuffers (&allocInfo, &commandBuffer);
+   if (uploadBatch.commandBuffer)
+   {
+      return uploadBatch.commandBuffer;
+   }
 
-   vk::CommandBufferBeginInfo beginInfo = {};
-   beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+   return beginSingleTimeCommands (commandPool);
+}
 
-   commandBuffer.begin (&beginInfo);
+TransferHandle HelloTriangleApplication::endUploadCommands (vk::CommandBuffer commandBuffer, vk::CommandPool commandPool, vk::Queue queue)
+{
+   //Batched commands complete with the batch
+   if (commandBuffer == uploadBatch.commandBuffer)
+   {
+      return TransferHandle ();
+   }
 
-   return commandBuffer;
+   return endSingleTimeCommands (commandBuffer, commandPool, queue);
 }
 
-void HelloTriangleApplication::endSingleTimeCommands (vk::CommandBuffer commandBuffer, vk::CommandPool commandPool, vk::Queue queue)
+void HelloTriangleApplication::releaseStagingBuffer (vk::Buffer buffer, MemoryAllocation& allocation, TransferHandle lastUse)
 {
-   commandBuffer.end ();
-
-   vk::SubmitInfo submitInfo = {};
-   submitInfo.commandBufferCount = 1;
-   submitInfo.pCommandBuffers = &commandBuffer;
+   if (uploadBatch.commandBuffer)
+   {
+      uploadBatch.stagingBuffers.push_back ({buffer, allocation});
+      allocation = MemoryAllocation ();
+      return;
+   }
 
-   queue.submit (1, &submitInfo, VK_NULL_HANDLE);
-   queue.waitIdle ();
+   MemoryAllocation stagingAllocation = allocation;
+   allocation = MemoryAllocation ();
 
-   device.freeCommandBuffers (commandPool, 1, &commandBuffer);
+   transferScheduler.whenComplete (lastUse, [this, buffer, stagingAllocation] () mutable
+   {
+      device.destroyBuffer (buffer, allocationCallbacks);
+      memoryAllocator.free (stagingAllocation);
+   });
 }
 
 void HelloTriangleApplication::cleanup ()
 {
+   PROFILE_ZONE ("cleanup");
+
+   //The device is idle here, so a pending compaction can be committed and everything deferred released right away
+   transferScheduler.destroy ();
+   updateMemoryCompaction ();
+   flushDeferredDestructions ();
+
    cleanupSwapChain ();
+   destroyRenderPassAndPipeline ();
 
-   device.destroySampler (textureSampler, nullptr);
+   device.destroySampler (textureSampler, allocationCallbacks);
 
-   device.destroyImageView (textureImageView, nullptr);
+   device.destroyImageView (textureImageView, allocationCallbacks);
 
-   device.destroyImage (textureImage, nullptr);
-   device.freeMemory (textureImageMemory, nullptr);
+   device.destroyImage (textureImage, allocationCallbacks);
+   memoryAllocator.free (textureImageAllocation);
 
-   device.destroyDescriptorPool (descriptorPool, nullptr);
+   device.destroyDescriptorPool (descriptorPool, allocationCallbacks);
 
-   device.destroyDescriptorSetLayout (descriptorSetLayout, nullptr);
+   device.destroyDescriptorSetLayout (descriptorSetLayout, allocationCallbacks);
 
-   device.destroyBuffer (uniformBuffer, nullptr);
-   device.freeMemory (uniformBufferMemory, nullptr);
+   device.destroyBuffer (uniformBuffer, allocationCallbacks);
+   memoryAllocator.free (uniformBufferAllocation);
 
-   device.destroyBuffer (indexBuffer, nullptr);
-   device.freeMemory (indexBufferMemory, nullptr);
+   device.destroyBuffer (transformBuffer, allocationCallbacks);
+   memoryAllocator.free (transformBufferAllocation);
 
-   device.destroyBuffer (vertexBuffer, nullptr);
-   device.freeMemory (vertexBufferMemory, nullptr);
+   device.destroyBuffer (indexBuffer, allocationCallbacks);
+   memoryAllocator.free (indexBufferAllocation);
 
-   device.destroySemaphore (renderFinishedSemaphore, nullptr);
-   device.destroySemaphore (imageAvailableSemaphore, nullptr);
+   device.destroyBuffer (instanceBuffer, allocationCallbacks);
+   memoryAllocator.free (instanceBufferAllocation);
 
-   device.destroyCommandPool (commandPoolGraphics, nullptr);
-   device.destroyCommandPool (commandPoolTransfer, nullptr);
+   device.destroyBuffer (vertexBuffer, allocationCallbacks);
+   memoryAllocator.free (vertexBufferAllocation);
 
-   device.destroy (nullptr);
+   destroyFrameSyncObjects ();
+   device.destroyFence (compactionFence, allocationCallbacks);
+
+   gpuProfiler.destroy ();
+   gpuCuller.destroy ();
+   drawListCache.destroy ();
+   lateDrawListCache.destroy ();
+   frameCommandPools.destroy ();
+   device.destroyCommandPool (commandPoolGraphics, allocationCallbacks);
+   device.destroyCommandPool (commandPoolTransfer, allocationCallbacks);
+
+   memoryAllocator.destroy ();
+
+   device.destroy (allocationCallbacks);
 
    DestroyDebugReportCallbackEXT (
       VkInstance (instance),
       static_cast<VkDebugReportCallbackEXT>(callback),
-      nullptr);
+      reinterpret_cast<const VkAllocationCallbacks*> (allocationCallbacks));
+
+   if (!options.headless)
+   {
+      instance.destroySurfaceKHR (surface, allocationCallbacks);
+   }
 
-   instance.destroySurfaceKHR (surface, nullptr);
+   instance.destroy (allocationCallbacks);
 
-   instance.destroy (nullptr);
+   if (!options.headless)
+   {
+      glfwDestroyWindow (window);
 
-   glfwDestroyWindow (window);
+      glfwTerminate ();
+   }
 
-   glfwTerminate ();
+   hostAllocator.printStatistics (std::cout);
 }
 
 VkResult HelloTriangleApplication::CreateDebugReportCallbackEXT (VkInstance instance, const VkDebugReportCallbackCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugReportCallbackEXT* pCallback)
@@ -1646,10 +4009,15 @@ void HelloTriangleApplication::DestroyDebugReportCallbackEXT (VkInstance instanc
 }
 
 bool HelloTriangleApplication::checkDeviceExtensionSupport (vk::PhysicalDevice device)
+{
+   return checkDeviceExtensionSupport (device, deviceExtensions);
+}
+
+bool HelloTriangleApplication::checkDeviceExtensionSupport (vk::PhysicalDevice device, const std::vector<const char*>& extensions)
 {
    auto availableExtensions = device.enumerateDeviceExtensionProperties ();
 
-   std::set<std::string> requiredExtensions (deviceExtensions.begin (), deviceExtensions.end ());
+   std::set<std::string> requiredExtensions (extensions.begin (), extensions.end ());
 
    for (const auto& extension : availableExtensions)
    {
@@ -1663,7 +4031,11 @@ std::vector<const char*> HelloTriangleApplication::getRequiredExtensions ()
 {
    std::vector<const char *> extensions;
 
-   getRequiredGlfwExtensions (extensions);
+   //Headless runs never initialise GLFW, and need no surface extensions
+   if (!options.headless)
+   {
+      getRequiredGlfwExtensions (extensions);
+   }
 
    if (enableValidationLayers)
    {
@@ -1793,3 +4165,29 @@ std::array<vk::VertexInputAttributeDescription, 3> Vertex::getAttributeDescripti
 
    return attributeDescriptions;
 }
+
+vk::VertexInputBindingDescription InstanceData::getBindingDescription ()
+{
+   vk::VertexInputBindingDescription bindingDescription = {};
+
+   bindingDescription.binding = 1;
+   bindingDescription.stride = sizeof (InstanceData);
+   bindingDescription.inputRate = vk::VertexInputRate::eInstance;
+
+   return bindingDescription;
+}
+
+std::array<vk::VertexInputAttributeDescription, 4> InstanceData::getAttributeDescriptions ()
+{
+   std::array<vk::VertexInputAttributeDescription, 4> attributeDescriptions = {};
+
+   for (uint32_t column = 0; column < 4; ++column)
+   {
+      attributeDescriptions[column].binding = 1;
+      attributeDescriptions[column].location = 3 + column;
+      attributeDescriptions[column].format = vk::Format::eR32G32B32A32Sfloat;
+      attributeDescriptions[column].offset = static_cast<uint32_t> (offsetof (InstanceData, model) + column * sizeof (glm::vec4));
+   }
+
+   return attributeDescriptions;
+}
@@ -3,11 +3,16 @@
 #include <array>
 #include <vector>
 #include <set>
+#include <functional>
+#include <future>
+#include <memory>
+#include <chrono>
+#include <string>
 
-#define GLFW_INCLUDE_VULKAN //Includes <vulkan\vulkan.h> indicates that glfw is to load in Vulkan
+#define GLFW_INCLUDE_VULKAN //Includes <vulkan/vulkan.h> indicates that glfw is to load in Vulkan
 #include <GLFW/glfw3.h>
 
-#include <vulkan\vulkan.hpp>
+#include <vulkan/vulkan.hpp>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -17,6 +22,19 @@
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/hash.hpp>
 
+#include "BenchmarkReport.h"
+#include "DeviceMemoryAllocator.h"
+#include "DrawListCache.h"
+#include "FrameCommandPools.h"
+#include "FramePacer.h"
+#include "GpuCuller.h"
+#include "GpuProfiler.h"
+#include "HostAllocator.h"
+#include "TimeSource.h"
+#include "TransformArray.h"
+#include "TransferScheduler.h"
+#include "WorkerPool.h"
+
 struct Vertex
 {
    glm::vec3 pos;
@@ -32,6 +50,15 @@ struct Vertex
    }
 };
 
+//Per instance vertex data, every draw renders ApplicationOptions::instanceCount copies of its part of the model
+struct InstanceData
+{
+   glm::mat4 model;
+
+   static vk::VertexInputBindingDescription getBindingDescription ();
+   static std::array<vk::VertexInputAttributeDescription, 4> getAttributeDescriptions (); //One vec4 per matrix column
+};
+
 namespace std
 {
    template <> struct hash<Vertex>
@@ -43,13 +70,20 @@ namespace std
    };
 }
 
+//Shared by every draw, written once per frame
 struct UniformBufferObject
 {
-   glm::mat4 model;
    glm::mat4 view;
    glm::mat4 proj;
 };
 
+//Per draw data, pushed right before each draw so changing it needs no buffer writes or descriptor updates
+struct PushConstants
+{
+   glm::mat4 model;
+   uint32_t drawIndex; //Selects the draw's matrix in the transform buffer when transforms are precomputed
+};
+
 struct QueueFamilyIndices
 {
    int graphicsFamily;
@@ -64,6 +98,104 @@ struct QueueFamilyIndices
    }
 };
 
+struct BufferRelocation
+{
+   vk::Buffer* buffer;
+   MemoryAllocation* allocation;
+   vk::Buffer newBuffer;
+   MemoryAllocation newAllocation;
+};
+
+struct ImageRelocation
+{
+   vk::Image* image;
+   vk::ImageView* imageView;
+   MemoryAllocation* allocation;
+   vk::Image newImage;
+   vk::ImageView newImageView;
+   MemoryAllocation newAllocation;
+};
+
+struct StagingBuffer
+{
+   vk::Buffer buffer;
+   MemoryAllocation allocation;
+};
+
+//While open, upload copies and layout transitions are recorded here instead of being submitted one by one
+struct UploadBatch
+{
+   vk::CommandBuffer commandBuffer;
+   std::vector<StagingBuffer> stagingBuffers; //Released once the batch has executed
+};
+
+struct DeferredDestruction
+{
+   uint64_t frameNumber;
+   std::function<void ()> destroy;
+};
+
+//Hands the pixels back to stb_image, which allocated them
+struct DecodedPixelsDeleter
+{
+   void operator() (unsigned char* pixels) const;
+};
+
+//Pixels as returned by stb_image, owned until createTextureImage has copied them into a staging buffer. Also freed when
+//initialization throws before then, or the decode task is never joined.
+struct DecodedImage
+{
+   int width;
+   int height;
+   std::unique_ptr<unsigned char, DecodedPixelsDeleter> pixels;
+};
+
+//One indexed draw out of the model's index buffer
+struct DrawCommand
+{
+   uint32_t indexCount;
+   uint32_t firstIndex;
+};
+
+struct ApplicationOptions
+{
+   bool benchmarkSharingModes;
+   bool sequentialInit; //Load assets on the main thread after pipeline creation, to compare time to first frame
+   bool benchmarkFramesInFlight;
+   uint32_t framesInFlight;
+   uint32_t drawCount; //The model is split into this many draws to give the recording threads work
+   uint32_t recordingThreads; //0 uses one per hardware thread
+   bool cacheDrawCommands; //Replay unchanged chunks of the draw list instead of re-recording all of them every frame
+   vk::PresentModeKHR presentMode; //Falls back to FIFO, which every surface supports, when unavailable
+   uint32_t swapChainImageCount; //0 asks for one more than the surface minimum
+   double targetFrameRate; //0 leaves the frame rate to the present mode
+   std::string profileOutput; //Chrome trace written here on exit, profiling is off when empty
+   bool gpuTiming; //Timestamp and pipeline statistics queries every frame
+   bool headless; //No window or surface, renders a fixed number of frames into offscreen images
+   uint32_t headlessFrames;
+   double timeStep; //Seconds of animation per frame, 0 follows the wall clock
+   std::string recordTimePath; //Frame times are written here on exit
+   std::string replayTimePath; //Frame times are read from here instead of the clock
+   bool checksum; //Print a checksum of the last headless frame
+   std::string modelPath; //Empty uses the built in model and texture
+   std::string texturePath;
+   bool benchmarkSuite; //Headless only, times the loading, upload and rendering paths into benchmarkReport
+   uint32_t benchmarkIterations;
+   bool precomputeTransforms; //Upload one model view projection matrix per draw and multiply once per vertex
+   uint32_t instanceCount; //Copies of the model, laid out on a grid scaled to the size of a single copy
+   bool gpuCulling; //Frustum cull the instances in a compute pass and draw the survivors with indirect draws
+   bool occlusionCulling; //Also cull against a depth pyramid of the instances visible last frame, implies gpuCulling
+   bool benchmarkResize; //Resize the window every frame, recreating the swap chain blocking and then deferred
+   uint32_t animatedDraws; //This many draws bob up and down through setDrawTransform, the rest replay from the cache
+
+   ApplicationOptions () : benchmarkSharingModes (false), sequentialInit (false), benchmarkFramesInFlight (false), framesInFlight (2),
+      drawCount (1), recordingThreads (0), cacheDrawCommands (true), presentMode (vk::PresentModeKHR::eMailbox), swapChainImageCount (0),
+      targetFrameRate (0.0), gpuTiming (false), headless (false), headlessFrames (1000),
+      timeStep (0.0), checksum (false), benchmarkSuite (false), benchmarkIterations (10),
+      precomputeTransforms (false), instanceCount (1), gpuCulling (false), occlusionCulling (false), benchmarkResize (false),
+      animatedDraws (0) {}
+};
+
 struct SwapChainSupportDetails
 {
    vk::SurfaceCapabilitiesKHR capabilities;
@@ -75,6 +207,13 @@ class HelloTriangleApplication
 {
 private:
 
+   ApplicationOptions options;
+
+   HostAllocator hostAllocator;
+   const vk::AllocationCallbacks* allocationCallbacks; //Passed to every create/destroy call
+
+   WorkerPool workerPool; //Records the stale chunks of the draw list cache
+
    GLFWwindow * window;
    vk::Instance instance;
    vk::DebugReportCallbackEXT callback;
@@ -83,6 +222,8 @@ private:
    vk::SurfaceKHR surface;
    vk::PhysicalDevice physicalDevice;
    vk::Device device;
+   DeviceMemoryAllocator memoryAllocator;
+   TransferScheduler transferScheduler;
    vk::Queue graphicsQueue;
    vk::Queue presentQueue;
    vk::Queue transferQueue;
@@ -93,50 +234,111 @@ private:
    vk::Extent2D swapChainExtent;
    std::vector<vk::ImageView> swapChainImageViews;
    std::vector<vk::Framebuffer> swapChainFramebuffers;
+   std::vector<MemoryAllocation> offscreenImageAllocations; //Backing swapChainImages when headless
+   uint32_t nextOffscreenImage;
 
    vk::RenderPass renderPass;
+   vk::RenderPass lateRenderPass; //Only with ApplicationOptions::occlusionCulling, loads what renderPass drew and adds the late draws
    vk::DescriptorSetLayout descriptorSetLayout;
    vk::PipelineLayout pipelineLayout;
    vk::Pipeline graphicsPipeline;
 
    std::vector<Vertex> vertices;
    std::vector<uint32_t> indices;
+   std::vector<DrawCommand> drawList;
+   TransformArray drawTransforms; //Model matrix of each draw in drawList
    vk::Buffer vertexBuffer;
-   vk::DeviceMemory vertexBufferMemory;
+   MemoryAllocation vertexBufferAllocation;
 
    vk::Buffer indexBuffer;
-   vk::DeviceMemory indexBufferMemory;
+   MemoryAllocation indexBufferAllocation;
+
+   vk::Buffer instanceBuffer;
+   MemoryAllocation instanceBufferAllocation;
 
    vk::Buffer uniformBuffer;
-   vk::DeviceMemory uniformBufferMemory;
+   MemoryAllocation uniformBufferAllocation;
+   vk::DeviceSize uniformBufferStride; //One aligned region per frame in flight, selected with a dynamic offset
+
+   vk::Buffer transformBuffer; //Model view projection of every draw, only written with ApplicationOptions::precomputeTransforms
+   MemoryAllocation transformBufferAllocation;
+   vk::DeviceSize transformBufferStride; //Per frame in flight like the uniform buffer
 
    vk::CommandPool commandPoolGraphics;
    vk::CommandPool commandPoolTransfer;
-   std::vector<vk::CommandBuffer> commandBuffers;
+   FrameCommandPools frameCommandPools; //Primary command buffers are recorded every frame from here
+   DrawListCache drawListCache; //Secondary command buffers for the draw list, re-recorded only when stale
+   DrawListCache lateDrawListCache; //The same for the late phase of occlusion culling, which binds other indirect commands
+   GpuProfiler gpuProfiler; //Query pools per frame slot, only created with ApplicationOptions::gpuTiming
+   GpuCuller gpuCuller; //Only created with ApplicationOptions::gpuCulling or occlusionCulling
+   glm::vec4 modelBounds; //Bounding sphere of the loaded model, w is the radius
+   glm::mat4 cullingView; //Of the camera written by the last updateUniformBuffer
+   glm::mat4 cullingProjection;
 
    vk::DescriptorPool descriptorPool;
    vk::DescriptorSet descriptorSet;
 
-   vk::Semaphore imageAvailableSemaphore;
-   vk::Semaphore renderFinishedSemaphore;
+   uint32_t framesInFlight;
+   uint32_t currentFrame;
+   std::vector<vk::Semaphore> imageAvailableSemaphores; //One of each per frame in flight
+   std::vector<vk::Semaphore> renderFinishedSemaphores;
+   std::vector<vk::Fence> inFlightFences;
+   std::vector<vk::Fence> imagesInFlight; //Fence of the frame that last rendered to each swap chain image, may be null
+   std::chrono::high_resolution_clock::duration frameWaitTime; //Time drawFrame spent blocked on the GPU or the presentation engine
+
+   bool resizePending; //Set by resize events, the swap chain is recreated once they have been quiet for a while
+   std::chrono::high_resolution_clock::time_point lastResizeEvent;
+   bool blockingSwapChainRecreation; //Wait for the device and destroy the old swap chain up front, for comparison
+   uint32_t resizeEvents;
+   uint32_t swapChainRecreations;
+   uint32_t outOfDateRecreations; //Of swapChainRecreations, the ones an out of date acquire or present could not wait for
+   std::chrono::high_resolution_clock::duration swapChainRecreateTime;
+   std::chrono::high_resolution_clock::duration slowestSwapChainRecreate;
+   FramePacer framePacer;
+   TimeSource timeSource; //Animation time, sampled once per rendered frame
 
    vk::Image textureImage;
-   vk::DeviceMemory textureImageMemory;
+   vk::Extent2D textureExtent;
+   MemoryAllocation textureImageAllocation;
    vk::ImageView textureImageView;
    vk::Sampler textureSampler;
 
    vk::Image depthImage;
-   vk::DeviceMemory depthImageMemory;
    vk::ImageView depthImageView;
+   vk::DeviceMemory transientAttachmentMemory;
+   MemoryAllocation depthImageAllocation; //Occlusion culling samples the depth image, so it cannot be transient then
+
+   uint64_t frameNumber;
+   std::vector<DeferredDestruction> deferredDestructions;
+
+   bool compactionInProgress;
+   vk::CommandBuffer compactionCommandBuffer;
+   vk::Fence compactionFence;
+   std::vector<BufferRelocation> bufferRelocations;
+   std::vector<ImageRelocation> imageRelocations;
+
+   UploadBatch uploadBatch;
+
+   std::chrono::high_resolution_clock::time_point launchTime;
+   std::future<DecodedImage> textureDecode; //Started at launch, joined by createTextureImage
+   std::future<void> modelLoad; //Started at launch, joined before createVertexBuffer
+
+   BenchmarkReport benchmarkReport;
 
 
 
 public:
    HelloTriangleApplication ();
+   explicit HelloTriangleApplication (const ApplicationOptions& options);
    ~HelloTriangleApplication ();
 
    void run ();
 
+   const BenchmarkReport& getBenchmarkReport () const;
+
+   //Only the chunk holding the draw is re-recorded, nothing is written to the uniform buffer
+   void setDrawTransform (size_t drawIndex, const glm::mat4& model);
+
    static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback (
       VkDebugReportFlagsEXT flags,
       VkDebugReportObjectTypeEXT objType,
@@ -169,6 +371,7 @@ private:
    void createLogicalDevice ();
 
    void createSwapChain ();
+   void createOffscreenImages ();
    SwapChainSupportDetails querySwapChainSupport (vk::PhysicalDevice device);
    vk::SurfaceFormatKHR chooseSwapSurfaceFormat (const std::vector<vk::SurfaceFormatKHR>& availableFormats);
    vk::PresentModeKHR chooseSwapPresentMode (const std::vector<vk::PresentModeKHR>& availablePresentModes);
@@ -181,58 +384,116 @@ private:
    void createRenderPass ();
 
    void createGraphicsPipeline ();
+   void setViewportAndScissor (vk::CommandBuffer commandBuffer);
+   void destroyRenderPassAndPipeline ();
    vk::ShaderModule createShaderModule (const std::vector<char>& code);
 
    void createFramebuffers ();
 
    void createCommandPool ();
-   void createCommandBuffers ();
+   void recordCommandBuffer (vk::CommandBuffer commandBuffer, uint32_t imageIndex);
+   void executeDrawList (vk::CommandBuffer commandBuffer, CullPhase phase);
+   void recordChunk (CullPhase phase, size_t chunkIndex);
 
-   void createSemaphores ();
+   void createSyncObjects ();
+   void createFrameSyncObjects ();
+   void destroyFrameSyncObjects ();
+   void setFramesInFlight (uint32_t count);
 
    void mainLoop ();
-   void updateUniformBuffer ();
+   void runHeadless ();
+   void runBenchmarkSuite ();
+   void benchmarkInstancing ();
+   void benchmarkOcclusionCulling ();
+   void printFrameStatistics ();
+   void initTimeSource ();
+   uint64_t checksumImage (vk::Image image);
+   void updateUniformBuffer (uint32_t frameIndex);
    void drawFrame ();
 
+   void swapChainOutOfDate ();
    void recreateSwapChain ();
+   std::function<void ()> retireSwapChain ();
    void cleanupSwapChain ();
 
    void createVertexBuffer ();
    void createIndexBuffer ();
+   void createInstanceBuffer ();
+   void createGpuCuller ();
    void createUniformBuffer ();
+   void createTransformBuffer ();
 
    void createDescriptorPool ();
    void createDescriptorSet ();
+   void writeDescriptorSet (vk::DescriptorSet set);
 
    void createBuffer (vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties,
-                      vk::Buffer& buffer, vk::DeviceMemory& bufferMemory);
-   void copyBuffer (vk::Buffer srcBuffer, vk::Buffer dstBuffer, vk::DeviceSize size);
+                      vk::Buffer& buffer, MemoryAllocation& bufferAllocation,
+                      vk::SharingMode sharingMode = vk::SharingMode::eExclusive);
+   TransferHandle createDeviceLocalBuffer (const void* srcData, vk::DeviceSize size, vk::BufferUsageFlags usage,
+                                 vk::AccessFlags dstAccessMask, vk::PipelineStageFlags dstStageMask,
+                                 vk::Buffer& buffer, MemoryAllocation& bufferAllocation,
+                                 vk::SharingMode sharingMode = vk::SharingMode::eExclusive);
+   TransferHandle copyBuffer (vk::Buffer srcBuffer, vk::Buffer dstBuffer, vk::DeviceSize size, vk::SharingMode dstSharingMode,
+                    vk::AccessFlags dstAccessMask, vk::PipelineStageFlags dstStageMask);
 
    void createDescriptorSetLayout ();
 
    void createTextureImage ();
    void createImage (uint32_t width, uint32_t height, vk::Format format, vk::ImageTiling tiling,
                      vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties,
-                     vk::Image& image, vk::DeviceMemory& imageMemory);
-   void transitionImageLayout (vk::Image image, vk::Format format, vk::ImageLayout oldLayout,
-                               vk::ImageLayout newLayout, vk::CommandPool commandPool, vk::Queue queue);
-   void copyBufferToImage (vk::Buffer buffer, vk::Image image, uint32_t width, uint32_t height);
+                     vk::Image& image, MemoryAllocation& imageAllocation);
+   TransferHandle transitionImageLayout (vk::Image image, vk::Format format, vk::ImageLayout oldLayout,
+                                         vk::ImageLayout newLayout, vk::CommandPool commandPool, vk::Queue queue);
+   TransferHandle transferImageOwnership (vk::Image image, vk::ImageLayout oldLayout, vk::ImageLayout newLayout,
+                                          vk::AccessFlags dstAccessMask, vk::PipelineStageFlags dstStageMask);
+   TransferHandle copyBufferToImage (vk::Buffer buffer, vk::Image image, uint32_t width, uint32_t height);
 
    void createTextureImageView ();
    void createTextureSampler ();
 
    void createDepthResources ();
+   vk::Image createTransientAttachmentImage (uint32_t width, uint32_t height, vk::Format format, vk::ImageUsageFlags usage);
+   void createTransientAttachmentMemory (const std::vector<vk::Image>& aliasedImages);
    vk::Format findSupportedFormat (const std::vector<vk::Format>& candidates,
                                    vk::ImageTiling, vk::FormatFeatureFlags features);
    vk::Format findDepthFormat ();
    bool hasStencilComponent (vk::Format format);
 
+   void startAssetLoading ();
+   std::string modelPath () const;
+   std::string texturePath () const;
    void loadModel ();
-
-   uint32_t findMemoryType (uint32_t typeFilter, vk::MemoryPropertyFlags properties);
+   void waitForModel ();
+   void buildDrawList ();
+   void createDrawListCache ();
+   void createQueryPools ();
+
+   void deferDestruction (std::function<void ()> destroy);
+   void processDeferredDestructions ();
+   void flushDeferredDestructions ();
+
+   void beginMemoryCompaction ();
+   void relocateBuffer (vk::Buffer& buffer, MemoryAllocation& allocation, vk::DeviceSize size, vk::BufferUsageFlags usage,
+                        vk::MemoryPropertyFlags properties, vk::DeviceSize& bytesMoved);
+   void relocateImage (vk::Image& image, vk::ImageView& imageView, MemoryAllocation& allocation, vk::Extent2D extent,
+                       vk::Format format, vk::ImageUsageFlags usage, vk::DeviceSize& bytesMoved);
+   void updateMemoryCompaction ();
+   void printMemoryStatistics ();
+
+   void benchmarkBufferSharingModes ();
+   void benchmarkFramesInFlight ();
+   void benchmarkResizeStorm ();
 
    vk::CommandBuffer beginSingleTimeCommands (vk::CommandPool& commandPool);
-   void endSingleTimeCommands (vk::CommandBuffer commandBuffer, vk::CommandPool commandPool, vk::Queue queue);
+   TransferHandle endSingleTimeCommands (vk::CommandBuffer commandBuffer, vk::CommandPool commandPool, vk::Queue queue,
+                                         const std::vector<TransferHandle>& waitFor = std::vector<TransferHandle> ());
+
+   void beginUploadBatch ();
+   void endUploadBatch ();
+   vk::CommandBuffer beginUploadCommands (vk::CommandPool& commandPool);
+   TransferHandle endUploadCommands (vk::CommandBuffer commandBuffer, vk::CommandPool commandPool, vk::Queue queue);
+   void releaseStagingBuffer (vk::Buffer buffer, MemoryAllocation& allocation, TransferHandle lastUse);
 
    void cleanup ();
 
@@ -242,6 +503,7 @@ private:
                                        const VkAllocationCallbacks* pAllocator);
 
    bool checkDeviceExtensionSupport (vk::PhysicalDevice device);
+   bool checkDeviceExtensionSupport (vk::PhysicalDevice device, const std::vector<const char*>& extensions);
 
    std::vector<const char*> getRequiredExtensions ();
 
@@ -0,0 +1,315 @@
+#include "HostAllocator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+static void* alignedAllocate (size_t size, size_t alignment)
+{
+#ifdef _WIN32
+   return _aligned_malloc (size, alignment);
+#else
+   void* memory = nullptr;
+   return posix_memalign (&memory, alignment, size) == 0 ? memory : nullptr;
+#endif
+}
+
+static void alignedFree (void* memory)
+{
+#ifdef _WIN32
+   _aligned_free (memory);
+#else
+   std::free (memory);
+#endif
+}
+
+static size_t alignUp (size_t value, size_t alignment)
+{
+   return (value + alignment - 1) / alignment * alignment;
+}
+
+static const char* scopeName (size_t scope)
+{
+   switch (scope)
+   {
+   case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND: return "command";
+   case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT: return "object";
+   case VK_SYSTEM_ALLOCATION_SCOPE_CACHE: return "cache";
+   case VK_SYSTEM_ALLOCATION_SCOPE_DEVICE: return "device";
+   case VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE: return "instance";
+   default: return "unknown";
+   }
+}
+
+HostAllocator::HostAllocator ()
+{
+   callbacks.pUserData = this;
+   callbacks.pfnAllocation = allocationFunction;
+   callbacks.pfnReallocation = reallocationFunction;
+   callbacks.pfnFree = freeFunction;
+   callbacks.pfnInternalAllocation = internalAllocationNotification;
+   callbacks.pfnInternalFree = internalFreeNotification;
+}
+
+HostAllocator::~HostAllocator ()
+{
+   for (auto& arena : arenas)
+   {
+      for (auto chunk : arena.chunks)
+      {
+         alignedFree (chunk);
+      }
+   }
+}
+
+const vk::AllocationCallbacks* HostAllocator::getCallbacks () const
+{
+   return &callbacks;
+}
+
+HostAllocationStatistics HostAllocator::getStatistics (vk::SystemAllocationScope scope)
+{
+   ScopeArena& arena = arenas[static_cast<size_t> (scope)];
+
+   std::lock_guard<std::mutex> lock (arena.mutex);
+   return arena.statistics;
+}
+
+void HostAllocator::printStatistics (std::ostream& out)
+{
+   out << "host allocations per scope:" << std::endl;
+
+   for (size_t scope = 0; scope < SCOPE_COUNT; ++scope)
+   {
+      HostAllocationStatistics statistics = getStatistics (static_cast<vk::SystemAllocationScope> (scope));
+
+      out << "\t" << scopeName (scope) << ": "
+         << statistics.allocationCount << " allocations (" << statistics.pooledAllocationCount << " pooled), "
+         << statistics.reallocationCount << " reallocations, "
+         << statistics.freeCount << " frees, "
+         << statistics.currentBytes << " bytes live, "
+         << statistics.highWaterBytes << " bytes peak, "
+         << statistics.arenaBytes << " arena bytes, "
+         << statistics.internalAllocationCount << " internal allocations ("
+         << statistics.internalHighWaterBytes << " bytes peak)" << std::endl;
+   }
+}
+
+VKAPI_ATTR void* VKAPI_CALL HostAllocator::allocationFunction (void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+   return static_cast<HostAllocator*> (userData)->allocate (size, alignment, scope);
+}
+
+VKAPI_ATTR void* VKAPI_CALL HostAllocator::reallocationFunction (void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+   return static_cast<HostAllocator*> (userData)->reallocate (original, size, alignment, scope);
+}
+
+VKAPI_ATTR void VKAPI_CALL HostAllocator::freeFunction (void* userData, void* memory)
+{
+   static_cast<HostAllocator*> (userData)->free (memory);
+}
+
+VKAPI_ATTR void VKAPI_CALL HostAllocator::internalAllocationNotification (void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope)
+{
+   ScopeArena& arena = static_cast<HostAllocator*> (userData)->arenas[scope];
+
+   std::lock_guard<std::mutex> lock (arena.mutex);
+   ++arena.statistics.internalAllocationCount;
+   arena.statistics.internalCurrentBytes += size;
+   arena.statistics.internalHighWaterBytes = std::max (arena.statistics.internalHighWaterBytes, arena.statistics.internalCurrentBytes);
+}
+
+VKAPI_ATTR void VKAPI_CALL HostAllocator::internalFreeNotification (void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope)
+{
+   ScopeArena& arena = static_cast<HostAllocator*> (userData)->arenas[scope];
+
+   std::lock_guard<std::mutex> lock (arena.mutex);
+   arena.statistics.internalCurrentBytes -= size;
+}
+
+void* HostAllocator::allocate (size_t size, size_t alignment, uint32_t scope)
+{
+   if (size == 0)
+   {
+      return nullptr;
+   }
+
+   ScopeArena& arena = arenas[scope];
+
+   if (alignment < POOL_ALIGNMENT)
+   {
+      alignment = POOL_ALIGNMENT;
+   }
+
+   size_t headerSpace = alignUp (sizeof (AllocationHeader), alignment);
+
+   uint32_t sizeClass = LARGE_ALLOCATION;
+
+   if (alignment == POOL_ALIGNMENT)
+   {
+      for (uint32_t i = 0; i < SIZE_CLASS_COUNT; ++i)
+      {
+         if (headerSpace + size <= MIN_SIZE_CLASS << i)
+         {
+            sizeClass = i;
+            break;
+         }
+      }
+   }
+
+   std::lock_guard<std::mutex> lock (arena.mutex);
+
+   char* block;
+
+   if (sizeClass == LARGE_ALLOCATION)
+   {
+      block = static_cast<char*> (alignedAllocate (headerSpace + size, alignment));
+   }
+   else
+   {
+      block = static_cast<char*> (allocateFromArena (arena, sizeClass));
+   }
+
+   if (!block)
+   {
+      return nullptr;
+   }
+
+   if (sizeClass != LARGE_ALLOCATION)
+   {
+      ++arena.statistics.pooledAllocationCount;
+   }
+
+   char* memory = block + headerSpace;
+
+   AllocationHeader* header = reinterpret_cast<AllocationHeader*> (memory) - 1;
+   header->scope = scope;
+   header->sizeClass = sizeClass;
+   header->size = size;
+   header->offset = headerSpace;
+
+   ++arena.statistics.allocationCount;
+   arena.statistics.currentBytes += size;
+   arena.statistics.highWaterBytes = std::max (arena.statistics.highWaterBytes, arena.statistics.currentBytes);
+
+   return memory;
+}
+
+void* HostAllocator::reallocate (void* original, size_t size, size_t alignment, uint32_t scope)
+{
+   if (!original)
+   {
+      return allocate (size, alignment, scope);
+   }
+
+   if (size == 0)
+   {
+      free (original);
+      return nullptr;
+   }
+
+   AllocationHeader* header = static_cast<AllocationHeader*> (original) - 1;
+   size_t originalSize = header->size;
+   uint32_t originalScope = header->scope;
+
+   //Still fits in its size class, nothing needs to move
+   if (header->sizeClass != LARGE_ALLOCATION && header->scope == scope && header->offset + size <= MIN_SIZE_CLASS << header->sizeClass)
+   {
+      ScopeArena& arena = arenas[scope];
+
+      std::lock_guard<std::mutex> lock (arena.mutex);
+      ++arena.statistics.reallocationCount;
+      arena.statistics.currentBytes = arena.statistics.currentBytes - originalSize + size;
+      arena.statistics.highWaterBytes = std::max (arena.statistics.highWaterBytes, arena.statistics.currentBytes);
+
+      header->size = size;
+      return original;
+   }
+
+   void* memory = allocate (size, alignment, scope);
+
+   if (!memory)
+   {
+      return nullptr;
+   }
+
+   memcpy (memory, original, std::min (originalSize, size));
+   free (original);
+
+   //Counted as a reallocation only, not as a fresh allocation plus a free
+   {
+      std::lock_guard<std::mutex> lock (arenas[scope].mutex);
+      ++arenas[scope].statistics.reallocationCount;
+      --arenas[scope].statistics.allocationCount;
+   }
+
+   {
+      std::lock_guard<std::mutex> lock (arenas[originalScope].mutex);
+      --arenas[originalScope].statistics.freeCount;
+   }
+
+   return memory;
+}
+
+void HostAllocator::free (void* memory)
+{
+   if (!memory)
+   {
+      return;
+   }
+
+   AllocationHeader* header = static_cast<AllocationHeader*> (memory) - 1;
+   ScopeArena& arena = arenas[header->scope];
+
+   char* block = static_cast<char*> (memory) - header->offset;
+
+   std::lock_guard<std::mutex> lock (arena.mutex);
+
+   ++arena.statistics.freeCount;
+   arena.statistics.currentBytes -= header->size;
+
+   if (header->sizeClass == LARGE_ALLOCATION)
+   {
+      alignedFree (block);
+   }
+   else
+   {
+      FreeSlot* slot = reinterpret_cast<FreeSlot*> (block);
+      slot->next = arena.freeLists[header->sizeClass];
+      arena.freeLists[header->sizeClass] = slot;
+   }
+}
+
+void* HostAllocator::allocateFromArena (ScopeArena& arena, uint32_t sizeClass)
+{
+   if (FreeSlot* slot = arena.freeLists[sizeClass])
+   {
+      arena.freeLists[sizeClass] = slot->next;
+      return slot;
+   }
+
+   size_t slotSize = MIN_SIZE_CLASS << sizeClass;
+
+   //Slot sizes are multiples of POOL_ALIGNMENT so the cursor stays aligned, the tail of an exhausted chunk is abandoned
+   if (arena.chunkRemaining < slotSize)
+   {
+      void* chunk = alignedAllocate (CHUNK_SIZE, POOL_ALIGNMENT);
+
+      if (!chunk)
+      {
+         return nullptr;
+      }
+
+      arena.chunks.push_back (chunk);
+      arena.chunkCursor = static_cast<char*> (chunk);
+      arena.chunkRemaining = CHUNK_SIZE;
+      arena.statistics.arenaBytes += CHUNK_SIZE;
+   }
+
+   void* slot = arena.chunkCursor;
+   arena.chunkCursor += slotSize;
+   arena.chunkRemaining -= slotSize;
+
+   return slot;
+}
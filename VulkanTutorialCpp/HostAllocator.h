@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+struct HostAllocationStatistics
+{
+   uint64_t allocationCount;
+   uint64_t reallocationCount;
+   uint64_t freeCount;
+   uint64_t pooledAllocationCount;
+   size_t currentBytes;
+   size_t highWaterBytes;
+   size_t arenaBytes;
+
+   uint64_t internalAllocationCount;
+   size_t internalCurrentBytes;
+   size_t internalHighWaterBytes;
+
+   HostAllocationStatistics () : allocationCount (0), reallocationCount (0), freeCount (0), pooledAllocationCount (0),
+      currentBytes (0), highWaterBytes (0), arenaBytes (0),
+      internalAllocationCount (0), internalCurrentBytes (0), internalHighWaterBytes (0) {}
+};
+
+//Implements vk::AllocationCallbacks with one arena per VkSystemAllocationScope. Small allocations are served from
+//power of two size class free lists carved out of the arena's chunks, anything bigger or more aligned goes straight
+//to the aligned heap. Every scope keeps its own counters so the driver's host allocation churn can be inspected.
+class HostAllocator
+{
+private:
+   static const size_t SCOPE_COUNT = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+   static const size_t MIN_SIZE_CLASS = 64;
+   static const size_t SIZE_CLASS_COUNT = 7; //64 bytes up to 4 KB
+   static const size_t POOL_ALIGNMENT = 16;
+   static const size_t CHUNK_SIZE = 256 * 1024;
+   static const uint32_t LARGE_ALLOCATION = ~0u;
+
+   struct AllocationHeader
+   {
+      uint32_t scope;
+      uint32_t sizeClass;
+      size_t size;
+      size_t offset; //From the start of the raw block to the pointer handed to the driver
+   };
+
+   struct FreeSlot
+   {
+      FreeSlot* next;
+   };
+
+   struct ScopeArena
+   {
+      std::mutex mutex;
+      std::array<FreeSlot*, SIZE_CLASS_COUNT> freeLists;
+      std::vector<void*> chunks;
+      char* chunkCursor;
+      size_t chunkRemaining;
+      HostAllocationStatistics statistics;
+
+      ScopeArena () : chunkCursor (nullptr), chunkRemaining (0) { freeLists.fill (nullptr); }
+   };
+
+   std::array<ScopeArena, SCOPE_COUNT> arenas;
+   vk::AllocationCallbacks callbacks;
+
+public:
+   HostAllocator ();
+   ~HostAllocator ();
+
+   HostAllocator (const HostAllocator&) = delete;
+   HostAllocator& operator = (const HostAllocator&) = delete;
+
+   const vk::AllocationCallbacks* getCallbacks () const;
+
+   HostAllocationStatistics getStatistics (vk::SystemAllocationScope scope);
+   void printStatistics (std::ostream& out);
+
+private:
+   static VKAPI_ATTR void* VKAPI_CALL allocationFunction (void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope);
+   static VKAPI_ATTR void* VKAPI_CALL reallocationFunction (void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+   static VKAPI_ATTR void VKAPI_CALL freeFunction (void* userData, void* memory);
+   static VKAPI_ATTR void VKAPI_CALL internalAllocationNotification (void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+   static VKAPI_ATTR void VKAPI_CALL internalFreeNotification (void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+
+   void* allocate (size_t size, size_t alignment, uint32_t scope);
+   void* reallocate (void* original, size_t size, size_t alignment, uint32_t scope);
+   void free (void* memory);
+
+   void* allocateFromArena (ScopeArena& arena, uint32_t sizeClass);
+};
@@ -0,0 +1,27 @@
+#include "OptionParsing.h"
+
+#include <stdexcept>
+
+uint32_t parseUnsigned (const std::string& option, const std::string& value)
+{
+   try
+   {
+      return static_cast<uint32_t> (std::stoul (value));
+   }
+   catch (const std::logic_error&)
+   {
+      throw std::runtime_error ("invalid value for " + option + ": " + value + "!");
+   }
+}
+
+double parseDouble (const std::string& option, const std::string& value)
+{
+   try
+   {
+      return std::stod (value);
+   }
+   catch (const std::logic_error&)
+   {
+      throw std::runtime_error ("invalid value for " + option + ": " + value + "!");
+   }
+}
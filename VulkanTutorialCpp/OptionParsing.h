@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+//Numeric command line values shared by the application and the benchmark. Malformed numbers throw
+//std::runtime_error naming the option, so they are reported like any other startup error.
+uint32_t parseUnsigned (const std::string& option, const std::string& value);
+double parseDouble (const std::string& option, const std::string& value);
@@ -0,0 +1,164 @@
+#include "Profiler.h"
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+static const size_t EVENTS_PER_THREAD = 1 << 16;
+
+namespace
+{
+   struct ProfileEvent
+   {
+      const char* name;
+      uint64_t start;
+      uint64_t end;
+   };
+
+   struct ThreadBuffer
+   {
+      uint32_t threadIndex;
+      std::string name;
+      std::vector<ProfileEvent> events; //Ring buffer, only ever written by the owning thread
+      std::atomic<uint64_t> written; //Total events recorded, the writer publishes each event with a release store
+
+      ThreadBuffer (uint32_t threadIndex) : threadIndex (threadIndex), events (EVENTS_PER_THREAD), written (0) {}
+   };
+
+   //Buffers outlive their threads, so zones recorded by a worker are still there at export
+   struct Registry
+   {
+      std::mutex mutex;
+      std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+   };
+
+   Registry& registry ()
+   {
+      static Registry instance;
+      return instance;
+   }
+
+   const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now ();
+
+   thread_local ThreadBuffer* threadBuffer = nullptr;
+   thread_local std::string threadName;
+
+   ThreadBuffer& getThreadBuffer ()
+   {
+      if (!threadBuffer)
+      {
+         Registry& instance = registry ();
+         std::lock_guard<std::mutex> lock (instance.mutex);
+
+         instance.buffers.emplace_back (new ThreadBuffer (static_cast<uint32_t> (instance.buffers.size ())));
+         threadBuffer = instance.buffers.back ().get ();
+         threadBuffer->name = threadName;
+      }
+
+      return *threadBuffer;
+   }
+
+   void writeJsonString (std::ostream& out, const std::string& text)
+   {
+      out << '"';
+
+      for (char c : text)
+      {
+         if (c == '"' || c == '\\')
+         {
+            out << '\\';
+         }
+
+         out << c;
+      }
+
+      out << '"';
+   }
+}
+
+std::atomic<bool> Profiler::enabled (false);
+
+void Profiler::setEnabled (bool enable)
+{
+   enabled.store (enable, std::memory_order_relaxed);
+}
+
+void Profiler::setThreadName (const std::string& name)
+{
+   threadName = name;
+
+   if (threadBuffer)
+   {
+      std::lock_guard<std::mutex> lock (registry ().mutex);
+      threadBuffer->name = name;
+   }
+}
+
+uint64_t Profiler::now ()
+{
+   return static_cast<uint64_t> (std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now () - epoch).count ());
+}
+
+void Profiler::record (const char* name, uint64_t start, uint64_t end)
+{
+   ThreadBuffer& buffer = getThreadBuffer ();
+
+   uint64_t index = buffer.written.load (std::memory_order_relaxed);
+
+   ProfileEvent& event = buffer.events[index % EVENTS_PER_THREAD];
+   event.name = name;
+   event.start = start;
+   event.end = end;
+
+   buffer.written.store (index + 1, std::memory_order_release);
+}
+
+bool Profiler::writeChromeTrace (const std::string& filename)
+{
+   std::ofstream file (filename);
+
+   if (!file.is_open ())
+   {
+      return false;
+   }
+
+   Registry& instance = registry ();
+   std::lock_guard<std::mutex> lock (instance.mutex);
+
+   //Timestamps are in microseconds, the fraction keeps the nanoseconds
+   file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+   file.precision (3);
+   file << std::fixed;
+
+   bool first = true;
+
+   for (auto& buffer : instance.buffers)
+   {
+      if (!buffer->name.empty ())
+      {
+         file << (first ? "" : ",") << "\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,\"tid\":" << buffer->threadIndex << ",\"args\":{\"name\":";
+         writeJsonString (file, buffer->name);
+         file << "}}";
+         first = false;
+      }
+
+      uint64_t written = buffer->written.load (std::memory_order_acquire);
+      uint64_t oldest = written > EVENTS_PER_THREAD ? written - EVENTS_PER_THREAD : 0;
+
+      for (uint64_t i = oldest; i < written; ++i)
+      {
+         const ProfileEvent& event = buffer->events[i % EVENTS_PER_THREAD];
+
+         file << (first ? "" : ",") << "\n{\"ph\":\"X\",\"name\":";
+         writeJsonString (file, event.name);
+         file << ",\"pid\":0,\"tid\":" << buffer->threadIndex << ",\"ts\":" << event.start / 1000.0 << ",\"dur\":" << (event.end - event.start) / 1000.0 << "}";
+         first = false;
+      }
+   }
+
+   file << "\n]}\n";
+
+   return file.good ();
+}
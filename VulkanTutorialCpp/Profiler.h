@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+//CPU frame profiler. Zones are written by the thread that closes them into its own ring buffer, so recording takes no
+//locks, and the oldest events are overwritten once a thread's buffer is full. While the profiler is disabled a zone
+//costs one relaxed load. Export to Chrome trace JSON once the threads that recorded have gone quiet.
+class Profiler
+{
+private:
+   static std::atomic<bool> enabled;
+
+public:
+   static void setEnabled (bool enable);
+   static bool isEnabled () { return enabled.load (std::memory_order_relaxed); }
+
+   static void setThreadName (const std::string& name); //Shown in the trace instead of the thread number
+
+   static uint64_t now (); //Nanoseconds since the profiler was loaded
+   static void record (const char* name, uint64_t start, uint64_t end); //name must outlive the profiler, a literal
+
+   static bool writeChromeTrace (const std::string& filename);
+};
+
+class ProfileZone
+{
+private:
+   const char* name; //Null when the profiler was disabled as the zone opened
+   uint64_t start;
+
+public:
+   explicit ProfileZone (const char* name) : name (Profiler::isEnabled () ? name : nullptr), start (this->name ? Profiler::now () : 0) {}
+
+   ~ProfileZone ()
+   {
+      if (name)
+      {
+         Profiler::record (name, start, Profiler::now ());
+      }
+   }
+
+   ProfileZone (const ProfileZone&) = delete;
+   ProfileZone& operator= (const ProfileZone&) = delete;
+};
+
+#define PROFILE_ZONE_CONCAT_INNER(a, b) a##b
+#define PROFILE_ZONE_CONCAT(a, b) PROFILE_ZONE_CONCAT_INNER (a, b)
+
+//Times the rest of the enclosing scope
+#define PROFILE_ZONE(name) ProfileZone PROFILE_ZONE_CONCAT (profileZone, __LINE__) (name)
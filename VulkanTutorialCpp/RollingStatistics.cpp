@@ -0,0 +1,89 @@
+#include "RollingStatistics.h"
+
+#include <algorithm>
+#include <cmath>
+
+RollingStatistics::RollingStatistics (size_t windowSize) : samples (std::max<size_t> (windowSize, 1)), nextSample (0), sampleCount (0)
+{
+}
+
+void RollingStatistics::add (double value)
+{
+   samples[nextSample] = value;
+
+   nextSample = (nextSample + 1) % samples.size ();
+   sampleCount = std::min (sampleCount + 1, samples.size ());
+}
+
+void RollingStatistics::reset ()
+{
+   nextSample = 0;
+   sampleCount = 0;
+}
+
+size_t RollingStatistics::getCount () const
+{
+   return sampleCount;
+}
+
+double RollingStatistics::getMean () const
+{
+   if (sampleCount == 0)
+   {
+      return 0.0;
+   }
+
+   double sum = 0.0;
+
+   for (size_t i = 0; i < sampleCount; ++i)
+   {
+      sum += samples[i];
+   }
+
+   return sum / sampleCount;
+}
+
+double RollingStatistics::getStandardDeviation () const
+{
+   if (sampleCount == 0)
+   {
+      return 0.0;
+   }
+
+   double mean = getMean ();
+   double variance = 0.0;
+
+   for (size_t i = 0; i < sampleCount; ++i)
+   {
+      variance += (samples[i] - mean) * (samples[i] - mean);
+   }
+
+   return std::sqrt (variance / sampleCount);
+}
+
+double RollingStatistics::getMax () const
+{
+   if (sampleCount == 0)
+   {
+      return 0.0;
+   }
+
+   return *std::max_element (samples.begin (), samples.begin () + sampleCount);
+}
+
+double RollingStatistics::getPercentile (double percentile) const
+{
+   if (sampleCount == 0)
+   {
+      return 0.0;
+   }
+
+   std::vector<double> sorted (samples.begin (), samples.begin () + sampleCount);
+
+   size_t rank = static_cast<size_t> (std::ceil (percentile / 100.0 * sampleCount));
+   size_t index = std::min (sampleCount - 1, rank > 0 ? rank - 1 : 0);
+
+   std::nth_element (sorted.begin (), sorted.begin () + index, sorted.end ());
+
+   return sorted[index];
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+//Fixed size window over the most recent samples, the oldest is overwritten once it is full
+class RollingStatistics
+{
+private:
+   std::vector<double> samples;
+   size_t nextSample;
+   size_t sampleCount;
+
+public:
+   explicit RollingStatistics (size_t windowSize = 600);
+
+   void add (double value);
+   void reset ();
+
+   size_t getCount () const;
+   double getMean () const;
+   double getStandardDeviation () const;
+   double getMax () const;
+   double getPercentile (double percentile) const; //0 to 100, nearest rank
+};
@@ -0,0 +1,111 @@
+#include "TimeSource.h"
+
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+TimeSource::TimeSource () : mode (TimeSourceMode::eWallClock), startTime (Clock::now ()), fixedStep (0.0), frameIndex (0), frameTime (0.0),
+   recording (false)
+{
+}
+
+void TimeSource::useWallClock ()
+{
+   mode = TimeSourceMode::eWallClock;
+   startTime = Clock::now ();
+   frameIndex = 0;
+}
+
+void TimeSource::useFixedStep (double seconds)
+{
+   mode = TimeSourceMode::eFixedStep;
+   fixedStep = seconds;
+   frameIndex = 0;
+}
+
+void TimeSource::useReplay (const std::string& filename)
+{
+   std::ifstream file (filename);
+
+   if (!file.is_open ())
+   {
+      throw std::runtime_error ("failed to open time recording!");
+   }
+
+   replayTimes.clear ();
+
+   double time;
+
+   while (file >> time)
+   {
+      replayTimes.push_back (time);
+   }
+
+   if (replayTimes.empty ())
+   {
+      throw std::runtime_error ("time recording is empty!");
+   }
+
+   mode = TimeSourceMode::eReplay;
+   frameIndex = 0;
+}
+
+void TimeSource::startRecording ()
+{
+   recording = true;
+   recordedTimes.clear ();
+}
+
+void TimeSource::saveRecording (const std::string& filename) const
+{
+   std::ofstream file (filename);
+
+   if (!file.is_open ())
+   {
+      throw std::runtime_error ("failed to write time recording!");
+   }
+
+   //Written with full precision so a replay reproduces the exact same floats
+   file.precision (std::numeric_limits<double>::max_digits10);
+
+   for (double time : recordedTimes)
+   {
+      file << time << "\n";
+   }
+}
+
+void TimeSource::beginFrame ()
+{
+   switch (mode)
+   {
+   case TimeSourceMode::eWallClock:
+      frameTime = std::chrono::duration<double> (Clock::now () - startTime).count ();
+      break;
+
+   case TimeSourceMode::eFixedStep:
+      frameTime = frameIndex * fixedStep;
+      break;
+
+   case TimeSourceMode::eReplay:
+      //A run longer than the recording holds the last frame's time
+      frameTime = replayTimes[frameIndex < replayTimes.size () ? static_cast<size_t> (frameIndex) : replayTimes.size () - 1];
+      break;
+   }
+
+   ++frameIndex;
+
+   if (recording)
+   {
+      recordedTimes.push_back (frameTime);
+   }
+}
+
+double TimeSource::getTime () const
+{
+   return frameTime;
+}
+
+TimeSourceMode TimeSource::getMode () const
+{
+   return mode;
+}
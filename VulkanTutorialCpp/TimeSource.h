@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class TimeSourceMode
+{
+   eWallClock,
+   eFixedStep, //Frame n sees n * step seconds, regardless of how long frames take
+   eReplay //Frame times read from a file written by a recording run
+};
+
+//Where the app takes its animation time from. The time is sampled once per frame, so everything a frame renders sees
+//the same value, and a fixed step or a replayed recording renders the same frame sequence on every run.
+class TimeSource
+{
+private:
+   typedef std::chrono::high_resolution_clock Clock;
+
+   TimeSourceMode mode;
+   Clock::time_point startTime;
+   double fixedStep;
+   std::vector<double> replayTimes;
+
+   uint64_t frameIndex;
+   double frameTime;
+
+   bool recording;
+   std::vector<double> recordedTimes;
+
+public:
+   TimeSource ();
+
+   void useWallClock ();
+   void useFixedStep (double seconds);
+   void useReplay (const std::string& filename); //Throws if the recording cannot be read
+
+   //Keeps the time of every frame so a later run can replay them
+   void startRecording ();
+   void saveRecording (const std::string& filename) const;
+
+   void beginFrame (); //Samples the time for the next frame
+   double getTime () const; //Seconds, fixed for the whole frame
+
+   TimeSourceMode getMode () const;
+};
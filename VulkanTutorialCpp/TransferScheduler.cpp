@@ -0,0 +1,248 @@
+#include "TransferScheduler.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+TransferScheduler::TransferScheduler () : allocationCallbacks (nullptr), nextId (1)
+{
+}
+
+void TransferScheduler::init (vk::Device device, const vk::AllocationCallbacks* allocationCallbacks)
+{
+   this->device = device;
+   this->allocationCallbacks = allocationCallbacks;
+}
+
+void TransferScheduler::destroy ()
+{
+   while (!pending.empty ())
+   {
+      device.waitForFences (1, &pending.front ().fence, VK_TRUE, std::numeric_limits<uint64_t>::max ());
+      retire (0);
+   }
+
+   for (auto fence : freeFences)
+   {
+      device.destroyFence (fence, allocationCallbacks);
+   }
+
+   for (auto semaphore : freeSemaphores)
+   {
+      device.destroySemaphore (semaphore, allocationCallbacks);
+   }
+
+   for (auto& pool : freeCommandBuffers)
+   {
+      device.freeCommandBuffers (pool.first, static_cast<uint32_t> (pool.second.size ()), pool.second.data ());
+   }
+
+   freeFences.clear ();
+   freeSemaphores.clear ();
+   freeCommandBuffers.clear ();
+}
+
+vk::CommandBuffer TransferScheduler::begin (vk::CommandPool commandPool)
+{
+   vk::CommandBuffer commandBuffer;
+
+   auto& recycled = freeCommandBuffers[VkCommandPool (commandPool)];
+
+   if (!recycled.empty ())
+   {
+      commandBuffer = recycled.back ();
+      recycled.pop_back ();
+   }
+   else
+   {
+      vk::CommandBufferAllocateInfo allocInfo = {};
+      allocInfo.level = vk::CommandBufferLevel::ePrimary;
+      allocInfo.commandPool = commandPool;
+      allocInfo.commandBufferCount = 1;
+
+      if (device.allocateCommandBuffers (&allocInfo, &commandBuffer) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to allocate command buffers!");
+      }
+   }
+
+   vk::CommandBufferBeginInfo beginInfo = {};
+   beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+
+   commandBuffer.begin (&beginInfo);
+
+   return commandBuffer;
+}
+
+TransferHandle TransferScheduler::submit (vk::CommandBuffer commandBuffer, vk::CommandPool commandPool, vk::Queue queue,
+                                          const std::vector<TransferHandle>& waitFor, vk::PipelineStageFlags waitStage)
+{
+   commandBuffer.end ();
+
+   Submission submission;
+   submission.id = nextId++;
+   submission.commandBuffer = commandBuffer;
+   submission.commandPool = commandPool;
+
+   if (!freeFences.empty ())
+   {
+      submission.fence = freeFences.back ();
+      freeFences.pop_back ();
+   }
+   else
+   {
+      vk::FenceCreateInfo fenceInfo = {};
+
+      if (device.createFence (&fenceInfo, allocationCallbacks, &submission.fence) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to create fence!");
+      }
+   }
+
+   if (!freeSemaphores.empty ())
+   {
+      submission.signalSemaphore = freeSemaphores.back ();
+      freeSemaphores.pop_back ();
+   }
+   else
+   {
+      vk::SemaphoreCreateInfo semaphoreInfo = {};
+
+      if (device.createSemaphore (&semaphoreInfo, allocationCallbacks, &submission.signalSemaphore) != vk::Result::eSuccess)
+      {
+         throw std::runtime_error ("failed to create semaphore!");
+      }
+   }
+
+   //Work that already retired needs no semaphore, the host has seen its fence before this submit
+   for (auto handle : waitFor)
+   {
+      Submission* dependency = find (handle);
+
+      if (!dependency)
+      {
+         continue;
+      }
+
+      if (!dependency->signalSemaphore)
+      {
+         throw std::runtime_error ("transfer is already chained to another submission!");
+      }
+
+      submission.waitSemaphores.push_back (dependency->signalSemaphore);
+      dependency->signalSemaphore = vk::Semaphore ();
+   }
+
+   std::vector<vk::PipelineStageFlags> waitStages (submission.waitSemaphores.size (), waitStage);
+
+   vk::SubmitInfo submitInfo = {};
+   submitInfo.waitSemaphoreCount = static_cast<uint32_t> (submission.waitSemaphores.size ());
+   submitInfo.pWaitSemaphores = submission.waitSemaphores.data ();
+   submitInfo.pWaitDstStageMask = waitStages.data ();
+   submitInfo.commandBufferCount = 1;
+   submitInfo.pCommandBuffers = &commandBuffer;
+   submitInfo.signalSemaphoreCount = 1;
+   submitInfo.pSignalSemaphores = &submission.signalSemaphore;
+
+   if (queue.submit (1, &submitInfo, submission.fence) != vk::Result::eSuccess)
+   {
+      throw std::runtime_error ("failed to submit transfer command buffer!");
+   }
+
+   pending.push_back (submission);
+
+   TransferHandle handle;
+   handle.id = submission.id;
+   return handle;
+}
+
+bool TransferScheduler::isComplete (TransferHandle handle)
+{
+   Submission* submission = find (handle);
+
+   if (!submission)
+   {
+      return true;
+   }
+
+   if (device.getFenceStatus (submission->fence) != vk::Result::eSuccess)
+   {
+      return false;
+   }
+
+   retire (static_cast<size_t> (submission - pending.data ()));
+   return true;
+}
+
+void TransferScheduler::wait (TransferHandle handle)
+{
+   Submission* submission = find (handle);
+
+   if (!submission)
+   {
+      return;
+   }
+
+   device.waitForFences (1, &submission->fence, VK_TRUE, std::numeric_limits<uint64_t>::max ());
+   retire (static_cast<size_t> (submission - pending.data ()));
+}
+
+void TransferScheduler::whenComplete (TransferHandle handle, std::function<void ()> callback)
+{
+   Submission* submission = find (handle);
+
+   if (!submission)
+   {
+      callback ();
+      return;
+   }
+
+   submission->onComplete.push_back (callback);
+}
+
+void TransferScheduler::retireCompleted ()
+{
+   for (size_t i = 0; i < pending.size ();)
+   {
+      if (device.getFenceStatus (pending[i].fence) == vk::Result::eSuccess)
+      {
+         retire (i);
+      }
+      else
+      {
+         ++i;
+      }
+   }
+}
+
+TransferScheduler::Submission* TransferScheduler::find (TransferHandle handle)
+{
+   auto submission = std::find_if (pending.begin (), pending.end (), [&] (const Submission& other) { return other.id == handle.id; });
+
+   return submission != pending.end () ? &*submission : nullptr;
+}
+
+void TransferScheduler::retire (size_t index)
+{
+   Submission submission = pending[index];
+   pending.erase (pending.begin () + index);
+
+   device.resetFences (1, &submission.fence);
+   freeFences.push_back (submission.fence);
+
+   submission.commandBuffer.reset (vk::CommandBufferResetFlags ());
+   freeCommandBuffers[VkCommandPool (submission.commandPool)].push_back (submission.commandBuffer);
+
+   freeSemaphores.insert (freeSemaphores.end (), submission.waitSemaphores.begin (), submission.waitSemaphores.end ());
+
+   //Nobody waited on it, a signaled semaphore cannot be signaled again so it is not recycled
+   if (submission.signalSemaphore)
+   {
+      device.destroySemaphore (submission.signalSemaphore, allocationCallbacks);
+   }
+
+   for (auto& callback : submission.onComplete)
+   {
+      callback ();
+   }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+//Identifies one submission, a default constructed handle counts as already complete
+struct TransferHandle
+{
+   uint64_t id;
+
+   TransferHandle () : id (0) {}
+};
+
+//Submits one time command buffers without blocking. Every submission gets a fence, and a semaphore other submissions
+//can wait on to chain GPU work. Command buffers, fences and semaphores are recycled once their submission retires.
+class TransferScheduler
+{
+private:
+
+   struct Submission
+   {
+      uint64_t id;
+      vk::Fence fence;
+      vk::CommandBuffer commandBuffer;
+      vk::CommandPool commandPool;
+      vk::Semaphore signalSemaphore; //Null once handed to a chained submission
+      std::vector<vk::Semaphore> waitSemaphores; //Unsignaled again once this submission has executed
+      std::vector<std::function<void ()>> onComplete;
+   };
+
+   vk::Device device;
+   const vk::AllocationCallbacks* allocationCallbacks;
+
+   uint64_t nextId;
+   std::vector<Submission> pending; //In submission order
+
+   std::map<VkCommandPool, std::vector<vk::CommandBuffer>> freeCommandBuffers; //Pools need eResetCommandBuffer
+   std::vector<vk::Fence> freeFences;
+   std::vector<vk::Semaphore> freeSemaphores;
+
+public:
+   TransferScheduler ();
+
+   void init (vk::Device device, const vk::AllocationCallbacks* allocationCallbacks);
+   void destroy (); //Waits for everything still in flight
+
+   vk::CommandBuffer begin (vk::CommandPool commandPool);
+
+   //Ends and submits the command buffer. Each handle in waitFor can be chained on by one submission only.
+   TransferHandle submit (vk::CommandBuffer commandBuffer, vk::CommandPool commandPool, vk::Queue queue,
+                          const std::vector<TransferHandle>& waitFor = std::vector<TransferHandle> (),
+                          vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eAllCommands);
+
+   bool isComplete (TransferHandle handle);
+   void wait (TransferHandle handle);
+
+   //Runs on the thread that retires the submission, or right away if it already has. Staging buffers are released here.
+   void whenComplete (TransferHandle handle, std::function<void ()> callback);
+
+   void retireCompleted (); //Polls every pending submission, meant to be called once per frame
+
+private:
+   Submission* find (TransferHandle handle);
+   void retire (size_t index);
+};
@@ -0,0 +1,134 @@
+#include "TransformArray.h"
+
+#include <algorithm>
+
+#if defined (_M_X64) || defined (_M_IX86) || defined (__SSE__)
+#define TRANSFORM_ARRAY_SSE
+#include <xmmintrin.h>
+#endif
+
+static size_t roundUpToFour (size_t value)
+{
+   return (value + 3) & ~static_cast<size_t> (3);
+}
+
+TransformArray::TransformArray () : count (0), stride (0)
+{
+}
+
+void TransformArray::resize (size_t count)
+{
+   size_t newStride = roundUpToFour (count);
+   std::vector<float> newElements (16 * newStride, 0.0f);
+
+   size_t kept = std::min (count, this->count);
+
+   for (size_t e = 0; e < 16; ++e)
+   {
+      std::copy (elements.begin () + e * stride, elements.begin () + e * stride + kept, newElements.begin () + e * newStride);
+   }
+
+   elements.swap (newElements);
+   stride = newStride;
+   this->count = count;
+
+   for (size_t i = kept; i < count; ++i)
+   {
+      set (i, glm::mat4 (1.0f));
+   }
+}
+
+size_t TransformArray::size () const
+{
+   return count;
+}
+
+void TransformArray::set (size_t index, const glm::mat4& matrix)
+{
+   const float* values = &matrix[0][0];
+
+   for (size_t e = 0; e < 16; ++e)
+   {
+      elements[e * stride + index] = values[e];
+   }
+}
+
+glm::mat4 TransformArray::get (size_t index) const
+{
+   glm::mat4 matrix;
+   float* values = &matrix[0][0];
+
+   for (size_t e = 0; e < 16; ++e)
+   {
+      values[e] = elements[e * stride + index];
+   }
+
+   return matrix;
+}
+
+void TransformArray::multiply (const glm::mat4& left, float* out) const
+{
+#ifdef TRANSFORM_ARRAY_SSE
+   //Every element of left is the same for all four lanes, so it is broadcast once up front
+   __m128 leftElements[4][4];
+
+   for (int column = 0; column < 4; ++column)
+   {
+      for (int row = 0; row < 4; ++row)
+      {
+         leftElements[column][row] = _mm_set1_ps (left[column][row]);
+      }
+   }
+
+   for (size_t first = 0; first < count; first += 4)
+   {
+      size_t lanes = std::min<size_t> (count - first, 4);
+
+      for (int column = 0; column < 4; ++column)
+      {
+         __m128 right[4];
+
+         for (int k = 0; k < 4; ++k)
+         {
+            right[k] = _mm_loadu_ps (&elements[(column * 4 + k) * stride + first]);
+         }
+
+         __m128 result[4];
+
+         for (int row = 0; row < 4; ++row)
+         {
+            result[row] = _mm_mul_ps (leftElements[0][row], right[0]);
+            result[row] = _mm_add_ps (result[row], _mm_mul_ps (leftElements[1][row], right[1]));
+            result[row] = _mm_add_ps (result[row], _mm_mul_ps (leftElements[2][row], right[2]));
+            result[row] = _mm_add_ps (result[row], _mm_mul_ps (leftElements[3][row], right[3]));
+         }
+
+         //Lane i of result[row] belongs to matrix first + i, the transpose turns that into one column per matrix
+         _MM_TRANSPOSE4_PS (result[0], result[1], result[2], result[3]);
+
+         for (size_t lane = 0; lane < lanes; ++lane)
+         {
+            _mm_storeu_ps (out + (first + lane) * 16 + column * 4, result[lane]);
+         }
+      }
+   }
+#else
+   for (size_t i = 0; i < count; ++i)
+   {
+      for (int column = 0; column < 4; ++column)
+      {
+         for (int row = 0; row < 4; ++row)
+         {
+            float sum = 0.0f;
+
+            for (int k = 0; k < 4; ++k)
+            {
+               sum += left[k][row] * elements[(column * 4 + k) * stride + i];
+            }
+
+            out[i * 16 + column * 4 + row] = sum;
+         }
+      }
+   }
+#endif
+}
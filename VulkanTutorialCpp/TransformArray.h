@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+//Matrices stored structure of arrays: each of the 16 elements has its own row of floats, padded to a multiple of four,
+//so one load fetches the same element of four matrices and the batch multiply never shuffles its inputs
+class TransformArray
+{
+private:
+   std::vector<float> elements; //Element e of matrix i is at e * stride + i
+   size_t count;
+   size_t stride;
+
+public:
+   TransformArray ();
+
+   void resize (size_t count); //New matrices start as identity
+   size_t size () const;
+
+   void set (size_t index, const glm::mat4& matrix);
+   glm::mat4 get (size_t index) const;
+
+   //out receives left * matrix for every matrix, as consecutive column major mat4s ready to copy into a buffer
+   void multiply (const glm::mat4& left, float* out) const;
+};
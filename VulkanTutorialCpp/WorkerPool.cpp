@@ -0,0 +1,119 @@
+#include "WorkerPool.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <string>
+
+WorkerPool::WorkerPool (uint32_t threadCount) : job (nullptr), generation (0), remaining (0), stopping (false)
+{
+   for (uint32_t i = 1; i < std::max (threadCount, 1u); ++i)
+   {
+      workers.emplace_back (&WorkerPool::workerLoop, this, i);
+   }
+}
+
+WorkerPool::~WorkerPool ()
+{
+   {
+      std::lock_guard<std::mutex> lock (mutex);
+      stopping = true;
+   }
+
+   jobReady.notify_all ();
+
+   for (auto& worker : workers)
+   {
+      worker.join ();
+   }
+}
+
+void WorkerPool::run (const std::function<void (uint32_t threadIndex)>& task)
+{
+   {
+      std::lock_guard<std::mutex> lock (mutex);
+      job = &task;
+      failure = nullptr;
+      remaining = static_cast<uint32_t> (workers.size ());
+      ++generation;
+   }
+
+   jobReady.notify_all ();
+
+   std::exception_ptr callerFailure;
+
+   try
+   {
+      task (0);
+   }
+   catch (...)
+   {
+      callerFailure = std::current_exception ();
+   }
+
+   std::unique_lock<std::mutex> lock (mutex);
+   jobDone.wait (lock, [this] { return remaining == 0; });
+   job = nullptr;
+
+   if (callerFailure)
+   {
+      std::rethrow_exception (callerFailure);
+   }
+
+   if (failure)
+   {
+      std::rethrow_exception (failure);
+   }
+}
+
+uint32_t WorkerPool::getThreadCount () const
+{
+   return static_cast<uint32_t> (workers.size ()) + 1;
+}
+
+void WorkerPool::workerLoop (uint32_t threadIndex)
+{
+   uint64_t lastGeneration = 0;
+
+   Profiler::setThreadName ("worker " + std::to_string (threadIndex));
+
+   for (;;)
+   {
+      const std::function<void (uint32_t)>* task;
+
+      {
+         std::unique_lock<std::mutex> lock (mutex);
+         jobReady.wait (lock, [&] { return stopping || generation != lastGeneration; });
+
+         if (stopping)
+         {
+            return;
+         }
+
+         lastGeneration = generation;
+         task = job;
+      }
+
+      std::exception_ptr taskFailure;
+
+      try
+      {
+         (*task) (threadIndex);
+      }
+      catch (...)
+      {
+         taskFailure = std::current_exception ();
+      }
+
+      std::lock_guard<std::mutex> lock (mutex);
+
+      if (taskFailure && !failure)
+      {
+         failure = taskFailure;
+      }
+
+      if (--remaining == 0)
+      {
+         jobDone.notify_one ();
+      }
+   }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Persistent threads for work that is split the same way every frame. Spawning threads per frame costs more than
+//recording a few hundred draws, so the workers stay parked on a condition variable between jobs.
+class WorkerPool
+{
+private:
+   std::vector<std::thread> workers;
+
+   std::mutex mutex;
+   std::condition_variable jobReady;
+   std::condition_variable jobDone;
+
+   const std::function<void (uint32_t)>* job; //Only valid while run is executing
+   uint64_t generation; //Bumped for every job so a worker never runs the same one twice
+   uint32_t remaining; //Workers still busy with the current job
+   std::exception_ptr failure; //First exception thrown by a worker, rethrown by run
+   bool stopping;
+
+public:
+   //threadCount includes the thread calling run, so threadCount - 1 workers are started
+   explicit WorkerPool (uint32_t threadCount);
+   ~WorkerPool ();
+
+   WorkerPool (const WorkerPool&) = delete;
+   WorkerPool& operator= (const WorkerPool&) = delete;
+
+   //Calls task once on every thread with its index, the caller being thread 0, and returns when all have finished
+   void run (const std::function<void (uint32_t threadIndex)>& task);
+
+   uint32_t getThreadCount () const;
+
+private:
+   void workerLoop (uint32_t threadIndex);
+};
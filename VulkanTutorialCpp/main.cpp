@@ -1,13 +1,160 @@
 #include <iostream>
 #include <stdexcept>
+#include <string>
 
 #include "HelloTriangleApplication.h"
+#include "OptionParsing.h"
 
-int main ()
+static bool parsePresentMode (const std::string& name, vk::PresentModeKHR& presentMode)
+{
+   if (name == "immediate")
+   {
+      presentMode = vk::PresentModeKHR::eImmediate;
+   }
+   else if (name == "mailbox")
+   {
+      presentMode = vk::PresentModeKHR::eMailbox;
+   }
+   else if (name == "fifo")
+   {
+      presentMode = vk::PresentModeKHR::eFifo;
+   }
+   else if (name == "fifo-relaxed")
+   {
+      presentMode = vk::PresentModeKHR::eFifoRelaxed;
+   }
+   else
+   {
+      return false;
+   }
+
+   return true;
+}
+
+static ApplicationOptions parseOptions (int argc, char* argv[])
+{
+   ApplicationOptions options;
+
+   for (int i = 1; i < argc; ++i)
+   {
+      std::string arg = argv[i];
+
+      if (arg == "--benchmark-sharing")
+      {
+         options.benchmarkSharingModes = true;
+      }
+      else if (arg == "--sequential-init")
+      {
+         options.sequentialInit = true;
+      }
+      else if (arg == "--benchmark-frames-in-flight")
+      {
+         options.benchmarkFramesInFlight = true;
+      }
+      else if (arg == "--benchmark-resize")
+      {
+         options.benchmarkResize = true;
+      }
+      else if (arg == "--frames-in-flight" && i + 1 < argc)
+      {
+         options.framesInFlight = parseUnsigned (arg, argv[++i]);
+      }
+      else if (arg == "--draw-count" && i + 1 < argc)
+      {
+         options.drawCount = parseUnsigned (arg, argv[++i]);
+      }
+      else if (arg == "--animate-draws" && i + 1 < argc)
+      {
+         options.animatedDraws = parseUnsigned (arg, argv[++i]);
+      }
+      else if (arg == "--no-command-cache")
+      {
+         options.cacheDrawCommands = false;
+      }
+      else if (arg == "--present-mode" && i + 1 < argc)
+      {
+         std::string name = argv[++i];
+
+         if (!parsePresentMode (name, options.presentMode))
+         {
+            std::cerr << "ignoring unknown present mode: " << name << std::endl;
+         }
+      }
+      else if (arg == "--swapchain-images" && i + 1 < argc)
+      {
+         options.swapChainImageCount = parseUnsigned (arg, argv[++i]);
+      }
+      else if (arg == "--target-fps" && i + 1 < argc)
+      {
+         options.targetFrameRate = parseDouble (arg, argv[++i]);
+      }
+      else if (arg == "--profile" && i + 1 < argc)
+      {
+         options.profileOutput = argv[++i];
+      }
+      else if (arg == "--headless")
+      {
+         options.headless = true;
+      }
+      else if (arg == "--frames" && i + 1 < argc)
+      {
+         options.headlessFrames = parseUnsigned (arg, argv[++i]);
+      }
+      else if (arg == "--time-step" && i + 1 < argc)
+      {
+         options.timeStep = parseDouble (arg, argv[++i]);
+      }
+      else if (arg == "--record-time" && i + 1 < argc)
+      {
+         options.recordTimePath = argv[++i];
+      }
+      else if (arg == "--replay-time" && i + 1 < argc)
+      {
+         options.replayTimePath = argv[++i];
+      }
+      else if (arg == "--checksum")
+      {
+         options.checksum = true;
+      }
+      else if (arg == "--gpu-timing")
+      {
+         options.gpuTiming = true;
+      }
+      else if (arg == "--recording-threads" && i + 1 < argc)
+      {
+         options.recordingThreads = parseUnsigned (arg, argv[++i]);
+      }
+      else if (arg == "--precomputed-mvp")
+      {
+         options.precomputeTransforms = true;
+      }
+      else if (arg == "--instances" && i + 1 < argc)
+      {
+         options.instanceCount = parseUnsigned (arg, argv[++i]);
+      }
+      else if (arg == "--gpu-culling")
+      {
+         options.gpuCulling = true;
+      }
+      else if (arg == "--occlusion-culling")
+      {
+         options.gpuCulling = true;
+         options.occlusionCulling = true;
+      }
+      else
+      {
+         std::cerr << "ignoring unknown option: " << arg << std::endl;
+      }
+   }
+
+   return options;
+}
+
+int main (int argc, char* argv[])
 {
-   HelloTriangleApplication app;
    try
    {
+      HelloTriangleApplication app (parseOptions (argc, argv));
       app.run ();
    }
    catch (const std::runtime_error& e)
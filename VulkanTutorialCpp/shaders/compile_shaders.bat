@@ -1,3 +1,7 @@
 C:/VulkanSDK/1.0.65.1/Bin32/glslangValidator.exe -V shader.vert
 C:/VulkanSDK/1.0.65.1/Bin32/glslangValidator.exe -V shader.frag
+C:/VulkanSDK/1.0.65.1/Bin32/glslangValidator.exe -V shader_mvp.vert -o vert_mvp.spv
+C:/VulkanSDK/1.0.65.1/Bin32/glslangValidator.exe -V cull.comp -o cull.spv
+C:/VulkanSDK/1.0.65.1/Bin32/glslangValidator.exe -V cull.comp -DOCCLUSION -o cull_occlusion.spv
+C:/VulkanSDK/1.0.65.1/Bin32/glslangValidator.exe -V depth_reduce.comp -o depth_reduce.spv
 pause
\ No newline at end of file
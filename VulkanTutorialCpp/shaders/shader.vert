@@ -3,14 +3,20 @@
 
 layout (binding = 0) uniform UniformBufferObject 
 {
-	mat4 model;
 	mat4 view;
 	mat4 proj;
 } ubo;
 
+layout (push_constant) uniform PushConstants
+{
+	mat4 model;
+	uint drawIndex;
+} pushConstants;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in mat4 inInstanceModel;
 
 layout (location = 0) out vec3 fragColor;
 layout (location = 1) out vec2 fragTexCoord;
@@ -22,7 +28,7 @@ out gl_PerVertex
 
 void main ()
 {
-	gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+	gl_Position = ubo.proj * (ubo.view * (pushConstants.model * (inInstanceModel * vec4(inPosition, 1.0))));
 
 	fragColor = inColor;
 	fragTexCoord = inTexCoord;
@@ -0,0 +1,35 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+//The model view projection of every draw is concatenated on the CPU
+layout (binding = 2) readonly buffer Transforms
+{
+	mat4 mvp[];
+} transforms;
+
+layout (push_constant) uniform PushConstants
+{
+	mat4 model;
+	uint drawIndex;
+} pushConstants;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in mat4 inInstanceModel;
+
+layout (location = 0) out vec3 fragColor;
+layout (location = 1) out vec2 fragTexCoord;
+
+out gl_PerVertex 
+{
+	vec4 gl_Position;
+};
+
+void main ()
+{
+	gl_Position = transforms.mvp[pushConstants.drawIndex] * (inInstanceModel * vec4(inPosition, 1.0));
+
+	fragColor = inColor;
+	fragTexCoord = inTexCoord;
+}
\ No newline at end of file